@@ -24,20 +24,62 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-PKGCONFIG += libavformat libavcodec libavutil libswscale
+PKGCONFIG += libavformat libavcodec libavutil libswscale libswresample zlib
 
 SOURCES += \
     main.cpp \
     mainwindow.cpp \
     inputfilesmodel.cpp \
+    inputfilesproxymodel.cpp \
     preferences.cpp \
-    mediautility.cpp
+    mediautility.cpp \
+    workerpool.cpp \
+    filescheduler.cpp \
+    fingerprintengine.cpp \
+    lumascaler.cpp \
+    duplicategroupsmodel.cpp \
+    thumbnailstore.cpp \
+    tracer.cpp \
+    archivereader.cpp \
+    fileverifier.cpp \
+    fingerprintcache.cpp \
+    closestpairs.cpp \
+    fingerprintcatalog.cpp \
+    allpairsengine.cpp \
+    pairstore.cpp \
+    concurrencycontroller.cpp \
+    fingerprintprofile.cpp \
+    scancommand.cpp \
+    lumabenchmark.cpp \
+    keyedlog.cpp \
+    scanpipeline.cpp
 
 HEADERS += \
     mainwindow.h \
     inputfilesmodel.h \
+    inputfilesproxymodel.h \
     preferences.h \
-    mediautility.h
+    mediautility.h \
+    workerpool.h \
+    filescheduler.h \
+    fingerprintengine.h \
+    lumascaler.h \
+    duplicategroupsmodel.h \
+    thumbnailstore.h \
+    tracer.h \
+    archivereader.h \
+    fileverifier.h \
+    fingerprintcache.h \
+    closestpairs.h \
+    fingerprintcatalog.h \
+    allpairsengine.h \
+    pairstore.h \
+    concurrencycontroller.h \
+    fingerprintprofile.h \
+    scancommand.h \
+    lumabenchmark.h \
+    keyedlog.h \
+    scanpipeline.h
 
 FORMS += \
     mainwindow.ui \
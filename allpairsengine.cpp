@@ -0,0 +1,402 @@
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QFutureSynchronizer>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	#define ALL_PAIRS_X86
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define ALL_PAIRS_INLINE inline __attribute__((always_inline))
+#else
+	#define ALL_PAIRS_INLINE inline
+#endif
+
+#include "allpairsengine.h"
+#include "pairstore.h"
+#include "preferences.h"
+
+const char *AllPairsEngine::ARGUMENT = "--all-pairs";
+// Two tiles take half of a small L2, leaving the rest for everything else going on.
+const int AllPairsEngine::TILE_BYTES = 128 * 1024;
+const int AllPairsEngine::OUTPUT_BATCH = 4096;
+
+typedef quint64 (*TileKernel)(const FingerprintCatalog &catalog,
+							  const quint64 rowBegin, const quint64 rowEnd,
+							  const quint64 columnBegin, const quint64 columnEnd,
+							  const double maxDifference, QVector<AllPairsEngine::Match> &matches);
+
+/*
+ * Compares records rowBegin to rowEnd with columnBegin to columnEnd, only ever
+ * a record with one after it. Returns the number of pairs compared.
+ */
+template <size_t SAMPLE_SIZE>
+static ALL_PAIRS_INLINE quint64 compareRecords(const FingerprintCatalog &catalog,
+											   const quint64 rowBegin, const quint64 rowEnd,
+											   const quint64 columnBegin, const quint64 columnEnd,
+											   const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	quint64 compared = 0;
+
+	for (quint64 i = rowBegin; i < rowEnd; i++) {
+		const uchar *record = catalog.getRecord(i);
+		quint32 samples = 0;
+
+		memcpy(&samples, record, sizeof(samples));
+
+		for (quint64 j = qMax(columnBegin, i + 1); j < columnEnd; j++) {
+			const uchar *otherRecord = catalog.getRecord(j);
+			quint32 otherSamples = 0;
+			int bits = 0;
+
+			memcpy(&otherSamples, otherRecord, sizeof(otherSamples));
+
+			if (!(samples & otherSamples))
+				continue;
+
+			int diff = getSampledDifference<SAMPLE_SIZE>(record + FingerprintCatalog::RECORD_HEADER_SIZE,
+														 otherRecord + FingerprintCatalog::RECORD_HEADER_SIZE,
+														 samples & otherSamples,
+														 maxDifference,
+														 &bits);
+
+			compared++;
+
+			if (diff <= maxDifference * bits) {
+				AllPairsEngine::Match match;
+
+				match.index = i;
+				match.otherIndex = j;
+				match.distance = static_cast<float>(diff) / bits;
+				matches.append(match);
+			}
+		}
+	}
+
+	return compared;
+}
+
+static quint64 compareDHashTiles(const FingerprintCatalog &catalog, const quint64 rowBegin, const quint64 rowEnd, const quint64 columnBegin, const quint64 columnEnd, const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	return compareRecords<DHashEngine::SAMPLE_SIZE>(catalog, rowBegin, rowEnd, columnBegin, columnEnd, maxDifference, matches);
+}
+
+static quint64 comparePHashTiles(const FingerprintCatalog &catalog, const quint64 rowBegin, const quint64 rowEnd, const quint64 columnBegin, const quint64 columnEnd, const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	return compareRecords<PHashEngine::SAMPLE_SIZE>(catalog, rowBegin, rowEnd, columnBegin, columnEnd, maxDifference, matches);
+}
+
+static quint64 comparePHash16Tiles(const FingerprintCatalog &catalog, const quint64 rowBegin, const quint64 rowEnd, const quint64 columnBegin, const quint64 columnEnd, const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	return compareRecords<PHash16Engine::SAMPLE_SIZE>(catalog, rowBegin, rowEnd, columnBegin, columnEnd, maxDifference, matches);
+}
+
+#ifdef ALL_PAIRS_X86
+/*
+ * The same loops built with the POPCNT instruction, which baseline x86-64 doesn't
+ * have. Without it every word takes a dozen instructions to count.
+ */
+__attribute__((target("popcnt")))
+static quint64 compareDHashTilesPopcnt(const FingerprintCatalog &catalog, const quint64 rowBegin, const quint64 rowEnd, const quint64 columnBegin, const quint64 columnEnd, const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	return compareRecords<DHashEngine::SAMPLE_SIZE>(catalog, rowBegin, rowEnd, columnBegin, columnEnd, maxDifference, matches);
+}
+
+__attribute__((target("popcnt")))
+static quint64 comparePHashTilesPopcnt(const FingerprintCatalog &catalog, const quint64 rowBegin, const quint64 rowEnd, const quint64 columnBegin, const quint64 columnEnd, const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	return compareRecords<PHashEngine::SAMPLE_SIZE>(catalog, rowBegin, rowEnd, columnBegin, columnEnd, maxDifference, matches);
+}
+
+__attribute__((target("popcnt")))
+static quint64 comparePHash16TilesPopcnt(const FingerprintCatalog &catalog, const quint64 rowBegin, const quint64 rowEnd, const quint64 columnBegin, const quint64 columnEnd, const double maxDifference, QVector<AllPairsEngine::Match> &matches)
+{
+	return compareRecords<PHash16Engine::SAMPLE_SIZE>(catalog, rowBegin, rowEnd, columnBegin, columnEnd, maxDifference, matches);
+}
+
+static bool hasPopcnt()
+{
+	static const bool popcnt = __builtin_cpu_supports("popcnt");
+
+	return popcnt;
+}
+#endif
+
+static TileKernel getTileKernel(const FINGERPRINT_ENGINE engine)
+{
+#ifdef ALL_PAIRS_X86
+	if (hasPopcnt()) {
+		switch (engine) {
+			case FINGERPRINT_ENGINE_PHASH:
+				return comparePHashTilesPopcnt;
+
+			case FINGERPRINT_ENGINE_PHASH_16:
+				return comparePHash16TilesPopcnt;
+
+			case FINGERPRINT_ENGINE_DHASH:
+			default:
+				return compareDHashTilesPopcnt;
+		}
+	}
+#endif
+
+	switch (engine) {
+		case FINGERPRINT_ENGINE_PHASH:
+			return comparePHashTiles;
+
+		case FINGERPRINT_ENGINE_PHASH_16:
+			return comparePHash16Tiles;
+
+		case FINGERPRINT_ENGINE_DHASH:
+		default:
+			return compareDHashTiles;
+	}
+}
+
+AllPairsEngine::AllPairsEngine(const FingerprintCatalog &catalog): catalog(catalog), comparisons(0)
+{
+	tileSize = qMax<quint64>(64, static_cast<quint64>(TILE_BYTES / catalog.getRecordSize()));
+	tiles = (catalog.getCount() + tileSize - 1) / tileSize;
+}
+
+/*
+ * Calls output with batches of the pairs within maxDifference, from one thread
+ * at a time, in no particular order. Returns the number of pairs compared.
+ */
+quint64 AllPairsEngine::run(const double maxDifference, const int threads, const Output output)
+{
+	QFutureSynchronizer<void> workers;
+
+	queues.clear();
+	comparisons = 0;
+
+	for (int i = 0; i < threads; i++)
+		queues.append(new Queue());
+
+	// Rows are dealt out in turn, so every thread gets long and short ones alike.
+	for (quint64 row = 0; row < tiles; row++) {
+		Task task;
+
+		task.row = row;
+		task.from = row;
+		task.to = tiles;
+
+		queues[static_cast<int>(row % static_cast<quint64>(threads))]->tasks.prepend(task);
+	}
+
+	for (int i = 0; i < threads; i++) {
+		workers.addFuture(QtConcurrent::run([=]() {
+			work(i, maxDifference, output);
+		}));
+	}
+
+	workers.waitForFinished();
+
+	qDeleteAll(queues);
+	queues.clear();
+
+	return comparisons;
+}
+
+void AllPairsEngine::work(const int worker, const double maxDifference, const Output &output)
+{
+	TileKernel kernel = getTileKernel(catalog.getEngine());
+	QVector<Match> matches;
+	quint64 row = 0;
+	quint64 column = 0;
+	quint64 compared = 0;
+
+	while (take(worker, row, column) || (steal(worker) && take(worker, row, column))) {
+		quint64 columnEnd = qMin((column + 1) * tileSize, catalog.getCount());
+
+		// The row tile stays put while the columns go by, read the next one in while this one's compared.
+		catalog.prefetch(columnEnd, tileSize);
+
+		compared += kernel(catalog,
+						   row * tileSize, qMin((row + 1) * tileSize, catalog.getCount()),
+						   column * tileSize, columnEnd,
+						   maxDifference, matches);
+
+		if (matches.length() >= OUTPUT_BATCH) {
+			QMutexLocker lock(&outputMutex);
+
+			output(matches);
+			matches.clear();
+		}
+	}
+
+	if (!matches.isEmpty()) {
+		QMutexLocker lock(&outputMutex);
+
+		output(matches);
+	}
+
+	comparisons += compared;
+}
+
+// Takes the next tile pair from the newest row in the worker's own queue.
+bool AllPairsEngine::take(const int worker, quint64 &row, quint64 &column)
+{
+	Queue *queue = queues[worker];
+	QMutexLocker lock(&queue->mutex);
+
+	while (!queue->tasks.isEmpty()) {
+		Task &task = queue->tasks.last();
+
+		if (task.from < task.to) {
+			row = task.row;
+			column = task.from++;
+
+			return true;
+		}
+
+		queue->tasks.removeLast();
+	}
+
+	return false;
+}
+
+// Moves half of the oldest row another worker has left into our own queue.
+bool AllPairsEngine::steal(const int worker)
+{
+	for (int i = 1; i < queues.length(); i++) {
+		Queue *victim = queues[(worker + i) % queues.length()];
+		Task stolen;
+
+		{
+			QMutexLocker lock(&victim->mutex);
+
+			while (!victim->tasks.isEmpty() && victim->tasks.first().from >= victim->tasks.first().to)
+				victim->tasks.removeFirst();
+
+			if (victim->tasks.isEmpty())
+				continue;
+
+			Task &task = victim->tasks.first();
+
+			stolen = task;
+
+			// A single tile pair is taken whole, the victim's already busy with something else.
+			if (task.to - task.from > 1) {
+				stolen.from = task.from + (task.to - task.from) / 2;
+				task.to = stolen.from;
+			} else {
+				victim->tasks.removeFirst();
+			}
+		}
+
+		QMutexLocker lock(&queues[worker]->mutex);
+
+		queues[worker]->tasks.append(stolen);
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Takes a catalog, and optionally the similarity threshold and the number of
+ * threads, and writes the distance and paths of every pair within the threshold
+ * to standard output, one pair per line, closest first.
+ *
+ * The catalog is compared at the loosest threshold and the pairs are saved next
+ * to it, so asking again with another threshold only reads them back.
+ */
+int AllPairsEngine::runCommand(const QStringList arguments)
+{
+	QTextStream out(stdout);
+	QTextStream err(stderr);
+	FingerprintCatalog catalog;
+	PairStore pairs;
+	int threshold = Preferences::DEFAULT_SIMILARITY_THRESHOLD;
+	int threads = QThread::idealThreadCount();
+	bool ok = true;
+
+	if (arguments.length() > 1)
+		threshold = arguments[1].toInt(&ok);
+
+	if (ok && arguments.length() > 2)
+		threads = arguments[2].toInt(&ok);
+
+	if (arguments.isEmpty() || arguments.length() > 3 || !ok || threshold < PairStore::LOOSEST_THRESHOLD || threshold > 100 || threads < 1) {
+		err << "Usage: SameDifference " << ARGUMENT << " <catalog> [threshold " << PairStore::LOOSEST_THRESHOLD << "-100] [threads]\n";
+
+		return 2;
+	}
+
+	if (!catalog.open(arguments[0])) {
+		err << "Could not read catalog " << arguments[0] << "\n";
+
+		return 1;
+	}
+
+	// PairStore numbers files with 32 bits.
+	if (catalog.getCount() > UINT32_MAX) {
+		err << "Catalog " << arguments[0] << " has too many files\n";
+
+		return 1;
+	}
+
+	QString pairsPath = arguments[0] + ".pairs";
+	QByteArray source = QByteArray::number(catalog.getCount()) + ':' + QByteArray::number(QFileInfo(arguments[0]).lastModified().toMSecsSinceEpoch());
+	QElapsedTimer timer;
+
+	timer.start();
+
+	if (pairs.load(pairsPath, source)) {
+		err << "Pairs read from " << pairsPath << " in " << timer.elapsed() / 1000.0 << " s\n";
+	} else {
+		AllPairsEngine engine(catalog);
+
+		QThreadPool::globalInstance()->setMaxThreadCount(qMax(threads, QThreadPool::globalInstance()->maxThreadCount()));
+
+		quint64 compared = engine.run(PairStore::MAX_DIFFERENCE, threads, [&](const QVector<Match> &matches) {
+			QVector<PairStore::Pair> found;
+
+			found.reserve(matches.length());
+
+			foreach (Match match, matches) {
+				PairStore::Pair pair;
+
+				pair.distance = match.distance;
+				pair.id = static_cast<quint32>(match.index);
+				pair.otherId = static_cast<quint32>(match.otherIndex);
+				found.append(pair);
+			}
+
+			pairs.add(found);
+		});
+
+		double seconds = qMax<qint64>(timer.elapsed(), 1) / 1000.0;
+
+		err << catalog.getCount() << " files, " << compared << " pairs compared in " << seconds << " s ("
+			<< static_cast<quint64>(compared / seconds) << " per second)\n";
+
+		if (!pairs.save(pairsPath, source))
+			err << "Could not write " << pairsPath << "\n";
+	}
+
+	// The same scale as the similarity slider.
+	QVector<PairStore::Pair> matched = pairs.getPairs((100 - threshold) / 200.0);
+
+	foreach (PairStore::Pair pair, matched) {
+		out << QString::number(static_cast<double>(pair.distance), 'f', 4) << '\t'
+			<< catalog.getPath(pair.id) << '\t'
+			<< catalog.getPath(pair.otherId) << '\n';
+	}
+
+	out.flush();
+
+	err << matched.length() << " pairs within the threshold\n";
+
+	return 0;
+}
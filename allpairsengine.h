@@ -0,0 +1,73 @@
+#ifndef ALLPAIRSENGINE_H
+#define ALLPAIRSENGINE_H
+
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+
+#include "fingerprintcatalog.h"
+
+/*
+ * Compares every file in a catalog with every other, for deduplicating a whole
+ * archive offline rather than one file at a time as files come in. The records
+ * are cut into tiles small enough that two fit in L2, and every tile is
+ * compared with itself and each tile after it, so each record loaded from
+ * memory is compared with a whole tile of others.
+ *
+ * Each thread starts with its own rows of tiles. A row is taken one tile pair
+ * at a time from its end of the thread's queue, and a thread that runs out
+ * steals half of what's left of the row at the other end of another thread's
+ * queue. The triangle of tile pairs stays balanced without any planning.
+ *
+ * The catalog is mapped, and the tile after the current one is read ahead,
+ * so a catalog larger than memory is streamed through rather than loaded.
+ */
+class AllPairsEngine
+{
+	public:
+		static const char *ARGUMENT;
+		static const int TILE_BYTES;
+		static const int OUTPUT_BATCH;
+
+		struct Match {
+			quint64 index;
+			quint64 otherIndex;
+			float distance;
+		};
+
+		typedef std::function<void(const QVector<Match> &matches)> Output;
+
+		explicit AllPairsEngine(const FingerprintCatalog &catalog);
+
+		quint64 run(const double maxDifference, const int threads, const Output output);
+		static int runCommand(const QStringList arguments);
+
+	private:
+		// The tile pairs (row, from) to (row, to - 1) that are still to be compared.
+		struct Task {
+			quint64 row;
+			quint64 from;
+			quint64 to;
+		};
+
+		struct Queue {
+			QMutex mutex;
+			QVector<Task> tasks;
+		};
+
+		const FingerprintCatalog &catalog;
+		quint64 tileSize;
+		quint64 tiles;
+		QVector<Queue *> queues;
+		QMutex outputMutex;
+		std::atomic<quint64> comparisons;
+
+		void work(const int worker, const double maxDifference, const Output &output);
+		bool take(const int worker, quint64 &row, quint64 &column);
+		bool steal(const int worker);
+};
+
+#endif // ALLPAIRSENGINE_H
@@ -0,0 +1,709 @@
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <zlib.h>
+
+#include "archivereader.h"
+
+const char *ArchiveReader::SEPARATOR = "!/";
+const int ArchiveReader::CACHED_ARCHIVES = 4;
+const int ArchiveReader::INPUT_BUFFER_SIZE = 64 * 1024;
+
+static const uint32_t ZIP_LOCAL_HEADER = 0x04034b50;
+static const uint32_t ZIP_CENTRAL_HEADER = 0x02014b50;
+static const uint32_t ZIP_END_OF_DIRECTORY = 0x06054b50;
+static const uint32_t ZIP64_END_OF_DIRECTORY = 0x06064b50;
+static const uint32_t ZIP64_END_OF_DIRECTORY_LOCATOR = 0x07064b50;
+static const int ZIP_STORED = 0;
+static const int ZIP_DEFLATED = 8;
+static const int TAR_BLOCK_SIZE = 512;
+
+/*
+ * Archives whose listing we already have, most recently used first. An entry is
+ * only trusted while the archive's size and modification time are unchanged.
+ * Members are also indexed by name, the first of any that share one, so opening
+ * one doesn't go through the whole listing.
+ */
+struct CachedArchive {
+	std::string path;
+	int64_t size;
+	int64_t modified;
+	std::vector<ArchiveReader::Member> members;
+	std::unordered_map<std::string, size_t> names;
+};
+
+static std::mutex cacheMutex;
+static std::list<CachedArchive> cache;
+
+static bool endsWith(const std::string &text, const char *suffix)
+{
+	size_t length = strlen(suffix);
+
+	if (text.length() < length)
+		return false;
+
+	for (size_t i = 0; i < length; i++) {
+		if (tolower(static_cast<unsigned char>(text[text.length() - length + i])) != suffix[i])
+			return false;
+	}
+
+	return true;
+}
+
+static int seekFile(FILE *file, const int64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0 ? 0 : -EIO;
+#else
+	return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0 ? 0 : -EIO;
+#endif
+}
+
+static int readAt(FILE *file, const int64_t offset, void *buffer, const size_t size)
+{
+	if (seekFile(file, offset) < 0 || fread(buffer, 1, size, file) != size)
+		return -EIO;
+
+	return 0;
+}
+
+static uint16_t readLittleEndian16(const uint8_t *data)
+{
+	return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+static uint32_t readLittleEndian32(const uint8_t *data)
+{
+	return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+		   (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static uint64_t readLittleEndian64(const uint8_t *data)
+{
+	return readLittleEndian32(data) | (static_cast<uint64_t>(readLittleEndian32(data + 4)) << 32);
+}
+
+static bool getFileStatus(const char *path, int64_t &size, int64_t &modified)
+{
+	struct stat status;
+
+	if (stat(path, &status) != 0 || !S_ISREG(status.st_mode))
+		return false;
+
+	size = static_cast<int64_t>(status.st_size);
+	modified = static_cast<int64_t>(status.st_mtime);
+
+	return true;
+}
+
+static int readZipDirectory(FILE *file, const int64_t fileSize, std::vector<ArchiveReader::Member> &members)
+{
+	// The end of directory record is at most a maximum length comment away from the end.
+	int64_t tailSize = std::min<int64_t>(fileSize, 22 + 65535);
+	std::vector<uint8_t> tail(static_cast<size_t>(tailSize));
+	int64_t end = -1;
+	int ret = 0;
+
+	if ((ret = readAt(file, fileSize - tailSize, tail.data(), tail.size())) < 0)
+		return ret;
+
+	for (int64_t i = tailSize - 22; i >= 0 && end < 0; i--) {
+		if (readLittleEndian32(&tail[static_cast<size_t>(i)]) == ZIP_END_OF_DIRECTORY)
+			end = i;
+	}
+
+	if (end < 0)
+		return -EINVAL;
+
+	const uint8_t *record = &tail[static_cast<size_t>(end)];
+	uint64_t entries = readLittleEndian16(record + 10);
+	uint64_t directorySize = readLittleEndian32(record + 12);
+	uint64_t directoryOffset = readLittleEndian32(record + 16);
+
+	// Zip64 archives keep the real values in another record, found through a locator just before.
+	if (entries == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+		uint8_t locator[20];
+		uint8_t record64[56];
+		int64_t locatorOffset = fileSize - tailSize + end - 20;
+
+		if (locatorOffset < 0 || (ret = readAt(file, locatorOffset, locator, sizeof(locator))) < 0)
+			return -EINVAL;
+
+		if (readLittleEndian32(locator) != ZIP64_END_OF_DIRECTORY_LOCATOR)
+			return -EINVAL;
+
+		if ((ret = readAt(file, static_cast<int64_t>(readLittleEndian64(locator + 8)), record64, sizeof(record64))) < 0)
+			return ret;
+
+		if (readLittleEndian32(record64) != ZIP64_END_OF_DIRECTORY)
+			return -EINVAL;
+
+		entries = readLittleEndian64(record64 + 32);
+		directorySize = readLittleEndian64(record64 + 40);
+		directoryOffset = readLittleEndian64(record64 + 48);
+	}
+
+	if (directoryOffset + directorySize > static_cast<uint64_t>(fileSize))
+		return -EINVAL;
+
+	std::vector<uint8_t> directory(static_cast<size_t>(directorySize));
+
+	if ((ret = readAt(file, static_cast<int64_t>(directoryOffset), directory.data(), directory.size())) < 0)
+		return ret;
+
+	size_t pos = 0;
+
+	for (uint64_t i = 0; i < entries && pos + 46 <= directory.size(); i++) {
+		const uint8_t *header = &directory[pos];
+
+		if (readLittleEndian32(header) != ZIP_CENTRAL_HEADER)
+			return -EINVAL;
+
+		uint16_t flags = readLittleEndian16(header + 8);
+		uint16_t nameLength = readLittleEndian16(header + 28);
+		uint16_t extraLength = readLittleEndian16(header + 30);
+		uint16_t commentLength = readLittleEndian16(header + 32);
+
+		if (pos + 46 + nameLength + extraLength + commentLength > directory.size())
+			return -EINVAL;
+
+		ArchiveReader::Member member;
+
+		member.name.assign(reinterpret_cast<const char *>(header + 46), nameLength);
+		member.method = readLittleEndian16(header + 10);
+		member.compressedSize = readLittleEndian32(header + 20);
+		member.size = readLittleEndian32(header + 24);
+		member.offset = readLittleEndian32(header + 42);
+
+		// Fields that didn't fit in 32 bits are in the Zip64 extra field, in this order.
+		const uint8_t *extra = header + 46 + nameLength;
+
+		for (size_t e = 0; e + 4 <= extraLength;) {
+			uint16_t id = readLittleEndian16(extra + e);
+			uint16_t length = readLittleEndian16(extra + e + 2);
+			size_t field = e + 4;
+
+			if (id == 0x0001) {
+				int64_t *values[] = { &member.size, &member.compressedSize, &member.offset };
+
+				for (int64_t *value : values) {
+					if (*value == 0xffffffff && field + 8 <= e + 4 + length && field + 8 <= extraLength) {
+						*value = static_cast<int64_t>(readLittleEndian64(extra + field));
+						field += 8;
+					}
+				}
+			}
+
+			e += 4 + length;
+		}
+
+		pos += 46 + nameLength + extraLength + commentLength;
+
+		// Directories, encrypted members and methods we can't decode are left out.
+		if (member.name.empty() || member.name.back() == '/' || (flags & 1))
+			continue;
+
+		if (member.method != ZIP_STORED && member.method != ZIP_DEFLATED)
+			continue;
+
+		members.push_back(member);
+	}
+
+	return 0;
+}
+
+static int64_t parseTarNumber(const uint8_t *field, const size_t length)
+{
+	int64_t value = 0;
+
+	// Large sizes are stored as big endian binary, flagged by the top bit.
+	if (field[0] & 0x80) {
+		for (size_t i = 1; i < length; i++)
+			value = (value << 8) | field[i];
+
+		return value;
+	}
+
+	for (size_t i = 0; i < length && field[i]; i++) {
+		if (field[i] >= '0' && field[i] <= '7')
+			value = value * 8 + (field[i] - '0');
+	}
+
+	return value;
+}
+
+static std::string parseTarString(const uint8_t *field, const size_t length)
+{
+	return std::string(reinterpret_cast<const char *>(field), strnlen(reinterpret_cast<const char *>(field), length));
+}
+
+// Takes the path out of a pax extended header, which is a list of "length key=value\n" records.
+static std::string parsePaxPath(const std::string &records)
+{
+	size_t pos = 0;
+
+	while (pos < records.length()) {
+		size_t space = records.find(' ', pos);
+		size_t length = static_cast<size_t>(strtoul(records.c_str() + pos, nullptr, 10));
+
+		if (space == std::string::npos || length == 0 || pos + length > records.length())
+			break;
+
+		std::string record = records.substr(space + 1, pos + length - space - 2);
+
+		if (record.compare(0, 5, "path=") == 0)
+			return record.substr(5);
+
+		pos += length;
+	}
+
+	return std::string();
+}
+
+static int readTarDirectory(FILE *file, const int64_t fileSize, std::vector<ArchiveReader::Member> &members)
+{
+	uint8_t header[TAR_BLOCK_SIZE];
+	int64_t offset = 0;
+	std::string longName;
+	int ret = 0;
+
+	while (offset + TAR_BLOCK_SIZE <= fileSize) {
+		if ((ret = readAt(file, offset, header, sizeof(header))) < 0)
+			return ret;
+
+		// The archive ends with zeroed blocks.
+		if (!header[0])
+			break;
+
+		if (memcmp(header + 257, "ustar", 5) != 0 && offset == 0)
+			return -EINVAL;
+
+		int64_t size = parseTarNumber(header + 124, 12);
+		int64_t data = offset + TAR_BLOCK_SIZE;
+		char type = static_cast<char>(header[156]);
+
+		if (size < 0 || data + size > fileSize)
+			return -EINVAL;
+
+		// GNU long names and pax headers carry the name of the member that follows them.
+		if (type == 'L' || type == 'x') {
+			std::string value(static_cast<size_t>(size), '\0');
+
+			if ((ret = readAt(file, data, &value[0], value.size())) < 0)
+				return ret;
+
+			longName = type == 'L' ? parseTarString(reinterpret_cast<const uint8_t *>(value.data()), value.size()) : parsePaxPath(value);
+		} else if (type == '0' || type == '\0' || type == '7') {
+			ArchiveReader::Member member;
+
+			if (!longName.empty()) {
+				member.name = longName;
+			} else {
+				std::string prefix = parseTarString(header + 345, 155);
+
+				member.name = parseTarString(header, 100);
+
+				if (!prefix.empty())
+					member.name = prefix + "/" + member.name;
+			}
+
+			member.method = ZIP_STORED;
+			member.offset = data;
+			member.compressedSize = size;
+			member.size = size;
+
+			members.push_back(member);
+			longName.clear();
+		} else {
+			longName.clear();
+		}
+
+		offset = data + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+	}
+
+	return 0;
+}
+
+ArchiveReader::ArchiveReader()
+{
+	file = nullptr;
+	dataOffset = 0;
+	position = 0;
+	inflater = nullptr;
+	input = nullptr;
+	compressedPosition = 0;
+	member.method = ZIP_STORED;
+	member.offset = 0;
+	member.compressedSize = 0;
+	member.size = 0;
+}
+
+ArchiveReader::~ArchiveReader()
+{
+	if (inflater) {
+		inflateEnd(inflater);
+
+		delete inflater;
+	}
+
+	delete[] input;
+
+	if (file)
+		fclose(file);
+}
+
+bool ArchiveReader::isArchive(const char *path)
+{
+	std::string name(path);
+
+	return endsWith(name, ".zip") || endsWith(name, ".tar");
+}
+
+bool ArchiveReader::isMemberPath(const char *path)
+{
+	std::string archivePath;
+	std::string memberName;
+
+	return splitPath(path, archivePath, memberName);
+}
+
+bool ArchiveReader::splitPath(const char *path, std::string &archivePath, std::string &memberName)
+{
+	std::string virtualPath(path);
+	size_t separator = 0;
+
+	// A "!/" could also be part of an ordinary folder name, so it has to follow an archive's name.
+	while ((separator = virtualPath.find(SEPARATOR, separator)) != std::string::npos) {
+		archivePath = virtualPath.substr(0, separator);
+
+		if (isArchive(archivePath.c_str())) {
+			memberName = virtualPath.substr(separator + strlen(SEPARATOR));
+
+			return !memberName.empty();
+		}
+
+		separator++;
+	}
+
+	return false;
+}
+
+// The cached listing of an archive, moved to the front, or the end. Call with cacheMutex held.
+static std::list<CachedArchive>::iterator findCachedArchive(const char *archivePath, const int64_t size, const int64_t modified)
+{
+	for (std::list<CachedArchive>::iterator iter = cache.begin(); iter != cache.end(); ++iter) {
+		if (iter->path == archivePath && iter->size == size && iter->modified == modified) {
+			cache.splice(cache.begin(), cache, iter);
+
+			return cache.begin();
+		}
+	}
+
+	return cache.end();
+}
+
+/*
+ * Lists the members of an archive, without folders or anything we can't read.
+ * Returns 0 or a negative errno, which is what FFmpeg's AVERROR() makes of it.
+ */
+int ArchiveReader::list(const char *archivePath, std::vector<Member> &members)
+{
+	int64_t size = 0;
+	int64_t modified = 0;
+
+	if (!getFileStatus(archivePath, size, modified))
+		return -ENOENT;
+
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::list<CachedArchive>::iterator cached = findCachedArchive(archivePath, size, modified);
+
+		if (cached != cache.end()) {
+			members = cached->members;
+
+			return 0;
+		}
+	}
+
+	CachedArchive archive;
+	int ret = 0;
+
+	if ((ret = readDirectory(archivePath, archive.members)) < 0)
+		return ret;
+
+	archive.path = archivePath;
+	archive.size = size;
+	archive.modified = modified;
+	members = archive.members;
+
+	for (size_t i = 0; i < archive.members.size(); i++)
+		archive.names.emplace(archive.members[i].name, i);
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+
+	cache.push_front(std::move(archive));
+
+	if (cache.size() > static_cast<size_t>(CACHED_ARCHIVES))
+		cache.pop_back();
+
+	return 0;
+}
+
+// The uncompressed size of the member at a virtual path, or -1.
+int64_t ArchiveReader::getMemberSize(const char *path)
+{
+	Member member;
+
+	if (findMember(path, member) < 0)
+		return -1;
+
+	return member.size;
+}
+
+int ArchiveReader::findMember(const char *path, Member &member)
+{
+	std::string archivePath;
+	std::string memberName;
+	std::vector<Member> members;
+	int64_t size = 0;
+	int64_t modified = 0;
+	int ret = 0;
+
+	if (!splitPath(path, archivePath, memberName))
+		return -EINVAL;
+
+	if (!getFileStatus(archivePath.c_str(), size, modified))
+		return -ENOENT;
+
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::list<CachedArchive>::iterator cached = findCachedArchive(archivePath.c_str(), size, modified);
+
+		if (cached != cache.end()) {
+			std::unordered_map<std::string, size_t>::const_iterator found = cached->names.find(memberName);
+
+			if (found == cached->names.end())
+				return -ENOENT;
+
+			member = cached->members[found->second];
+
+			return 0;
+		}
+	}
+
+	// Listing the archive caches it, so only the first member looked up searches it like this.
+	if ((ret = list(archivePath.c_str(), members)) < 0)
+		return ret;
+
+	for (size_t i = 0; i < members.size(); i++) {
+		if (members[i].name == memberName) {
+			member = members[i];
+
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+int ArchiveReader::readDirectory(const char *archivePath, std::vector<Member> &members)
+{
+	int64_t size = 0;
+	int64_t modified = 0;
+	FILE *archive = nullptr;
+	int ret = 0;
+
+	if (!getFileStatus(archivePath, size, modified) || !(archive = fopen(archivePath, "rb")))
+		return -ENOENT;
+
+	if (endsWith(archivePath, ".zip"))
+		ret = readZipDirectory(archive, size, members);
+
+	else
+		ret = readTarDirectory(archive, size, members);
+
+	fclose(archive);
+
+	return ret;
+}
+
+// Opens the member at a virtual path. Returns 0 or a negative errno.
+int ArchiveReader::open(const char *path)
+{
+	std::string archivePath;
+	std::string memberName;
+	int ret = 0;
+
+	if ((ret = findMember(path, member)) < 0)
+		return ret;
+
+	splitPath(path, archivePath, memberName);
+
+	if (!(file = fopen(archivePath.c_str(), "rb")))
+		return -ENOENT;
+
+	// Every read seeks anyway, and FFmpeg does its own buffering.
+	setvbuf(file, nullptr, _IONBF, 0);
+
+	dataOffset = member.offset;
+
+	// Zip members start after their local header, whose extra field can differ from the directory's.
+	if (endsWith(archivePath, ".zip")) {
+		uint8_t header[30];
+
+		if ((ret = readAt(file, member.offset, header, sizeof(header))) < 0)
+			return ret;
+
+		if (readLittleEndian32(header) != ZIP_LOCAL_HEADER)
+			return -EINVAL;
+
+		dataOffset = member.offset + 30 + readLittleEndian16(header + 26) + readLittleEndian16(header + 28);
+	}
+
+	if (member.method == ZIP_DEFLATED) {
+		inflater = new z_stream();
+		input = new uint8_t[INPUT_BUFFER_SIZE];
+
+		if (inflateInit2(inflater, -MAX_WBITS) != Z_OK) {
+			delete inflater;
+
+			inflater = nullptr;
+
+			return -ENOMEM;
+		}
+	}
+
+	position = 0;
+	compressedPosition = 0;
+
+	return seekFile(file, dataOffset);
+}
+
+// Returns the number of bytes read, 0 at the end of the member, or a negative errno.
+int ArchiveReader::read(uint8_t *buffer, const int size)
+{
+	if (!file)
+		return -EBADF;
+
+	int wanted = static_cast<int>(std::min<int64_t>(size, member.size - position));
+
+	if (wanted <= 0)
+		return 0;
+
+	if (inflater)
+		return inflate(buffer, wanted);
+
+	if (seekFile(file, dataOffset + position) < 0)
+		return -EIO;
+
+	size_t count = fread(buffer, 1, static_cast<size_t>(wanted), file);
+
+	if (count == 0)
+		return ferror(file) ? -EIO : 0;
+
+	position += static_cast<int64_t>(count);
+
+	return static_cast<int>(count);
+}
+
+// Takes SEEK_SET, SEEK_CUR or SEEK_END and returns the new position or a negative errno.
+int64_t ArchiveReader::seek(const int64_t offset, const int whence)
+{
+	int64_t target = offset;
+
+	if (whence == SEEK_CUR)
+		target += position;
+
+	else if (whence == SEEK_END)
+		target += member.size;
+
+	else if (whence != SEEK_SET)
+		return -EINVAL;
+
+	if (target < 0 || target > member.size)
+		return -EINVAL;
+
+	if (!inflater) {
+		position = target;
+
+		return position;
+	}
+
+	// Deflate can only be decoded front to back, so going back means starting over.
+	if (target < position) {
+		int ret = 0;
+
+		if ((ret = resetInflater()) < 0)
+			return ret;
+	}
+
+	uint8_t skipped[16384];
+
+	while (position < target) {
+		int ret = inflate(skipped, static_cast<int>(std::min<int64_t>(sizeof(skipped), target - position)));
+
+		if (ret <= 0)
+			return ret < 0 ? ret : -EIO;
+	}
+
+	return position;
+}
+
+int ArchiveReader::resetInflater()
+{
+	if (inflateReset(inflater) != Z_OK)
+		return -EIO;
+
+	inflater->next_in = nullptr;
+	inflater->avail_in = 0;
+	position = 0;
+	compressedPosition = 0;
+
+	return 0;
+}
+
+int ArchiveReader::inflate(uint8_t *buffer, const int size)
+{
+	inflater->next_out = buffer;
+	inflater->avail_out = static_cast<uInt>(size);
+
+	while (inflater->avail_out > 0) {
+		if (inflater->avail_in == 0 && compressedPosition < member.compressedSize) {
+			size_t count = static_cast<size_t>(std::min<int64_t>(INPUT_BUFFER_SIZE, member.compressedSize - compressedPosition));
+
+			if (seekFile(file, dataOffset + compressedPosition) < 0 || fread(input, 1, count, file) != count)
+				return -EIO;
+
+			inflater->next_in = input;
+			inflater->avail_in = static_cast<uInt>(count);
+			compressedPosition += static_cast<int64_t>(count);
+		}
+
+		int ret = ::inflate(inflater, Z_NO_FLUSH);
+
+		if (ret == Z_STREAM_END)
+			break;
+
+		// A truncated member still gives back what could be inflated.
+		if (ret != Z_OK) {
+			if (ret == Z_BUF_ERROR && inflater->avail_out < static_cast<uInt>(size))
+				break;
+
+			return -EIO;
+		}
+	}
+
+	int count = size - static_cast<int>(inflater->avail_out);
+
+	position += count;
+
+	return count;
+}
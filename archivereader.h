@@ -0,0 +1,72 @@
+#ifndef ARCHIVEREADER_H
+#define ARCHIVEREADER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct z_stream_s;
+
+/*
+ * Reads the members of zip and tar archives in place, so media inside them can
+ * be fingerprinted without being extracted. A member is addressed by a virtual
+ * path made of the archive's path, SEPARATOR and the member's name, for example
+ * "videos.zip!/holiday/beach.mp4".
+ *
+ * Stored members (everything in a tar, uncompressed ones in a zip) are read and
+ * seeked directly in the archive. Deflated zip members are inflated as they're
+ * read, seeking forward inflates and skips, and seeking back starts over from
+ * the beginning of the member. Other compression methods, encrypted members and
+ * compressed tars (.tar.gz and friends) aren't supported.
+ *
+ * Listings are cached per process for the last few archives, so opening every
+ * member of a large archive only reads its directory once.
+ */
+class ArchiveReader
+{
+	public:
+		static const char *SEPARATOR;
+		static const int CACHED_ARCHIVES;
+		static const int INPUT_BUFFER_SIZE;
+
+		struct Member {
+			std::string name;
+			// 0 for stored, 8 for deflated.
+			int method;
+			// Where the data starts for tar members, the local header for zip members.
+			int64_t offset;
+			int64_t compressedSize;
+			int64_t size;
+		};
+
+		static bool isArchive(const char *path);
+		static bool isMemberPath(const char *path);
+		static bool splitPath(const char *path, std::string &archivePath, std::string &memberName);
+		static int list(const char *archivePath, std::vector<Member> &members);
+		static int64_t getMemberSize(const char *path);
+
+		ArchiveReader();
+		~ArchiveReader();
+
+		int open(const char *path);
+		int read(uint8_t *buffer, const int size);
+		int64_t seek(const int64_t offset, const int whence);
+		int64_t getSize() const { return member.size; }
+
+	private:
+		FILE *file;
+		Member member;
+		int64_t dataOffset;
+		int64_t position;
+		z_stream_s *inflater;
+		uint8_t *input;
+		int64_t compressedPosition;
+
+		static int findMember(const char *path, Member &member);
+		static int readDirectory(const char *archivePath, std::vector<Member> &members);
+		int resetInflater();
+		int inflate(uint8_t *buffer, const int size);
+};
+
+#endif // ARCHIVEREADER_H
@@ -0,0 +1,322 @@
+#include <QHash>
+#include <QSet>
+
+#include <algorithm>
+
+#include "closestpairs.h"
+#include "pairstore.h"
+
+// Distances are the fraction of bits that differ, so this lets everything through.
+static const double NO_BOUND = 1.0;
+
+static bool isCloser(const ClosestPairs::Pair &pair, const ClosestPairs::Pair &otherPair)
+{
+	return pair.distance < otherPair.distance;
+}
+
+static QPair<QString, QString> getKey(const ClosestPairs::Pair &pair)
+{
+	return qMakePair(pair.path, pair.otherPath);
+}
+
+ClosestPairs::ClosestPairs(): pairLimit(0), fileLimit(0), bound(NO_BOUND)
+{
+}
+
+/*
+ * Lowering the limits drops the furthest pairs there are now. Raising them only
+ * lets more pairs in from here on, ones left out before aren't compared again.
+ */
+void ClosestPairs::setLimits(const int pairLimit, const int fileLimit)
+{
+	this->fileLimit.store(fileLimit, std::memory_order_relaxed);
+
+	if (this->pairLimit.exchange(pairLimit) == pairLimit)
+		return;
+
+	QMutexLocker lock(&heapsMutex);
+
+	foreach (QSharedPointer<Heap> heap, heaps) {
+		QMutexLocker heapLock(&heap->mutex);
+
+		while (heap->pairs.length() > qMax(pairLimit, 0))
+			removeFurthest(heap.data());
+	}
+
+	lock.unlock();
+
+	resetBound();
+}
+
+// Returns whether the pair was kept, for now at least.
+bool ClosestPairs::add(const QString path, const QString otherPath, const double distance)
+{
+	int limit = pairLimit.load(std::memory_order_relaxed);
+
+	if (limit <= 0 || distance > getBound())
+		return false;
+
+	Heap *heap = getHeap();
+	Pair pair;
+
+	pair.distance = distance;
+	pair.path = qMin(path, otherPath);
+	pair.otherPath = qMax(path, otherPath);
+
+	QMutexLocker lock(&heap->mutex);
+	QHash<QPair<QString, QString>, int>::const_iterator existing = heap->positions.constFind(getKey(pair));
+
+	// Files are compared again as they're refined, a pair may turn out closer than it first was.
+	if (existing != heap->positions.constEnd()) {
+		int index = existing.value();
+
+		if (heap->pairs[index].distance <= distance)
+			return false;
+
+		heap->pairs[index].distance = distance;
+		siftDown(heap, index);
+	} else {
+		if (heap->pairs.length() >= limit) {
+			if (distance >= heap->pairs.first().distance)
+				return false;
+
+			removeFurthest(heap);
+		}
+
+		heap->pairs.append(pair);
+		siftUp(heap, heap->pairs.length() - 1);
+	}
+
+	if (heap->pairs.length() >= limit)
+		lowerBound(heap->pairs.first().distance);
+
+	return true;
+}
+
+/*
+ * The closest pairs over every thread, closest first. When there's a limit per
+ * file, a pair is left out once either of its files has that many closer pairs,
+ * and the next closest takes its place.
+ *
+ * Nothing compared within the bound is missing from store, so if it has enough
+ * pairs within the loosest threshold those are the closest ones.
+ */
+QVector<ClosestPairs::Pair> ClosestPairs::getPairs(PairStore &store)
+{
+	QHash<QPair<QString, QString>, double> merged;
+	QVector<Pair> pairs;
+	int limit = pairLimit.load(std::memory_order_relaxed);
+	int perFile = fileLimit.load(std::memory_order_relaxed);
+	QVector<QString> storedPaths;
+	QVector<PairStore::Pair> stored = store.getClosestPairs(limit, perFile, &storedPaths);
+
+	if (limit > 0 && stored.length() >= limit) {
+		foreach (PairStore::Pair storedPair, stored) {
+			QString path = storedPaths[static_cast<int>(storedPair.id)];
+			QString otherPath = storedPaths[static_cast<int>(storedPair.otherId)];
+			Pair pair;
+
+			pair.distance = storedPair.distance;
+			pair.path = qMin(path, otherPath);
+			pair.otherPath = qMax(path, otherPath);
+			pairs.append(pair);
+		}
+
+		return pairs;
+	}
+
+	QMutexLocker lock(&heapsMutex);
+
+	foreach (QSharedPointer<Heap> heap, heaps) {
+		QMutexLocker heapLock(&heap->mutex);
+
+		foreach (Pair pair, heap->pairs) {
+			QPair<QString, QString> key = qMakePair(pair.path, pair.otherPath);
+			QHash<QPair<QString, QString>, double>::iterator existing = merged.find(key);
+
+			if (existing == merged.end())
+				merged.insert(key, pair.distance);
+
+			else
+				existing.value() = qMin(existing.value(), pair.distance);
+		}
+	}
+
+	lock.unlock();
+
+	for (QHash<QPair<QString, QString>, double>::const_iterator i = merged.constBegin(); i != merged.constEnd(); i++) {
+		Pair pair;
+
+		pair.distance = i.value();
+		pair.path = i.key().first;
+		pair.otherPath = i.key().second;
+		pairs.append(pair);
+	}
+
+	std::sort(pairs.begin(), pairs.end(), [](const Pair &pair, const Pair &otherPair) {
+		if (pair.distance != otherPair.distance)
+			return pair.distance < otherPair.distance;
+
+		return qMakePair(pair.path, pair.otherPath) < qMakePair(otherPair.path, otherPair.otherPath);
+	});
+
+	QHash<QString, int> counts;
+	QVector<Pair> closest;
+
+	foreach (Pair pair, pairs) {
+		if (closest.length() >= limit)
+			break;
+
+		if (perFile > 0 && (counts.value(pair.path) >= perFile || counts.value(pair.otherPath) >= perFile))
+			continue;
+
+		counts[pair.path]++;
+		counts[pair.otherPath]++;
+		closest.append(pair);
+	}
+
+	return closest;
+}
+
+// Pairs the removed files were in are gone, but ones they pushed out aren't coming back.
+void ClosestPairs::removeFiles(const QStringList paths)
+{
+	QSet<QString> removed = QSet<QString>::fromList(paths);
+	QMutexLocker lock(&heapsMutex);
+
+	foreach (QSharedPointer<Heap> heap, heaps) {
+		QMutexLocker heapLock(&heap->mutex);
+		QVector<Pair> remaining;
+
+		foreach (Pair pair, heap->pairs) {
+			if (!removed.contains(pair.path) && !removed.contains(pair.otherPath))
+				remaining.append(pair);
+		}
+
+		heap->pairs = remaining;
+		rebuild(heap.data());
+	}
+
+	lock.unlock();
+
+	resetBound();
+}
+
+void ClosestPairs::clear()
+{
+	QMutexLocker lock(&heapsMutex);
+
+	foreach (QSharedPointer<Heap> heap, heaps) {
+		QMutexLocker heapLock(&heap->mutex);
+
+		heap->pairs.clear();
+		heap->positions.clear();
+	}
+
+	bound.store(NO_BOUND, std::memory_order_relaxed);
+}
+
+ClosestPairs::Heap *ClosestPairs::getHeap()
+{
+	if (!threadHeaps.hasLocalData()) {
+		QSharedPointer<Heap> heap(new Heap());
+		QMutexLocker lock(&heapsMutex);
+
+		threadHeaps.setLocalData(heap);
+		heaps.append(heap);
+	}
+
+	return threadHeaps.localData().data();
+}
+
+void ClosestPairs::place(Heap *heap, const int index, const Pair &pair)
+{
+	heap->pairs[index] = pair;
+	heap->positions[getKey(pair)] = index;
+}
+
+// Moves a pair that got further away, or was just added, towards the top.
+void ClosestPairs::siftUp(Heap *heap, int index)
+{
+	Pair pair = heap->pairs[index];
+
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+
+		if (!isCloser(heap->pairs[parent], pair))
+			break;
+
+		place(heap, index, heap->pairs[parent]);
+		index = parent;
+	}
+
+	place(heap, index, pair);
+}
+
+// Moves a pair that got closer, or was moved to the top, down to where it belongs.
+void ClosestPairs::siftDown(Heap *heap, int index)
+{
+	Pair pair = heap->pairs[index];
+	int length = heap->pairs.length();
+
+	while (2 * index + 1 < length) {
+		int child = 2 * index + 1;
+
+		if (child + 1 < length && isCloser(heap->pairs[child], heap->pairs[child + 1]))
+			child++;
+
+		if (!isCloser(pair, heap->pairs[child]))
+			break;
+
+		place(heap, index, heap->pairs[child]);
+		index = child;
+	}
+
+	place(heap, index, pair);
+}
+
+void ClosestPairs::removeFurthest(Heap *heap)
+{
+	heap->positions.remove(getKey(heap->pairs.first()));
+
+	Pair last = heap->pairs.takeLast();
+
+	if (heap->pairs.isEmpty())
+		return;
+
+	place(heap, 0, last);
+	siftDown(heap, 0);
+}
+
+void ClosestPairs::rebuild(Heap *heap)
+{
+	std::make_heap(heap->pairs.begin(), heap->pairs.end(), isCloser);
+	heap->positions.clear();
+
+	for (int i = 0; i < heap->pairs.length(); i++)
+		heap->positions.insert(getKey(heap->pairs[i]), i);
+}
+
+void ClosestPairs::lowerBound(const double distance)
+{
+	double current = bound.load(std::memory_order_relaxed);
+
+	while (distance < current && !bound.compare_exchange_weak(current, distance, std::memory_order_relaxed));
+}
+
+// Works the bound out again from scratch, after pairs have gone.
+void ClosestPairs::resetBound()
+{
+	int limit = pairLimit.load(std::memory_order_relaxed);
+	double lowest = NO_BOUND;
+	QMutexLocker lock(&heapsMutex);
+
+	foreach (QSharedPointer<Heap> heap, heaps) {
+		QMutexLocker heapLock(&heap->mutex);
+
+		if (limit > 0 && heap->pairs.length() >= limit)
+			lowest = qMin(lowest, heap->pairs.first().distance);
+	}
+
+	bound.store(lowest, std::memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+#ifndef CLOSESTPAIRS_H
+#define CLOSESTPAIRS_H
+
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadStorage>
+#include <QVector>
+
+#include <atomic>
+
+/*
+ * Keeps the closest pairs of files found during a scan, rather than every pair
+ * within the similarity threshold. Each comparing thread adds to its own bounded
+ * max-heap, so adding never waits on another thread, and the heaps are merged
+ * when the pairs are asked for. Memory stays at the limit per thread however many
+ * pairs are compared.
+ *
+ * A full heap's furthest pair is as far as anything in the closest pairs overall
+ * can be, so the nearest of those is published as the bound, and comparisons
+ * stop early on anything further away.
+ *
+ * Every pair within the loosest threshold also goes to PairStore, which keeps
+ * them sorted, so when there are enough of those the closest pairs are taken
+ * from there. The heaps only decide when they're further apart than that.
+ */
+class PairStore;
+
+class ClosestPairs
+{
+	public:
+		struct Pair {
+			double distance;
+			// The two paths are kept in order, so a pair has only one form.
+			QString path;
+			QString otherPath;
+		};
+
+		ClosestPairs();
+
+		void setLimits(const int pairLimit, const int fileLimit);
+		bool isEnabled() const { return pairLimit.load(std::memory_order_relaxed) > 0; }
+		double getBound() const { return bound.load(std::memory_order_relaxed); }
+		bool add(const QString path, const QString otherPath, const double distance);
+		QVector<Pair> getPairs(PairStore &store);
+		void removeFiles(const QStringList paths);
+		void clear();
+
+	private:
+		struct Heap {
+			QMutex mutex;
+			// Furthest pair first.
+			QVector<Pair> pairs;
+			// Where each pair is in pairs, so one found again is moved without a search.
+			QHash<QPair<QString, QString>, int> positions;
+		};
+
+		std::atomic<int> pairLimit;
+		std::atomic<int> fileLimit;
+		std::atomic<double> bound;
+		QThreadStorage<QSharedPointer<Heap>> threadHeaps;
+		QMutex heapsMutex;
+		// Heaps outlive their threads, what they found still counts.
+		QVector<QSharedPointer<Heap>> heaps;
+
+		Heap *getHeap();
+		static void place(Heap *heap, const int index, const Pair &pair);
+		static void siftUp(Heap *heap, int index);
+		static void siftDown(Heap *heap, int index);
+		static void removeFurthest(Heap *heap);
+		static void rebuild(Heap *heap);
+		void lowerBound(const double distance);
+		void resetBound();
+};
+
+#endif // CLOSESTPAIRS_H
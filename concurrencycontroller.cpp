@@ -0,0 +1,99 @@
+#include <QThread>
+
+#include "concurrencycontroller.h"
+
+const int ConcurrencyController::INTERVAL = 2000;
+// Throughput has to change by more than this to count, anything less is noise.
+const double ConcurrencyController::TOLERANCE = 0.05;
+
+ConcurrencyController::ConcurrencyController()
+{
+	active = false;
+
+	for (int stage = 0; stage < FileScheduler::STAGE_COUNT; stage++) {
+		stages[stage].limit = QThread::idealThreadCount();
+		stages[stage].maximum = QThread::idealThreadCount();
+		stages[stage].direction = 1;
+		stages[stage].score = 0.0;
+		stages[stage].filesPerSecond = 0.0;
+		stages[stage].bytesPerSecond = 0.0;
+		stages[stage].files = -1;
+		stages[stage].bytes = 0;
+		stages[stage].queued = false;
+	}
+}
+
+// Limits start at one per core, or the maximum if that's lower.
+void ConcurrencyController::setBounds(const int maxProbes, const int maxFingerprints)
+{
+	int maximums[FileScheduler::STAGE_COUNT] = { qMax(1, maxProbes), qMax(1, maxFingerprints) };
+
+	for (int stage = 0; stage < FileScheduler::STAGE_COUNT; stage++) {
+		if (stages[stage].maximum == maximums[stage])
+			continue;
+
+		stages[stage].maximum = maximums[stage];
+		stages[stage].limit = qMin(stages[stage].limit, maximums[stage]);
+		stages[stage].score = 0.0;
+	}
+}
+
+// Takes the schedulers' counts elapsed milliseconds after the last ones.
+void ConcurrencyController::update(const FileScheduler::Stats &stats, const qint64 elapsed)
+{
+	active = false;
+
+	for (int i = 0; i < FileScheduler::STAGE_COUNT; i++) {
+		Stage &stage = stages[i];
+		bool first = stage.files < 0;
+		// Waiting at both ends of the interval is as close as we get to knowing the limit was what held it back.
+		bool saturated = stage.queued && stats.queued[i];
+
+		stage.filesPerSecond = first || elapsed <= 0 ? 0.0 : (stats.files[i] - stage.files) * 1000.0 / elapsed;
+		stage.bytesPerSecond = first || elapsed <= 0 ? 0.0 : (stats.bytes[i] - stage.bytes) * 1000.0 / elapsed;
+		stage.files = stats.files[i];
+		stage.bytes = stats.bytes[i];
+		stage.queued = stats.queued[i];
+
+		if (stats.running[i] > 0 || stats.queued[i])
+			active = true;
+
+		if (first || !saturated) {
+			stage.score = 0.0;
+
+			continue;
+		}
+
+		double score = i == FileScheduler::STAGE_PROBE ? stage.filesPerSecond : stage.bytesPerSecond;
+
+		// The first interval under a new limit only gives us something to compare the next one with.
+		if (stage.score > 0.0 && score <= stage.score * (1.0 + TOLERANCE))
+			stage.direction = -stage.direction;
+
+		stage.score = score;
+
+		int limit = qBound(1, stage.limit + stage.direction, stage.maximum);
+
+		// Up against a bound, the only way left to try is back.
+		if (limit == stage.limit)
+			stage.direction = -stage.direction;
+
+		stage.limit = limit;
+	}
+}
+
+QString ConcurrencyController::getSummary() const
+{
+	const Stage &probes = stages[FileScheduler::STAGE_PROBE];
+	const Stage &fingerprints = stages[FileScheduler::STAGE_FINGERPRINT];
+
+	if (!active)
+		return QString("Reading %1, decoding %2 files at a time").arg(probes.limit).arg(fingerprints.limit);
+
+	return QString("Reading %1 at a time, %2 files/s - decoding %3 at a time, %4 files/s, %5 MB/s")
+			.arg(probes.limit)
+			.arg(probes.filesPerSecond, 0, 'f', 1)
+			.arg(fingerprints.limit)
+			.arg(fingerprints.filesPerSecond, 0, 'f', 1)
+			.arg(fingerprints.bytesPerSecond / (1000 * 1000), 0, 'f', 1);
+}
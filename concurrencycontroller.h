@@ -0,0 +1,57 @@
+#ifndef CONCURRENCYCONTROLLER_H
+#define CONCURRENCYCONTROLLER_H
+
+#include <QString>
+
+#include "filescheduler.h"
+
+/*
+ * Tunes how many files are probed and how many are fingerprinted at once from
+ * the throughput actually seen, since the best number depends on where the
+ * files are: a fast SSD wants about one decoder per core, a network share wants
+ * many more reads in flight to hide the latency, and a spinning disk is slowed
+ * down by every read added past the first few.
+ *
+ * Each stage is hill-climbed on its own. Every interval its limit moves one step,
+ * in the same direction as last time if throughput went up by more than the
+ * noise, and back the other way otherwise, so it settles around the best limit
+ * and follows it when the mix of files changes. A stage is only judged while it
+ * had files waiting for the whole interval, otherwise it's the supply of files
+ * being measured rather than the limit.
+ *
+ * Probes are judged on files per second, as they only read headers. Fingerprints
+ * are judged on bytes per second, which follows the decoding work more closely
+ * than the number of files does.
+ */
+class ConcurrencyController
+{
+	public:
+		static const int INTERVAL;
+		static const double TOLERANCE;
+
+		ConcurrencyController();
+
+		void setBounds(const int maxProbes, const int maxFingerprints);
+		void update(const FileScheduler::Stats &stats, const qint64 elapsed);
+		int getLimit(const FileScheduler::STAGE stage) const { return stages[stage].limit; }
+		QString getSummary() const;
+
+	private:
+		struct Stage {
+			int limit;
+			int maximum;
+			int direction;
+			// The throughput the limit was last judged on, 0 when there's nothing to go by.
+			double score;
+			double filesPerSecond;
+			double bytesPerSecond;
+			qint64 files;
+			qint64 bytes;
+			bool queued;
+		};
+
+		Stage stages[FileScheduler::STAGE_COUNT];
+		bool active;
+};
+
+#endif // CONCURRENCYCONTROLLER_H
@@ -0,0 +1,765 @@
+#include <QFileInfo>
+#include <QPixmap>
+#include <QPixmapCache>
+#include <QSet>
+
+#include <algorithm>
+
+#include "duplicategroupsmodel.h"
+
+DuplicateGroupsModel::DuplicateGroupsModel(QObject *parent): QAbstractItemModel(parent)
+{
+	sortColumn = COLUMN_RECLAIMABLE;
+	sortOrder = Qt::DescendingOrder;
+	thumbnails = nullptr;
+}
+
+QVariant DuplicateGroupsModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+	Q_UNUSED(orientation)
+
+	if (role == Qt::DisplayRole) {
+		switch (section) {
+			case COLUMN_FILES:
+				return "Files";
+
+			case COLUMN_SIZE:
+				return "Size";
+
+			case COLUMN_RECLAIMABLE:
+				return "Reclaimable";
+
+			case COLUMN_IDENTICAL:
+				return "Identical";
+		}
+	}
+
+	return QVariant();
+}
+
+/*
+ * Group rows have an internal id of 0, member rows the id of their group's root
+ * plus one. Roots never change while a group exists, so member indexes stay valid
+ * however the groups are sorted.
+ */
+QModelIndex DuplicateGroupsModel::index(int row, int column, const QModelIndex &parent) const
+{
+	if (row < 0 || column < 0 || column >= COLUMN_COUNT)
+		return QModelIndex();
+
+	if (!parent.isValid())
+		return row < groups.length() ? createIndex(row, column, quintptr(0)) : QModelIndex();
+
+	if (parent.internalId() != 0 || parent.row() >= groups.length())
+		return QModelIndex();
+
+	int root = groups[parent.row()];
+	QHash<int, QVector<int>>::const_iterator group = members.constFind(root);
+
+	if (group == members.constEnd() || row >= group->length())
+		return QModelIndex();
+
+	return createIndex(row, column, quintptr(root + 1));
+}
+
+QModelIndex DuplicateGroupsModel::parent(const QModelIndex &child) const
+{
+	if (!child.isValid() || child.internalId() == 0)
+		return QModelIndex();
+
+	int row = findGroupRow(static_cast<int>(child.internalId() - 1));
+
+	return row >= 0 ? createIndex(row, 0, quintptr(0)) : QModelIndex();
+}
+
+int DuplicateGroupsModel::rowCount(const QModelIndex &parent) const
+{
+	if (!parent.isValid())
+		return groups.length();
+
+	if (parent.internalId() != 0 || parent.column() != 0 || parent.row() >= groups.length())
+		return 0;
+
+	QHash<int, QVector<int>>::const_iterator group = members.constFind(groups[parent.row()]);
+
+	return group == members.constEnd() ? 0 : group->length();
+}
+
+int DuplicateGroupsModel::columnCount(const QModelIndex &parent) const
+{
+	Q_UNUSED(parent)
+
+	return COLUMN_COUNT;
+}
+
+bool DuplicateGroupsModel::hasChildren(const QModelIndex &parent) const
+{
+	if (!parent.isValid())
+		return !groups.isEmpty();
+
+	return parent.internalId() == 0 && parent.column() == 0;
+}
+
+bool DuplicateGroupsModel::canFetchMore(const QModelIndex &parent) const
+{
+	if (!parent.isValid() || parent.internalId() != 0 || parent.row() >= groups.length())
+		return false;
+
+	return !members.contains(groups[parent.row()]);
+}
+
+void DuplicateGroupsModel::fetchMore(const QModelIndex &parent)
+{
+	if (!canFetchMore(parent))
+		return;
+
+	int root = groups[parent.row()];
+	QVector<int> groupMembers = getMembers(root);
+
+	beginInsertRows(parent.sibling(parent.row(), 0), 0, groupMembers.length() - 1);
+	members.insert(root, groupMembers);
+	endInsertRows();
+}
+
+QVariant DuplicateGroupsModel::data(const QModelIndex &index, int role) const
+{
+	if (!index.isValid())
+		return QVariant();
+
+	if (index.internalId() == 0) {
+		if (index.row() >= groups.length())
+			return QVariant();
+
+		int root = groups[index.row()];
+
+		if (role == Qt::DisplayRole) {
+			switch (index.column()) {
+				case COLUMN_FILES:
+					return QString("%1 similar files").arg(counts[root]);
+
+				case COLUMN_SIZE:
+					return humanReadableFileSize(bytes[root]);
+
+				case COLUMN_RECLAIMABLE:
+					return humanReadableFileSize(bytes[root] - largest[root]);
+
+				case COLUMN_IDENTICAL:
+					if (!verified[root])
+						return QVariant();
+
+					if (verified[root] < counts[root])
+						return QString("%1 of %2, %3 unchecked").arg(exact[root]).arg(counts[root]).arg(counts[root] - verified[root]);
+
+					if (exact[root] == counts[root])
+						return "All";
+
+					return exact[root] ? QString("%1 of %2").arg(exact[root]).arg(counts[root]) : "None";
+			}
+		} else if (role == Qt::DecorationRole && index.column() == COLUMN_FILES) {
+			return getThumbnail(root);
+		}
+
+		return QVariant();
+	}
+
+	int id = members.value(static_cast<int>(index.internalId() - 1)).value(index.row(), -1);
+
+	if (id < 0)
+		return QVariant();
+
+	if (role == Qt::DisplayRole) {
+		switch (index.column()) {
+			case COLUMN_FILES:
+				return QFileInfo(paths[id]).fileName();
+
+			case COLUMN_SIZE:
+				return humanReadableFileSize(sizes[id]);
+
+			case COLUMN_IDENTICAL:
+				if (!copies[id])
+					return QVariant();
+
+				if (copies[id] == 1)
+					return "No";
+
+				return copies[id] == 2 ? QString("1 copy") : QString("%1 copies").arg(copies[id] - 1);
+		}
+	} else if (role == Qt::DecorationRole && index.column() == COLUMN_FILES) {
+		return getThumbnail(id);
+	} else if (role == Qt::ToolTipRole) {
+		return paths[id];
+	}
+
+	return QVariant();
+}
+
+void DuplicateGroupsModel::sort(int column, Qt::SortOrder order)
+{
+	if (column < 0 || column >= COLUMN_COUNT || (column == sortColumn && order == sortOrder))
+		return;
+
+	sortColumn = column;
+	sortOrder = order;
+
+	sortGroups();
+}
+
+void DuplicateGroupsModel::sortGroups()
+{
+	emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+	QModelIndexList from = persistentIndexList();
+	QModelIndexList to;
+	QVector<int> roots;
+
+	// Member rows are found through their root, only the group rows move.
+	foreach (QModelIndex index, from) {
+		roots.append(index.internalId() == 0 && index.row() < groups.length() ? groups[index.row()] : -1);
+	}
+
+	std::sort(groups.begin(), groups.end(), [this](const int root, const int otherRoot) {
+		return lessThan(root, otherRoot);
+	});
+
+	for (int i = 0; i < from.length(); i++) {
+		if (roots[i] >= 0)
+			to.append(createIndex(findGroupRow(roots[i]), from[i].column(), quintptr(0)));
+
+		else
+			to.append(from[i]);
+	}
+
+	changePersistentIndexList(from, to);
+
+	emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+void DuplicateGroupsModel::addDuplicates(const InputFileItemPtr item, const QVector<InputFileItemPtr> duplicates)
+{
+	int id = addFile(item->getPath(), item->getSize());
+
+	foreach (InputFileItemPtr duplicate, duplicates) {
+		link(id, addFile(duplicate->getPath(), duplicate->getSize()), true);
+	}
+}
+
+/*
+ * Union-find can't split a set, so removing files rebuilds the groups from the
+ * pairs that are left. Removals are rare next to matches coming in.
+ */
+void DuplicateGroupsModel::removeFiles(const QStringList removedPaths)
+{
+	QVector<bool> removed(paths.length(), false);
+	bool found = false;
+
+	foreach (QString path, removedPaths) {
+		int id = fileIds.value(path, -1);
+
+		if (id >= 0) {
+			removed[id] = true;
+			found = true;
+		}
+	}
+
+	if (!found)
+		return;
+
+	QVector<QPair<int, int>> oldPairs = pairs;
+	QVector<QString> oldPaths = paths;
+	QVector<qint64> oldSizes = sizes;
+	QVector<QByteArray> oldKeys = keys;
+
+	beginResetModel();
+
+	reset();
+
+	for (int i = 0; i < oldPairs.length(); i++) {
+		int id = oldPairs[i].first;
+		int otherId = oldPairs[i].second;
+
+		if (!removed[id] && !removed[otherId])
+			link(addFile(oldPaths[id], oldSizes[id], oldKeys[id]), addFile(oldPaths[otherId], oldSizes[otherId], oldKeys[otherId]), false);
+	}
+
+	endResetModel();
+}
+
+/*
+ * Makes the groups the ones these pairs form, for when the pairs are chosen
+ * elsewhere and can be swapped out. While pairs are only added the view is
+ * kept as it is, once one goes the groups are rebuilt.
+ */
+void DuplicateGroupsModel::setPairs(const QVector<QPair<InputFileItemPtr, InputFileItemPtr>> newPairs)
+{
+	QSet<QPair<QString, QString>> wanted;
+	QSet<QPair<QString, QString>> existing;
+	bool removed = false;
+
+	for (int i = 0; i < newPairs.length(); i++) {
+		QString path = newPairs[i].first->getPath();
+		QString otherPath = newPairs[i].second->getPath();
+
+		wanted.insert(qMakePair(qMin(path, otherPath), qMax(path, otherPath)));
+	}
+
+	for (int i = 0; i < pairs.length() && !removed; i++) {
+		QString path = paths[pairs[i].first];
+		QString otherPath = paths[pairs[i].second];
+		QPair<QString, QString> key = qMakePair(qMin(path, otherPath), qMax(path, otherPath));
+
+		removed = !wanted.contains(key);
+		existing.insert(key);
+	}
+
+	if (removed) {
+		beginResetModel();
+
+		reset();
+		existing.clear();
+	}
+
+	for (int i = 0; i < newPairs.length(); i++) {
+		QString path = newPairs[i].first->getPath();
+		QString otherPath = newPairs[i].second->getPath();
+
+		if (existing.contains(qMakePair(qMin(path, otherPath), qMax(path, otherPath))))
+			continue;
+
+		link(addFile(path, newPairs[i].first->getSize()), addFile(otherPath, newPairs[i].second->getSize()), !removed);
+	}
+
+	if (removed)
+		endResetModel();
+}
+
+/*
+ * Rebuilds the groups from the stored pairs within maxDifference, for when the
+ * similarity threshold moves. The sets are all joined before the groups are
+ * sorted once, and keys already looked up are kept, so this costs little more
+ * than reading the pairs.
+ */
+void DuplicateGroupsModel::regroup(PairStore &store, const double maxDifference)
+{
+	QVector<QString> storePaths;
+	QVector<qint64> storeSizes;
+	QVector<PairStore::Pair> storePairs = store.getPairs(maxDifference, &storePaths, &storeSizes);
+	QVector<int> ids(storePaths.length(), -1);
+	QHash<QString, QByteArray> oldKeys;
+
+	for (int i = 0; i < paths.length(); i++)
+		oldKeys.insert(paths[i], keys[i]);
+
+	beginResetModel();
+
+	reset();
+
+	foreach (PairStore::Pair pair, storePairs) {
+		int id = static_cast<int>(pair.id);
+		int otherId = static_cast<int>(pair.otherId);
+
+		if (ids[id] < 0)
+			ids[id] = addFile(storePaths[id], storeSizes[id], oldKeys.value(storePaths[id]));
+
+		if (ids[otherId] < 0)
+			ids[otherId] = addFile(storePaths[otherId], storeSizes[otherId], oldKeys.value(storePaths[otherId]));
+
+		unite(ids[id], ids[otherId]);
+	}
+
+	for (int id = 0; id < paths.length(); id++) {
+		if (parents[id] == id && counts[id] > 1)
+			groups.append(id);
+	}
+
+	std::sort(groups.begin(), groups.end(), [this](const int root, const int otherRoot) {
+		return lessThan(root, otherRoot);
+	});
+
+	endResetModel();
+}
+
+void DuplicateGroupsModel::clear()
+{
+	beginResetModel();
+
+	reset();
+
+	endResetModel();
+}
+
+QString DuplicateGroupsModel::getPath(const QModelIndex &index) const
+{
+	if (!index.isValid() || index.internalId() == 0)
+		return QString();
+
+	int id = members.value(static_cast<int>(index.internalId() - 1)).value(index.row(), -1);
+
+	return id >= 0 ? paths[id] : QString();
+}
+
+// The paths in each group that hasn't been verified as a whole yet.
+QVector<QStringList> DuplicateGroupsModel::getUnverifiedGroups() const
+{
+	QVector<QStringList> unverified;
+
+	foreach (int root, groups) {
+		if (verified[root] == counts[root])
+			continue;
+
+		unverified.append(QStringList());
+
+		foreach (int id, getMembers(root)) {
+			unverified.last().append(paths[id]);
+		}
+	}
+
+	return unverified;
+}
+
+/*
+ * Records the outcome of FileVerifier::findIdentical() for verifiedPaths, the
+ * sets of identical files in identical. Files removed since are skipped.
+ */
+void DuplicateGroupsModel::setVerified(const QStringList verifiedPaths, const QVector<QStringList> identical)
+{
+	QHash<int, int> results;
+	QSet<int> roots;
+
+	foreach (QString path, verifiedPaths) {
+		int id = fileIds.value(path, -1);
+
+		if (id >= 0)
+			results.insert(id, 1);
+	}
+
+	foreach (QStringList set, identical) {
+		foreach (QString path, set) {
+			int id = fileIds.value(path, -1);
+
+			if (id >= 0)
+				results.insert(id, set.length());
+		}
+	}
+
+	for (QHash<int, int>::const_iterator result = results.constBegin(); result != results.constEnd(); result++) {
+		int id = result.key();
+		int root = find(id);
+
+		if (!copies[id])
+			verified[root]++;
+
+		exact[root] += (result.value() > 1) - (copies[id] > 1);
+		copies[id] = result.value();
+		roots.insert(root);
+	}
+
+	// Other columns keep the groups in order as they are.
+	if (sortColumn == COLUMN_IDENTICAL)
+		sortGroups();
+
+	foreach (int root, roots) {
+		int row = findGroupRow(root);
+
+		if (row < 0)
+			continue;
+
+		emit dataChanged(index(row, COLUMN_IDENTICAL), index(row, COLUMN_IDENTICAL));
+
+		if (members.contains(root))
+			emit dataChanged(createIndex(0, COLUMN_IDENTICAL, quintptr(root + 1)), createIndex(members[root].length() - 1, COLUMN_IDENTICAL, quintptr(root + 1)));
+	}
+}
+
+int DuplicateGroupsModel::addFile(const QString path, const qint64 size, const QByteArray key)
+{
+	QHash<QString, int>::const_iterator existing = fileIds.constFind(path);
+
+	if (existing != fileIds.constEnd())
+		return existing.value();
+
+	int id = paths.length();
+
+	fileIds.insert(path, id);
+	paths.append(path);
+	sizes.append(size);
+	keys.append(key);
+	copies.append(0);
+	parents.append(id);
+	next.append(id);
+	counts.append(1);
+	bytes.append(size);
+	largest.append(size);
+	verified.append(0);
+	exact.append(0);
+
+	return id;
+}
+
+/*
+ * Only rows on screen ask for their thumbnail, and decoded ones are kept in the
+ * pixmap cache. A file's cache key is only worked out the first time, most
+ * grouped files are never scrolled to.
+ */
+QVariant DuplicateGroupsModel::getThumbnail(const int id) const
+{
+	if (!thumbnails)
+		return QVariant();
+
+	if (keys[id].isEmpty())
+		keys[id] = getFileCacheKey(paths[id]);
+
+	QString cacheKey = "thumbnail:" + QString::fromLatin1(keys[id].toHex());
+	QPixmap pixmap;
+
+	if (!QPixmapCache::find(cacheKey, &pixmap)) {
+		QByteArray thumbnail = thumbnails->get(keys[id]);
+
+		if (thumbnail.isEmpty() || !pixmap.loadFromData(thumbnail, "JPG"))
+			return QVariant();
+
+		QPixmapCache::insert(cacheKey, pixmap);
+	}
+
+	return pixmap;
+}
+
+int DuplicateGroupsModel::find(int id)
+{
+	while (parents[id] != id) {
+		// Path halving keeps the trees flat without a second pass.
+		parents[id] = parents[parents[id]];
+		id = parents[id];
+	}
+
+	return id;
+}
+
+// Keeps a pair for removeFiles() to replay, once however often it's matched.
+void DuplicateGroupsModel::record(const int id, const int otherId)
+{
+	quint64 key = static_cast<quint64>(qMin(id, otherId)) << 32 | static_cast<quint32>(qMax(id, otherId));
+
+	if (id == otherId || recorded.contains(key))
+		return;
+
+	recorded.insert(key);
+	pairs.append(qMakePair(id, otherId));
+}
+
+void DuplicateGroupsModel::link(const int id, const int otherId, const bool notify)
+{
+	int root = find(id);
+	int otherRoot = find(otherId);
+
+	// Pairs within a group are kept too, removing a file may leave them as the only link.
+	record(id, otherId);
+
+	if (root == otherRoot)
+		return;
+
+	// The larger set absorbs the smaller one, which keeps both the trees shallow
+	// and the row that moves the least.
+	if (counts[root] < counts[otherRoot])
+		std::swap(root, otherRoot);
+
+	bool isGroup = counts[root] > 1;
+	int row = isGroup ? findGroupRow(root) : -1;
+	QVector<int> added;
+
+	if (counts[otherRoot] > 1) {
+		int otherRow = findGroupRow(otherRoot);
+
+		if (notify)
+			beginRemoveRows(QModelIndex(), otherRow, otherRow);
+
+		groups.remove(otherRow);
+		members.remove(otherRoot);
+
+		if (notify)
+			endRemoveRows();
+
+		if (row > otherRow)
+			row--;
+	}
+
+	if (members.contains(root))
+		added = getMembers(otherRoot);
+
+	parents[otherRoot] = root;
+	std::swap(next[root], next[otherRoot]);
+
+	if (!isGroup) {
+		mergeTotals(root, otherRoot);
+		row = findInsertRow(root, 0, groups.length());
+
+		if (notify)
+			beginInsertRows(QModelIndex(), row, row);
+
+		groups.insert(row, root);
+
+		if (notify)
+			endInsertRows();
+
+		return;
+	}
+
+	if (!added.isEmpty()) {
+		QVector<int> &groupMembers = members[root];
+
+		if (notify)
+			beginInsertRows(createIndex(row, 0, quintptr(0)), groupMembers.length(), groupMembers.length() + added.length() - 1);
+
+		groupMembers += added;
+
+		if (notify)
+			endInsertRows();
+	}
+
+	// Views look up the parent of member rows by the group's totals, so those only
+	// change once nothing else will be signalled before the group is back in order.
+	mergeTotals(root, otherRoot);
+
+	// The group only grew, so it only ever moves one way, towards the front when sorted largest first.
+	if (row > 0 && lessThan(root, groups[row - 1])) {
+		int destination = findInsertRow(root, 0, row);
+
+		if (notify)
+			beginMoveRows(QModelIndex(), row, row, QModelIndex(), destination);
+
+		groups.remove(row);
+		groups.insert(destination, root);
+
+		if (notify)
+			endMoveRows();
+
+		row = destination;
+	} else if (row < groups.length() - 1 && lessThan(groups[row + 1], root)) {
+		int destination = findInsertRow(root, row + 1, groups.length());
+
+		if (notify)
+			beginMoveRows(QModelIndex(), row, row, QModelIndex(), destination);
+
+		groups.remove(row);
+		groups.insert(destination - 1, root);
+
+		if (notify)
+			endMoveRows();
+
+		row = destination - 1;
+	}
+
+	if (notify)
+		emit dataChanged(index(row, 0), index(row, COLUMN_COUNT - 1));
+}
+
+// Joins two sets without keeping the group rows in order, for when they're all sorted afterwards.
+void DuplicateGroupsModel::unite(const int id, const int otherId)
+{
+	int root = find(id);
+	int otherRoot = find(otherId);
+
+	record(id, otherId);
+
+	if (root == otherRoot)
+		return;
+
+	if (counts[root] < counts[otherRoot])
+		std::swap(root, otherRoot);
+
+	parents[otherRoot] = root;
+	std::swap(next[root], next[otherRoot]);
+	mergeTotals(root, otherRoot);
+}
+
+void DuplicateGroupsModel::mergeTotals(const int root, const int otherRoot)
+{
+	counts[root] += counts[otherRoot];
+	bytes[root] += bytes[otherRoot];
+	largest[root] = qMax(largest[root], largest[otherRoot]);
+	verified[root] += verified[otherRoot];
+	exact[root] += exact[otherRoot];
+}
+
+QVector<int> DuplicateGroupsModel::getMembers(const int root) const
+{
+	QVector<int> groupMembers;
+	int id = root;
+
+	groupMembers.reserve(counts[root]);
+
+	do {
+		groupMembers.append(id);
+		id = next[id];
+	} while (id != root);
+
+	return groupMembers;
+}
+
+qint64 DuplicateGroupsModel::getSortKey(const int root) const
+{
+	switch (sortColumn) {
+		case COLUMN_FILES:
+			return counts[root];
+
+		case COLUMN_SIZE:
+			return bytes[root];
+
+		case COLUMN_IDENTICAL:
+			return exact[root];
+
+		case COLUMN_RECLAIMABLE:
+		default:
+			return bytes[root] - largest[root];
+	}
+}
+
+bool DuplicateGroupsModel::lessThan(const int root, const int otherRoot) const
+{
+	qint64 key = getSortKey(root);
+	qint64 otherKey = getSortKey(otherRoot);
+
+	if (key != otherKey)
+		return sortOrder == Qt::AscendingOrder ? key < otherKey : key > otherKey;
+
+	return root < otherRoot;
+}
+
+// Only valid while the group's totals are still the ones it was placed with.
+int DuplicateGroupsModel::findGroupRow(const int root) const
+{
+	int row = findInsertRow(root, 0, groups.length());
+
+	if (row >= groups.length() || groups[row] != root)
+		return -1;
+
+	return row;
+}
+
+int DuplicateGroupsModel::findInsertRow(const int root, const int from, const int to) const
+{
+	QVector<int>::const_iterator position = std::lower_bound(groups.constBegin() + from, groups.constBegin() + to, root, [this](const int group, const int otherGroup) {
+		return lessThan(group, otherGroup);
+	});
+
+	return static_cast<int>(position - groups.constBegin());
+}
+
+void DuplicateGroupsModel::reset()
+{
+	fileIds.clear();
+	paths.clear();
+	sizes.clear();
+	keys.clear();
+	copies.clear();
+	parents.clear();
+	next.clear();
+	counts.clear();
+	bytes.clear();
+	largest.clear();
+	verified.clear();
+	exact.clear();
+	pairs.clear();
+	recorded.clear();
+	groups.clear();
+	members.clear();
+}
@@ -0,0 +1,110 @@
+#ifndef DUPLICATEGROUPSMODEL_H
+#define DUPLICATEGROUPSMODEL_H
+
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include "inputfilesmodel.h"
+#include "pairstore.h"
+#include "thumbnailstore.h"
+
+/*
+ * Groups of files that were found to be duplicates of each other, as a two level
+ * tree of groups and their members. Files are clustered with a union-find over
+ * every confirmed pair, and each set also keeps its members in a circular list so
+ * two groups merge in constant time. Nothing per file is stored beyond a handful
+ * of flat arrays indexed by file id, and a group's member rows are only built once
+ * it's expanded.
+ *
+ * Groups are kept sorted, largest first, by the number of files, the total size
+ * or the space that deleting all but the largest file would free. A merge only
+ * removes the smaller group's row and moves the larger one to its new place.
+ *
+ * Groups can be checked byte for byte with FileVerifier. The results are kept
+ * per file and dropped when files are removed or the threshold moves, since the
+ * groups are rebuilt then.
+ */
+class DuplicateGroupsModel: public QAbstractItemModel
+{
+	Q_OBJECT
+
+	public:
+		enum COLUMN {
+			COLUMN_FILES,
+			COLUMN_SIZE,
+			COLUMN_RECLAIMABLE,
+			COLUMN_IDENTICAL,
+			COLUMN_COUNT
+		};
+
+		explicit DuplicateGroupsModel(QObject *parent = nullptr);
+
+		QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+		QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+		QModelIndex parent(const QModelIndex &child) const override;
+		int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+		int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+		bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+		bool canFetchMore(const QModelIndex &parent) const override;
+		void fetchMore(const QModelIndex &parent) override;
+		QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+		void sort(int column, Qt::SortOrder order = Qt::DescendingOrder) override;
+
+		void addDuplicates(const InputFileItemPtr item, const QVector<InputFileItemPtr> duplicates);
+		void removeFiles(const QStringList removedPaths);
+		void setPairs(const QVector<QPair<InputFileItemPtr, InputFileItemPtr>> newPairs);
+		void regroup(PairStore &store, const double maxDifference);
+		void clear();
+		QString getPath(const QModelIndex &index) const;
+		QVector<QStringList> getUnverifiedGroups() const;
+		void setVerified(const QStringList verifiedPaths, const QVector<QStringList> identical);
+		void setThumbnailStore(ThumbnailStore *thumbnails) { this->thumbnails = thumbnails; }
+
+	private:
+		QHash<QString, int> fileIds;
+		QVector<QString> paths;
+		QVector<qint64> sizes;
+		// Cache keys of the files, empty until their thumbnail is first shown.
+		mutable QVector<QByteArray> keys;
+		// How many files share a file's bytes, itself included, or 0 until it's been verified.
+		QVector<int> copies;
+		QVector<int> parents;
+		QVector<int> next;
+		// Only meaningful for the root of each set.
+		QVector<int> counts;
+		QVector<qint64> bytes;
+		QVector<qint64> largest;
+		// Files that have been verified, and those of them with an exact copy.
+		QVector<int> verified;
+		QVector<int> exact;
+
+		QVector<QPair<int, int>> pairs;
+		// The pairs above as lower id in the high half and higher id in the low half.
+		QSet<quint64> recorded;
+		QVector<int> groups;
+		QHash<int, QVector<int>> members;
+		int sortColumn;
+		Qt::SortOrder sortOrder;
+		ThumbnailStore *thumbnails;
+
+		int addFile(const QString path, const qint64 size, const QByteArray key = QByteArray());
+		QVariant getThumbnail(const int id) const;
+		int find(int id);
+		void record(const int id, const int otherId);
+		void link(const int id, const int otherId, const bool notify);
+		void unite(const int id, const int otherId);
+		void mergeTotals(const int root, const int otherRoot);
+		void sortGroups();
+		QVector<int> getMembers(const int root) const;
+		qint64 getSortKey(const int root) const;
+		bool lessThan(const int root, const int otherRoot) const;
+		int findGroupRow(const int root) const;
+		int findInsertRow(const int root, const int from, const int to) const;
+		void reset();
+};
+
+#endif // DUPLICATEGROUPSMODEL_H
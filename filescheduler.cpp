@@ -0,0 +1,302 @@
+#include <QSet>
+#include <QThread>
+
+#include <limits>
+
+#include "filescheduler.h"
+
+const int FileScheduler::BACKFILL_LIMIT = 64;
+const int FileScheduler::BACKFILL_DEPTH = 256;
+
+FileScheduler::FileScheduler()
+{
+	sequence = 0;
+	consumers = 0;
+	maxConsumers = QThread::idealThreadCount();
+	memoryBudget = 0;
+	memoryInUse = 0;
+	bypassed = 0;
+
+	for (int stage = 0; stage < STAGE_COUNT; stage++) {
+		stageLimits[stage] = 0;
+		running[stage] = 0;
+		finishedFiles[stage] = 0;
+		finishedBytes[stage] = 0;
+	}
+}
+
+void FileScheduler::push(const Job job)
+{
+	QMutexLocker lock(&mutex);
+
+	if (keys.contains(job.path))
+		return;
+
+	Key key = { job.probe, job.cost, sequence++ };
+
+	keys[job.path] = key;
+	jobs[key] = job;
+}
+
+bool FileScheduler::take(Job &job)
+{
+	QMutexLocker lock(&mutex);
+
+	return takeLocked(job);
+}
+
+void FileScheduler::finish(const Job &job)
+{
+	QMutexLocker lock(&mutex);
+
+	releaseLocked(job);
+	finishedFiles[getStage(job)]++;
+	finishedBytes[getStage(job)] += job.cost;
+}
+
+// For a job that was handed out but never done, such as one that's queued again.
+void FileScheduler::release(const Job &job)
+{
+	QMutexLocker lock(&mutex);
+
+	releaseLocked(job);
+}
+
+void FileScheduler::releaseLocked(const Job &job)
+{
+	memoryInUse = qMax<qint64>(0, memoryInUse - job.memory);
+	running[getStage(job)] = qMax(0, running[getStage(job)] - 1);
+}
+
+/*
+ * Empties the queue, most urgent first, whatever the limits say. Nothing is
+ * counted as running, so these are never finished.
+ */
+QList<FileScheduler::Job> FileScheduler::takeAll()
+{
+	QMutexLocker lock(&mutex);
+	QList<Job> taken = visibleJobs.values() + jobs.values();
+
+	visibleJobs.clear();
+	jobs.clear();
+	keys.clear();
+
+	return taken;
+}
+
+// 0 means unlimited. Jobs already handed out keep running.
+void FileScheduler::setMemoryBudget(const qint64 bytes)
+{
+	QMutexLocker lock(&mutex);
+
+	memoryBudget = bytes;
+}
+
+/*
+ * 0 means no limit for that stage. Consumers are limited to both together, since
+ * that's as many as could ever be busy.
+ */
+void FileScheduler::setStageLimits(const int probes, const int fingerprints)
+{
+	QMutexLocker lock(&mutex);
+
+	stageLimits[STAGE_PROBE] = probes;
+	stageLimits[STAGE_FINGERPRINT] = fingerprints;
+
+	if (probes > 0 && fingerprints > 0)
+		maxConsumers = probes + fingerprints;
+}
+
+FileScheduler::Stats FileScheduler::getStats() const
+{
+	QMutexLocker lock(&mutex);
+	QList<const QMap<Key, Job> *> queues = QList<const QMap<Key, Job> *>() << &visibleJobs << &jobs;
+	Key fingerprints = { false, std::numeric_limits<qint64>::min(), 0 };
+	Stats stats;
+
+	for (int stage = 0; stage < STAGE_COUNT; stage++) {
+		stats.running[stage] = running[stage];
+		stats.queued[stage] = false;
+		stats.files[stage] = finishedFiles[stage];
+		stats.bytes[stage] = finishedBytes[stage];
+	}
+
+	// Probes sort ahead of everything else, so each queue shows what it has at its front and past its probes.
+	foreach (const QMap<Key, Job> *queue, queues) {
+		if (!queue->isEmpty() && queue->constBegin()->probe)
+			stats.queued[STAGE_PROBE] = true;
+
+		if (queue->lowerBound(fingerprints) != queue->constEnd())
+			stats.queued[STAGE_FINGERPRINT] = true;
+	}
+
+	return stats;
+}
+
+bool FileScheduler::takeLocked(Job &job)
+{
+	QList<QMap<Key, Job> *> queues = QList<QMap<Key, Job> *>() << &visibleJobs << &jobs;
+	bool first = true;
+	// Where fingerprinting starts, every probe sorts ahead of it.
+	Key fingerprints = { false, std::numeric_limits<qint64>::min(), 0 };
+
+	// Only the first few jobs are looked at, the queue is cheapest first so that's where small ones are.
+	foreach (QMap<Key, Job> *queue, queues) {
+		QMap<Key, Job>::iterator iter = queue->begin();
+
+		for (int depth = 0; iter != queue->end() && depth < BACKFILL_DEPTH; depth++) {
+			if (!iter->token || *iter->token) {
+				keys.remove(iter->path);
+				iter = queue->erase(iter);
+
+				continue;
+			}
+
+			STAGE stage = getStage(*iter);
+
+			// A stage that's busy enough is skipped whole, it doesn't hold up the other one.
+			if (stageLimits[stage] > 0 && running[stage] >= stageLimits[stage]) {
+				if (stage != STAGE_PROBE)
+					break;
+
+				iter = queue->lowerBound(fingerprints);
+
+				continue;
+			}
+
+			if (fits(*iter)) {
+				job = *iter;
+				keys.remove(job.path);
+				queue->erase(iter);
+				running[stage]++;
+
+				if (first || job.path == blockedPath) {
+					blockedPath.clear();
+					bypassed = 0;
+				} else {
+					bypassed++;
+				}
+
+				memoryInUse += job.memory;
+
+				return true;
+			}
+
+			if (first) {
+				if (iter->path != blockedPath) {
+					blockedPath = iter->path;
+					bypassed = 0;
+				}
+
+				// Let running jobs drain until the one at the front fits.
+				if (bypassed >= BACKFILL_LIMIT)
+					return false;
+
+				first = false;
+			}
+
+			++iter;
+		}
+	}
+
+	return false;
+}
+
+bool FileScheduler::fits(const Job &job) const
+{
+	return memoryBudget <= 0 || memoryInUse == 0 || memoryInUse + job.memory <= memoryBudget;
+}
+
+void FileScheduler::setVisible(const QStringList paths)
+{
+	QMutexLocker lock(&mutex);
+	QSet<QString> visible = paths.toSet();
+
+	// Only a screenful of jobs ever moves, so this stays cheap however long the queue is.
+	foreach (Job job, visibleJobs) {
+		if (!visible.contains(job.path)) {
+			Key key = keys.value(job.path);
+
+			jobs[key] = visibleJobs.take(key);
+		}
+	}
+
+	foreach (QString path, visible) {
+		QHash<QString, Key>::const_iterator key = keys.constFind(path);
+
+		if (key != keys.constEnd() && jobs.contains(key.value()))
+			visibleJobs[key.value()] = jobs.take(key.value());
+	}
+}
+
+void FileScheduler::prune()
+{
+	QMutexLocker lock(&mutex);
+	QList<QMap<Key, Job> *> queues = QList<QMap<Key, Job> *>() << &visibleJobs << &jobs;
+
+	foreach (QMap<Key, Job> *queue, queues) {
+		QMap<Key, Job>::iterator iter = queue->begin();
+
+		while (iter != queue->end()) {
+			if (!iter->token || *iter->token) {
+				keys.remove(iter->path);
+				iter = queue->erase(iter);
+			} else {
+				++iter;
+			}
+		}
+	}
+}
+
+void FileScheduler::clear()
+{
+	QMutexLocker lock(&mutex);
+
+	visibleJobs.clear();
+	jobs.clear();
+	keys.clear();
+}
+
+int FileScheduler::length() const
+{
+	QMutexLocker lock(&mutex);
+
+	return keys.size();
+}
+
+void FileScheduler::setMaxConsumers(const int count)
+{
+	QMutexLocker lock(&mutex);
+
+	maxConsumers = count;
+}
+
+bool FileScheduler::startConsumer()
+{
+	QMutexLocker lock(&mutex);
+
+	if (keys.isEmpty() || consumers >= maxConsumers)
+		return false;
+
+	// Nothing may fit until a running job finishes, which starts another consumer then.
+	if (memoryBudget > 0 && memoryInUse >= memoryBudget)
+		return false;
+
+	consumers++;
+
+	return true;
+}
+
+bool FileScheduler::takeOrStop(Job &job)
+{
+	QMutexLocker lock(&mutex);
+
+	// Stopping has to happen under the same lock as the emptiness check, otherwise a
+	// push() racing with us could be left without anyone to run it.
+	if (consumers <= maxConsumers && takeLocked(job))
+		return true;
+
+	consumers--;
+
+	return false;
+}
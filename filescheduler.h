@@ -0,0 +1,120 @@
+#ifndef FILESCHEDULER_H
+#define FILESCHEDULER_H
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+
+#include "inputfilesmodel.h"
+
+/*
+ * Thread safe priority queue of files waiting to be processed. Files that are
+ * currently visible in the table are handed out first, then everything else in
+ * order of estimated cost (smallest first), so a few huge files can't hold up a
+ * long scan. Probes always go ahead of fingerprinting, as they're cheap and fill
+ * in the table. Both lookups and reprioritisation are O(log n).
+ *
+ * With a memory budget a job is only handed out while its estimated decoding
+ * memory fits next to the jobs already running, and smaller jobs further back
+ * start in its place. Once BACKFILL_LIMIT jobs have gone around the one at the
+ * front, nothing else starts until it fits, so a large file can't be starved.
+ * A job is always handed out when nothing else is running.
+ *
+ * Probing and fingerprinting can each be limited to a number of jobs running at
+ * once, and how many of each have finished is counted for ConcurrencyController
+ * to tune those limits by.
+ */
+class FileScheduler
+{
+	public:
+		static const int BACKFILL_LIMIT;
+		static const int BACKFILL_DEPTH;
+
+		enum STAGE {
+			STAGE_PROBE,
+			STAGE_FINGERPRINT,
+			STAGE_COUNT
+		};
+
+		struct Job {
+			QString path;
+			bool probe;
+			qint64 cost;
+			qint64 memory;
+			quint32 samples;
+			bool audioFirst;
+			FINGERPRINT_ENGINE engine;
+			FINGERPRINT_PROFILE profile;
+			CancelToken token;
+		};
+
+		// Finished counts only ever go up, so two snapshots give the rate in between.
+		struct Stats {
+			int running[STAGE_COUNT];
+			bool queued[STAGE_COUNT];
+			qint64 files[STAGE_COUNT];
+			qint64 bytes[STAGE_COUNT];
+		};
+
+		FileScheduler();
+
+		void push(const Job job);
+		bool take(Job &job);
+		void finish(const Job &job);
+		void release(const Job &job);
+		QList<Job> takeAll();
+		void setMemoryBudget(const qint64 bytes);
+		void setStageLimits(const int probes, const int fingerprints);
+		Stats getStats() const;
+		void setVisible(const QStringList paths);
+		void prune();
+		void clear();
+		int length() const;
+
+		// Consumer accounting for callers that drain the queue from a thread pool.
+		void setMaxConsumers(const int count);
+		bool startConsumer();
+		bool takeOrStop(Job &job);
+
+	private:
+		// Ordered by phase and cost, then by arrival so equal costs stay first come first served.
+		struct Key {
+			bool probe;
+			qint64 cost;
+			quint64 sequence;
+
+			bool operator <(const Key &other) const {
+				if (probe != other.probe)
+					return probe;
+
+				if (cost != other.cost)
+					return cost < other.cost;
+
+				return sequence < other.sequence;
+			}
+		};
+
+		mutable QMutex mutex;
+		QMap<Key, Job> visibleJobs;
+		QMap<Key, Job> jobs;
+		QHash<QString, Key> keys;
+		quint64 sequence;
+		int consumers;
+		int maxConsumers;
+		qint64 memoryBudget;
+		qint64 memoryInUse;
+		QString blockedPath;
+		int bypassed;
+		int stageLimits[STAGE_COUNT];
+		int running[STAGE_COUNT];
+		qint64 finishedFiles[STAGE_COUNT];
+		qint64 finishedBytes[STAGE_COUNT];
+
+		bool takeLocked(Job &job);
+		void releaseLocked(const Job &job);
+		bool fits(const Job &job) const;
+		static STAGE getStage(const Job &job) { return job.probe ? STAGE_PROBE : STAGE_FINGERPRINT; }
+};
+
+#endif // FILESCHEDULER_H
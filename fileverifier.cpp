@@ -0,0 +1,217 @@
+#include <QFile>
+#include <QHash>
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+#include "fileverifier.h"
+#include "archivereader.h"
+#include "inputfilesmodel.h"
+#include "tracer.h"
+
+const qint64 FileVerifier::CHUNK_SIZE = 64 << 20;
+const qint64 FileVerifier::MIN_CHUNK_SIZE = 1 << 20;
+// How much of all the files being compared is mapped at once, large sets get smaller chunks.
+const qint64 FileVerifier::WINDOW_SIZE = 1024 << 20;
+
+namespace {
+
+// One of the files being compared, read a chunk at a time from the start.
+class VerifiedFile
+{
+	public:
+		explicit VerifiedFile(const QString path): path(path), archive(nullptr), map(nullptr) {}
+		~VerifiedFile() { close(); }
+
+		bool open();
+		const uchar *read(const qint64 offset, const qint64 length);
+		void close();
+
+		QString path;
+
+	private:
+		QFile file;
+		ArchiveReader *archive;
+		uchar *map;
+		QByteArray buffer;
+
+		Q_DISABLE_COPY(VerifiedFile)
+};
+
+bool VerifiedFile::open()
+{
+	if (!ArchiveReader::isMemberPath(qPrintable(path))) {
+		file.setFileName(path);
+
+		return file.open(QIODevice::ReadOnly);
+	}
+
+	archive = new ArchiveReader();
+
+	return archive->open(qPrintable(path)) >= 0;
+}
+
+// The data stays valid until the next call. Chunks have to be asked for in order.
+const uchar *VerifiedFile::read(const qint64 offset, const qint64 length)
+{
+	if (archive) {
+		qint64 done = 0;
+		int ret = 0;
+
+		buffer.resize(static_cast<int>(length));
+
+		while (done < length) {
+			if ((ret = archive->read(reinterpret_cast<uint8_t *>(buffer.data()) + done, static_cast<int>(length - done))) <= 0)
+				return nullptr;
+
+			done += ret;
+		}
+
+		return reinterpret_cast<const uchar *>(buffer.constData());
+	}
+
+	if (map)
+		file.unmap(map);
+
+	if ((map = file.map(offset, length))) {
+#ifdef Q_OS_UNIX
+		// Start reading the whole chunk now rather than a page fault at a time.
+		posix_madvise(map, static_cast<size_t>(length), POSIX_MADV_WILLNEED);
+#endif
+
+		return map;
+	}
+
+	// Some file systems can't be mapped, those are read like archive members.
+	if (!file.seek(offset))
+		return nullptr;
+
+	buffer = file.read(length);
+
+	return buffer.size() == length ? reinterpret_cast<const uchar *>(buffer.constData()) : nullptr;
+}
+
+void VerifiedFile::close()
+{
+	if (map)
+		file.unmap(map);
+
+	map = nullptr;
+	file.close();
+	buffer.clear();
+
+	delete archive;
+	archive = nullptr;
+}
+
+}
+
+static bool isCancelled(const CancelToken &token)
+{
+	return token && *token;
+}
+
+/*
+ * Splits paths into sets of files with identical contents. Files without an
+ * exact copy among paths are left out. Returns nothing if token is set before
+ * the comparison is done, it's checked before every chunk.
+ */
+QVector<QStringList> FileVerifier::findIdentical(const QStringList paths, const CancelToken token)
+{
+	QHash<qint64, QStringList> sizes;
+	QVector<QStringList> identical;
+
+	foreach (QString path, paths) {
+		sizes[getFileSize(path)].append(path);
+	}
+
+	for (QHash<qint64, QStringList>::const_iterator sized = sizes.constBegin(); sized != sizes.constEnd(); sized++) {
+		if (sized.value().length() < 2)
+			continue;
+
+		TRACE_SPAN("verify", sized.value().first());
+
+		qint64 size = sized.key();
+		qint64 chunkSize = qBound(MIN_CHUNK_SIZE, WINDOW_SIZE / sized.value().length() / MIN_CHUNK_SIZE * MIN_CHUNK_SIZE, CHUNK_SIZE);
+		QVector<VerifiedFile *> files;
+		QVector<QVector<VerifiedFile *>> sets(1);
+
+		foreach (QString path, sized.value()) {
+			files.append(new VerifiedFile(path));
+
+			if (files.last()->open())
+				sets[0].append(files.last());
+		}
+
+		if (sets[0].length() < 2)
+			sets.clear();
+
+		for (qint64 offset = 0; offset < size && !sets.isEmpty(); offset += chunkSize) {
+			qint64 length = qMin(chunkSize, size - offset);
+			QVector<QVector<VerifiedFile *>> refined;
+
+			if (isCancelled(token))
+				break;
+
+			foreach (QVector<VerifiedFile *> set, sets) {
+				QVector<QVector<VerifiedFile *>> splits;
+				QVector<const uchar *> leaders;
+
+				foreach (VerifiedFile *file, set) {
+					const uchar *data = file->read(offset, length);
+					int i = 0;
+
+					if (!data) {
+						file->close();
+
+						continue;
+					}
+
+					// Almost always the first leader matches, a set rarely splits more than once.
+					while (i < leaders.length() && memcmp(leaders[i], data, static_cast<size_t>(length)) != 0)
+						i++;
+
+					if (i == leaders.length()) {
+						leaders.append(data);
+						splits.append(QVector<VerifiedFile *>());
+					}
+
+					splits[i].append(file);
+				}
+
+				foreach (QVector<VerifiedFile *> split, splits) {
+					if (split.length() > 1)
+						refined.append(split);
+
+					else
+						split[0]->close();
+				}
+			}
+
+			sets = refined;
+		}
+
+		if (!isCancelled(token)) {
+			foreach (QVector<VerifiedFile *> set, sets) {
+				if (set.length() < 2)
+					continue;
+
+				identical.append(QStringList());
+
+				foreach (VerifiedFile *file, set) {
+					identical.last().append(file->path);
+				}
+			}
+		}
+
+		qDeleteAll(files);
+	}
+
+	if (isCancelled(token))
+		return QVector<QStringList>();
+
+	return identical;
+}
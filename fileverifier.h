@@ -0,0 +1,31 @@
+#ifndef FILEVERIFIER_H
+#define FILEVERIFIER_H
+
+#include <QStringList>
+#include <QVector>
+
+#include "inputfilesmodel.h"
+
+/*
+ * Confirms which files in a group of duplicates are byte for byte identical,
+ * before anything is done to them that relies on it. Files are only compared
+ * with files of the same size, and all of those are read together in one pass,
+ * a chunk of each at a time: every file is checked against the first of the
+ * files that have matched it so far, so reading the set costs about as much as
+ * reading each file once. A file drops out at the first chunk that sets it apart
+ * from every other file, so differing files are rarely read far.
+ *
+ * Files on disk are mapped a chunk at a time, archive members are read through
+ * ArchiveReader instead. A file that can't be read is treated as having no copy.
+ */
+class FileVerifier
+{
+	public:
+		static const qint64 CHUNK_SIZE;
+		static const qint64 MIN_CHUNK_SIZE;
+		static const qint64 WINDOW_SIZE;
+
+		static QVector<QStringList> findIdentical(const QStringList paths, const CancelToken token = CancelToken());
+};
+
+#endif // FILEVERIFIER_H
@@ -0,0 +1,61 @@
+#include <QDataStream>
+#include <QDir>
+
+#include "fingerprintcache.h"
+
+static const quint32 CACHE_MAGIC = 0x53444650;
+// Has to change whenever InputFileItem's stream format does, unless the new fields
+// go on the end and records without them can still be read.
+static const quint32 CACHE_VERSION = 1;
+
+bool FingerprintCache::open(const QString directory)
+{
+	if (!QDir().mkpath(directory))
+		return false;
+
+	return log.open(QDir(directory).filePath("fingerprints.dat"), CACHE_MAGIC, CACHE_VERSION);
+}
+
+bool FingerprintCache::contains(const QByteArray key) const
+{
+	return log.contains(key);
+}
+
+// In the order they're stored, so getting every item is one pass over the file.
+QList<QByteArray> FingerprintCache::getKeys() const
+{
+	return log.getKeys();
+}
+
+InputFileItemPtr FingerprintCache::get(const QByteArray key)
+{
+	QByteArray record = log.get(key);
+
+	if (record.isNull())
+		return InputFileItemPtr();
+
+	QSharedPointer<InputFileItem> item(new InputFileItem(QString()));
+	QDataStream itemIn(record);
+
+	itemIn.setVersion(QDataStream::Qt_5_0);
+	itemIn >> *item;
+
+	if (itemIn.status() != QDataStream::Ok)
+		return InputFileItemPtr();
+
+	return item;
+}
+
+void FingerprintCache::insert(const QByteArray key, const InputFileItem &item)
+{
+	if (!log.isOpen())
+		return;
+
+	QByteArray record;
+	QDataStream itemOut(&record, QIODevice::WriteOnly);
+
+	itemOut.setVersion(QDataStream::Qt_5_0);
+	itemOut << item;
+
+	log.append(key, record);
+}
@@ -0,0 +1,31 @@
+#ifndef FINGERPRINTCACHE_H
+#define FINGERPRINTCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "inputfilesmodel.h"
+#include "keyedlog.h"
+
+/*
+ * On disk cache of finished fingerprints, keyed by getFileCacheKey(), so files
+ * that were scanned before don't have to be decoded again. Items are appended
+ * to a KeyedLog as they're finished, so only where each one starts is kept in
+ * memory.
+ *
+ * Only used from the GUI thread.
+ */
+class FingerprintCache
+{
+	public:
+		bool open(const QString directory);
+		bool contains(const QByteArray key) const;
+		QList<QByteArray> getKeys() const;
+		InputFileItemPtr get(const QByteArray key);
+		void insert(const QByteArray key, const InputFileItem &item);
+
+	private:
+		KeyedLog log;
+};
+
+#endif // FINGERPRINTCACHE_H
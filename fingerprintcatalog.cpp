@@ -0,0 +1,240 @@
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QVector>
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+#include "fingerprintcatalog.h"
+#include "fingerprintcache.h"
+
+const char *FingerprintCatalog::ARGUMENT = "--export-catalog";
+const int FingerprintCatalog::HEADER_SIZE = 64;
+const int FingerprintCatalog::RECORD_HEADER_SIZE = 8;
+
+static const quint32 CATALOG_MAGIC = 0x53444354;
+static const quint32 CATALOG_VERSION = 2;
+static const quint64 PREFETCH_ALIGNMENT = 4096;
+
+struct CatalogHeader {
+	quint32 magic;
+	quint32 version;
+	quint32 engine;
+	quint32 recordSize;
+	quint64 count;
+	// Where the table of path offsets starts, the paths follow it.
+	quint64 pathsOffset;
+	quint32 profile;
+	quint32 profileVersion;
+};
+
+static quint64 getPathsOffset(const quint64 count, const int recordSize)
+{
+	quint64 end = static_cast<quint64>(FingerprintCatalog::HEADER_SIZE) + count * static_cast<quint64>(recordSize);
+
+	return (end + 7) & ~static_cast<quint64>(7);
+}
+
+int FingerprintCatalog::getRecordSize(const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile)
+{
+	return RECORD_HEADER_SIZE + static_cast<int>((FingerprintProfile::get(profile).getFingerprintSize(engine) + 7) & ~static_cast<size_t>(7));
+}
+
+/*
+ * Writes every complete picture fingerprint in the fingerprint cache made by
+ * engine and the current version of profile to a new catalog at path. Returns
+ * the number of files written, or -1.
+ */
+int FingerprintCatalog::exportCache(const QString cacheDirectory, const QString path, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile)
+{
+	FingerprintCache cache;
+	QFile catalog(path);
+	QTemporaryFile pathData;
+	QVector<quint64> pathOffsets;
+	int recordSize = getRecordSize(engine, profile);
+	QByteArray record(recordSize, 0);
+	CatalogHeader header;
+
+	if (!cache.open(cacheDirectory) || !catalog.open(QIODevice::WriteOnly | QIODevice::Truncate) || !pathData.open())
+		return -1;
+
+	// The header is filled in once the records are counted.
+	if (!catalog.resize(HEADER_SIZE) || !catalog.seek(HEADER_SIZE))
+		return -1;
+
+	pathOffsets.append(0);
+
+	foreach (QByteArray key, cache.getKeys()) {
+		InputFileItemPtr item = cache.get(key);
+
+		if (!item || !item->isFingerprintComplete() || !item->isFingerprintCurrent(engine, profile))
+			continue;
+
+		if (item->getMediaType() != "Image" && item->getMediaType() != "Video")
+			continue;
+
+		quint32 samples = item->getFingerprintSamples();
+		QByteArray fingerprint = item->getFingerprint().left(recordSize - RECORD_HEADER_SIZE);
+		QByteArray utf8 = item->getPath().toUtf8();
+
+		record.fill(0);
+		memcpy(record.data(), &samples, sizeof(samples));
+		memcpy(record.data() + RECORD_HEADER_SIZE, fingerprint.constData(), static_cast<size_t>(fingerprint.size()));
+
+		if (catalog.write(record) != record.size() || pathData.write(utf8) != utf8.size())
+			return -1;
+
+		pathOffsets.append(pathOffsets.last() + static_cast<quint64>(utf8.size()));
+	}
+
+	header.magic = CATALOG_MAGIC;
+	header.version = CATALOG_VERSION;
+	header.engine = static_cast<quint32>(engine);
+	header.profile = static_cast<quint32>(profile);
+	header.profileVersion = FingerprintProfile::get(profile).version;
+	header.recordSize = static_cast<quint32>(recordSize);
+	header.count = static_cast<quint64>(pathOffsets.length() - 1);
+	header.pathsOffset = getPathsOffset(header.count, recordSize);
+
+	if (!catalog.resize(static_cast<qint64>(header.pathsOffset)) || !catalog.seek(static_cast<qint64>(header.pathsOffset)))
+		return -1;
+
+	if (catalog.write(reinterpret_cast<const char *>(pathOffsets.constData()), pathOffsets.length() * static_cast<qint64>(sizeof(quint64))) < 0)
+		return -1;
+
+	pathData.seek(0);
+
+	while (!pathData.atEnd()) {
+		QByteArray chunk = pathData.read(1 << 20);
+
+		if (chunk.isEmpty() || catalog.write(chunk) != chunk.size())
+			return -1;
+	}
+
+	if (!catalog.seek(0) || catalog.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header))
+		return -1;
+
+	return static_cast<int>(header.count);
+}
+
+/*
+ * Takes the catalog to write, optionally "fast" or "thorough" for the fingerprint
+ * method and then optionally the name of the fingerprint profile.
+ */
+int FingerprintCatalog::runExport(const QStringList arguments)
+{
+	QTextStream err(stderr);
+	FINGERPRINT_ENGINE engine = FINGERPRINT_ENGINE_DHASH;
+	int profile = arguments.length() == 3 ? FingerprintProfile::find(qPrintable(arguments[2])) : FINGERPRINT_PROFILE_DEFAULT;
+
+	if (arguments.isEmpty() || arguments.length() > 3 || (arguments.length() >= 2 && arguments[1] != "fast" && arguments[1] != "thorough") || profile < 0) {
+		err << "Usage: SameDifference " << ARGUMENT << " <catalog> [fast|thorough] [fast|default|archive]\n";
+
+		return 2;
+	}
+
+	if (arguments.length() >= 2 && arguments[1] == "thorough")
+		engine = FINGERPRINT_ENGINE_PHASH;
+
+	engine = FingerprintProfile::get(profile).getEngine(engine);
+
+	int written = exportCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation), arguments[0], engine, static_cast<FINGERPRINT_PROFILE>(profile));
+
+	if (written < 0) {
+		err << "Could not write " << arguments[0] << "\n";
+
+		return 1;
+	}
+
+	err << written << " files written to " << arguments[0] << "\n";
+
+	return 0;
+}
+
+FingerprintCatalog::FingerprintCatalog()
+{
+	map = nullptr;
+	count = 0;
+	engine = FINGERPRINT_ENGINE_DHASH;
+	profile = FINGERPRINT_PROFILE_DEFAULT;
+	recordSize = 0;
+	records = nullptr;
+	pathOffsets = nullptr;
+	paths = nullptr;
+}
+
+FingerprintCatalog::~FingerprintCatalog()
+{
+	if (map)
+		file.unmap(map);
+}
+
+// The whole file is mapped, only what's being compared has to be in memory.
+bool FingerprintCatalog::open(const QString path)
+{
+	CatalogHeader header;
+
+	file.setFileName(path);
+
+	if (!file.open(QIODevice::ReadOnly) || file.size() < HEADER_SIZE || !(map = file.map(0, file.size())))
+		return false;
+
+	memcpy(&header, map, sizeof(header));
+
+	if (header.magic != CATALOG_MAGIC || header.version != CATALOG_VERSION)
+		return false;
+
+	if (header.engine > FINGERPRINT_ENGINE_PHASH_16 || header.profile >= FINGERPRINT_PROFILE_COUNT)
+		return false;
+
+	engine = static_cast<FINGERPRINT_ENGINE>(header.engine);
+	profile = static_cast<FINGERPRINT_PROFILE>(header.profile);
+
+	if (static_cast<int>(header.recordSize) != getRecordSize(engine, profile) || header.pathsOffset != getPathsOffset(header.count, static_cast<int>(header.recordSize)))
+		return false;
+
+	quint64 size = static_cast<quint64>(file.size());
+	quint64 tableEnd = header.pathsOffset + (header.count + 1) * sizeof(quint64);
+
+	if (header.pathsOffset > size || tableEnd > size)
+		return false;
+
+	pathOffsets = reinterpret_cast<const quint64 *>(map + header.pathsOffset);
+
+	if (pathOffsets[header.count] > size - tableEnd)
+		return false;
+
+	count = header.count;
+	recordSize = static_cast<int>(header.recordSize);
+	records = map + HEADER_SIZE;
+	paths = reinterpret_cast<const char *>(map + tableEnd);
+
+	return true;
+}
+
+QString FingerprintCatalog::getPath(const quint64 index) const
+{
+	if (index >= count || pathOffsets[index] > pathOffsets[index + 1])
+		return QString();
+
+	return QString::fromUtf8(paths + pathOffsets[index], static_cast<int>(pathOffsets[index + 1] - pathOffsets[index]));
+}
+
+// Asks for records to be read ahead, for when the catalog is larger than memory.
+void FingerprintCatalog::prefetch(const quint64 first, const quint64 records) const
+{
+#ifdef Q_OS_UNIX
+	quint64 begin = static_cast<quint64>(getRecord(first) - map) & ~(PREFETCH_ALIGNMENT - 1);
+	quint64 end = static_cast<quint64>(getRecord(qMin(first + records, count)) - map);
+
+	if (first < count && end > begin)
+		posix_madvise(map + begin, static_cast<size_t>(end - begin), POSIX_MADV_WILLNEED);
+#else
+	Q_UNUSED(first)
+	Q_UNUSED(records)
+#endif
+}
@@ -0,0 +1,58 @@
+#ifndef FINGERPRINTCATALOG_H
+#define FINGERPRINTCATALOG_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+#include "fingerprintengine.h"
+#include "fingerprintprofile.h"
+
+/*
+ * Flat file of finished fingerprints for batch comparisons, laid out so it can
+ * be mapped and used in place however large it is. Every fingerprint in it was
+ * made by the same engine and profile. A 64 byte header is followed
+ * by one fixed size record per file: the sample mask, four bytes of padding and
+ * the fingerprint, padded out to whole 64 bit words. The paths come after the
+ * records, as a table of offsets and then the UTF-8 paths themselves, so the
+ * records stay packed together.
+ *
+ * Everything is in the byte order of the machine that wrote it, a catalog is
+ * made from the local fingerprint cache for use on the same machine.
+ */
+class FingerprintCatalog
+{
+	public:
+		static const char *ARGUMENT;
+		static const int HEADER_SIZE;
+		static const int RECORD_HEADER_SIZE;
+
+		static int getRecordSize(const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile);
+		static int exportCache(const QString cacheDirectory, const QString path, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile);
+		static int runExport(const QStringList arguments);
+
+		FingerprintCatalog();
+		~FingerprintCatalog();
+
+		bool open(const QString path);
+		quint64 getCount() const { return count; }
+		FINGERPRINT_ENGINE getEngine() const { return engine; }
+		FINGERPRINT_PROFILE getProfile() const { return profile; }
+		int getRecordSize() const { return recordSize; }
+		const uchar *getRecord(const quint64 index) const { return records + index * static_cast<quint64>(recordSize); }
+		QString getPath(const quint64 index) const;
+		void prefetch(const quint64 first, const quint64 records) const;
+
+	private:
+		QFile file;
+		uchar *map;
+		quint64 count;
+		FINGERPRINT_ENGINE engine;
+		FINGERPRINT_PROFILE profile;
+		int recordSize;
+		const uchar *records;
+		const quint64 *pathOffsets;
+		const char *paths;
+};
+
+#endif // FINGERPRINTCATALOG_H
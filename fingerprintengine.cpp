@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+	#include <xmmintrin.h>
+	#define FINGERPRINT_ENGINE_SSE
+#endif
+
+#include "fingerprintengine.h"
+
+/*
+ * Rows and columns of the picture behind each row of bits. The middle one is
+ * skipped, so the set looks the same from either side.
+ */
+static inline int dHashLine(const int index)
+{
+	return index < 4 ? index : index + 1;
+}
+
+void DHashEngine::compute(const uint8_t *pixels, const int stride, uint8_t *sample)
+{
+	memset(sample, 0, SAMPLE_SIZE);
+
+	// First 8 bytes compare each pixel with its left neighbour, the last 8 with the one above.
+	for (int y = 0; y < 8; y++) {
+		const uint8_t *row = pixels + dHashLine(y) * stride;
+
+		for (int x = 0; x < WIDTH - 1; x++) {
+			if (row[x + 1] > row[x])
+				sample[y] |= (1 << (7 - x));
+		}
+	}
+
+	for (int y = 0; y < HEIGHT - 1; y++) {
+		const uint8_t *row = pixels + y * stride;
+		const uint8_t *below = row + stride;
+
+		for (int x = 0; x < 8; x++) {
+			if (below[dHashLine(x)] > row[dHashLine(x)])
+				sample[8 + y] |= (1 << (7 - x));
+		}
+	}
+}
+
+/*
+ * For every bit of a transformed dHash, which bit of the original it comes from
+ * and whether it's inverted. Bits are numbered by matrix (horizontal then
+ * vertical), row and column, so bit 64 + 8 * r + c is row r, column c of the
+ * vertical comparisons. The three basic transforms follow from where each
+ * comparison lands in the 9x9 picture, the rest are built up from those.
+ * Pixels that compare equal come out as 0 both ways, which is why inverting
+ * isn't exact and such a match costs a few bits.
+ */
+struct DHashTransformTable {
+	uint8_t source[FINGERPRINT_TRANSFORM_COUNT][128];
+	bool invert[FINGERPRINT_TRANSFORM_COUNT][128];
+
+	DHashTransformTable() {
+		for (int bit = 0; bit < 128; bit++) {
+			source[FINGERPRINT_TRANSFORM_NONE][bit] = static_cast<uint8_t>(bit);
+			invert[FINGERPRINT_TRANSFORM_NONE][bit] = false;
+		}
+
+		for (int bit = 0; bit < 128; bit++) {
+			int vertical = bit / 64;
+			int row = bit / 8 % 8;
+			int column = bit % 8;
+
+			// Mirroring reverses the columns, and horizontal comparisons now look the other way.
+			source[FINGERPRINT_TRANSFORM_MIRROR][bit] = static_cast<uint8_t>(vertical * 64 + row * 8 + 7 - column);
+			invert[FINGERPRINT_TRANSFORM_MIRROR][bit] = !vertical;
+
+			source[FINGERPRINT_TRANSFORM_FLIP][bit] = static_cast<uint8_t>(vertical * 64 + (7 - row) * 8 + column);
+			invert[FINGERPRINT_TRANSFORM_FLIP][bit] = vertical;
+
+			// Transposing turns horizontal comparisons into vertical ones and back.
+			source[FINGERPRINT_TRANSFORM_TRANSPOSE][bit] = static_cast<uint8_t>((1 - vertical) * 64 + column * 8 + row);
+			invert[FINGERPRINT_TRANSFORM_TRANSPOSE][bit] = false;
+		}
+
+		compose(FINGERPRINT_TRANSFORM_ROTATE_180, FINGERPRINT_TRANSFORM_MIRROR, FINGERPRINT_TRANSFORM_FLIP);
+		compose(FINGERPRINT_TRANSFORM_ROTATE_90, FINGERPRINT_TRANSFORM_TRANSPOSE, FINGERPRINT_TRANSFORM_MIRROR);
+		compose(FINGERPRINT_TRANSFORM_ROTATE_270, FINGERPRINT_TRANSFORM_TRANSPOSE, FINGERPRINT_TRANSFORM_FLIP);
+		compose(FINGERPRINT_TRANSFORM_TRANSVERSE, FINGERPRINT_TRANSFORM_ROTATE_90, FINGERPRINT_TRANSFORM_FLIP);
+	}
+
+	// The picture transformed by first and then by second.
+	void compose(const int transform, const int first, const int second) {
+		for (int bit = 0; bit < 128; bit++) {
+			int middle = source[second][bit];
+
+			source[transform][bit] = source[first][middle];
+			invert[transform][bit] = invert[first][middle] != invert[second][bit];
+		}
+	}
+};
+
+static const DHashTransformTable &dHashTransformTable()
+{
+	static const DHashTransformTable table;
+
+	return table;
+}
+
+void DHashEngine::transform(const uint8_t *sample, const FINGERPRINT_TRANSFORM transform, uint8_t *transformed)
+{
+	const DHashTransformTable &table = dHashTransformTable();
+
+	memset(transformed, 0, SAMPLE_SIZE);
+
+	for (int bit = 0; bit < 128; bit++) {
+		int from = table.source[transform][bit];
+		bool value = ((sample[from / 8] >> (7 - from % 8)) & 1) != table.invert[transform][bit];
+
+		if (value)
+			transformed[bit / 8] |= (1 << (7 - bit % 8));
+	}
+}
+
+static const int PHASH_SIZE = PHashEngine::WIDTH;
+static const int MAX_PHASH_COEFFICIENTS = 16;
+
+/*
+ * Rows 1 to 16 of the 32 point DCT-II basis, the only ones either hash looks at.
+ * Kept 16 byte aligned so each row is 8 aligned SSE loads.
+ */
+struct DctTable {
+	alignas(16) float basis[MAX_PHASH_COEFFICIENTS][PHASH_SIZE];
+
+	DctTable() {
+		for (int u = 0; u < MAX_PHASH_COEFFICIENTS; u++) {
+			for (int x = 0; x < PHASH_SIZE; x++)
+				basis[u][x] = static_cast<float>(cos(M_PI * (u + 1) * (2 * x + 1) / (2.0 * PHASH_SIZE)));
+		}
+	}
+};
+
+static const DctTable &dctTable()
+{
+	static const DctTable table;
+
+	return table;
+}
+
+static inline float dot32(const float *a, const float *b)
+{
+#ifdef FINGERPRINT_ENGINE_SSE
+	__m128 sum0 = _mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b));
+	__m128 sum1 = _mm_mul_ps(_mm_load_ps(a + 4), _mm_load_ps(b + 4));
+
+	sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(a + 8), _mm_load_ps(b + 8)));
+	sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(a + 12), _mm_load_ps(b + 12)));
+	sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(a + 16), _mm_load_ps(b + 16)));
+	sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(a + 20), _mm_load_ps(b + 20)));
+	sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(a + 24), _mm_load_ps(b + 24)));
+	sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(a + 28), _mm_load_ps(b + 28)));
+	sum0 = _mm_add_ps(sum0, sum1);
+
+	// Horizontal add of the four lanes.
+	sum0 = _mm_add_ps(sum0, _mm_movehl_ps(sum0, sum0));
+	sum0 = _mm_add_ss(sum0, _mm_shuffle_ps(sum0, sum0, 1));
+
+	return _mm_cvtss_f32(sum0);
+#else
+	float sum = 0.0f;
+
+	for (int i = 0; i < PHASH_SIZE; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+#endif
+}
+
+// The COEFFICIENTS x COEFFICIENTS lowest non-DC frequencies, each compared with their median.
+template <int COEFFICIENTS>
+static void computePHash(const uint8_t *pixels, const int stride, uint8_t *sample)
+{
+	const DctTable &table = dctTable();
+	alignas(16) float image[PHASH_SIZE][PHASH_SIZE];
+	alignas(16) float rows[COEFFICIENTS][PHASH_SIZE];
+	float coefficients[COEFFICIENTS * COEFFICIENTS];
+	float sorted[COEFFICIENTS * COEFFICIENTS];
+
+	for (int y = 0; y < PHASH_SIZE; y++) {
+		for (int x = 0; x < PHASH_SIZE; x++)
+			image[y][x] = pixels[y * stride + x];
+	}
+
+	/*
+	 * The 2D DCT is separable: transform every row against the basis we need, then
+	 * the resulting columns. Only COEFFICIENTS of the 32 outputs are kept in each
+	 * direction, so for the 8x8 hash this is 256 + 64 dot products of 32 rather
+	 * than a full transform.
+	 */
+	for (int v = 0; v < COEFFICIENTS; v++) {
+		for (int y = 0; y < PHASH_SIZE; y++)
+			rows[v][y] = dot32(image[y], table.basis[v]);
+	}
+
+	for (int u = 0; u < COEFFICIENTS; u++) {
+		for (int v = 0; v < COEFFICIENTS; v++)
+			coefficients[u * COEFFICIENTS + v] = dot32(table.basis[u], rows[v]);
+	}
+
+	std::copy(coefficients, coefficients + COEFFICIENTS * COEFFICIENTS, sorted);
+	std::nth_element(sorted, sorted + COEFFICIENTS * COEFFICIENTS / 2, sorted + COEFFICIENTS * COEFFICIENTS);
+
+	float median = sorted[COEFFICIENTS * COEFFICIENTS / 2];
+
+	memset(sample, 0, COEFFICIENTS * COEFFICIENTS / 8);
+
+	for (int bit = 0; bit < COEFFICIENTS * COEFFICIENTS; bit++) {
+		if (coefficients[bit] > median)
+			sample[bit / 8] |= (1 << (7 - bit % 8));
+	}
+}
+
+void PHashEngine::compute(const uint8_t *pixels, const int stride, uint8_t *sample)
+{
+	computePHash<8>(pixels, stride, sample);
+}
+
+void PHash16Engine::compute(const uint8_t *pixels, const int stride, uint8_t *sample)
+{
+	computePHash<16>(pixels, stride, sample);
+}
@@ -0,0 +1,201 @@
+#ifndef FINGERPRINTENGINE_H
+#define FINGERPRINTENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * A fingerprint engine turns one small greyscale picture into a fixed size
+ * sample fingerprint. Everything about an engine is known at compile time, so
+ * code templated on it gets its buffers sized and its comparison loops unrolled
+ * for that engine alone. The id is what gets stored with a fingerprint, as
+ * fingerprints from different engines can't be compared.
+ */
+enum FINGERPRINT_ENGINE {
+	FINGERPRINT_ENGINE_DHASH,
+	FINGERPRINT_ENGINE_PHASH,
+	FINGERPRINT_ENGINE_PHASH_16
+};
+
+/*
+ * The mirrors and quarter turns of a picture. Engines that can work out the
+ * fingerprint of a transformed picture from the original one list how many of
+ * these they support in TRANSFORMS, in this order, so a transformed copy can be
+ * matched without decoding anything again.
+ */
+enum FINGERPRINT_TRANSFORM {
+	FINGERPRINT_TRANSFORM_NONE,
+	FINGERPRINT_TRANSFORM_MIRROR,
+	FINGERPRINT_TRANSFORM_FLIP,
+	FINGERPRINT_TRANSFORM_ROTATE_180,
+	FINGERPRINT_TRANSFORM_TRANSPOSE,
+	FINGERPRINT_TRANSFORM_ROTATE_90,
+	FINGERPRINT_TRANSFORM_ROTATE_270,
+	FINGERPRINT_TRANSFORM_TRANSVERSE,
+	FINGERPRINT_TRANSFORM_COUNT
+};
+
+template <FINGERPRINT_ENGINE engine>
+struct FingerprintEngine;
+
+/*
+ * Difference hash: one bit per horizontal and one per vertical neighbour
+ * comparison over a 9x9 picture, leaving out the middle row and column to get
+ * 8x8 of each. Cheap, but easily thrown by crops and strong re-encodes. As the
+ * picture is symmetric, mirroring or turning it only moves and inverts bits, so
+ * every transform is supported.
+ */
+template <>
+struct FingerprintEngine<FINGERPRINT_ENGINE_DHASH>
+{
+	static const FINGERPRINT_ENGINE ID = FINGERPRINT_ENGINE_DHASH;
+	static const int WIDTH = 9;
+	static const int HEIGHT = 9;
+	static const size_t SAMPLE_SIZE = 16;
+	static const int TRANSFORMS = FINGERPRINT_TRANSFORM_COUNT;
+
+	static void compute(const uint8_t *pixels, const int stride, uint8_t *sample);
+	static void transform(const uint8_t *sample, const FINGERPRINT_TRANSFORM transform, uint8_t *transformed);
+};
+
+/*
+ * Perceptual hash: the 8x8 lowest non-DC frequencies of the DCT of a 32x32
+ * picture, each compared with their median. About ten times the work of a
+ * dHash, but it survives scaling, blurring and recompression much better.
+ * Mirroring flips the sign of half the coefficients, which moves the median,
+ * so transformed copies can't be worked out from the bits alone.
+ */
+template <>
+struct FingerprintEngine<FINGERPRINT_ENGINE_PHASH>
+{
+	static const FINGERPRINT_ENGINE ID = FINGERPRINT_ENGINE_PHASH;
+	static const int WIDTH = 32;
+	static const int HEIGHT = 32;
+	static const size_t SAMPLE_SIZE = 8;
+	static const int TRANSFORMS = 1;
+
+	static void compute(const uint8_t *pixels, const int stride, uint8_t *sample);
+};
+
+/*
+ * The same perceptual hash over the 16x16 lowest frequencies, for four times
+ * the bits. The finer detail tells apart pictures that only share a layout,
+ * like frames from different episodes of a show, for about two and a half
+ * times the work of the 8x8 hash.
+ */
+template <>
+struct FingerprintEngine<FINGERPRINT_ENGINE_PHASH_16>
+{
+	static const FINGERPRINT_ENGINE ID = FINGERPRINT_ENGINE_PHASH_16;
+	static const int WIDTH = 32;
+	static const int HEIGHT = 32;
+	static const size_t SAMPLE_SIZE = 32;
+	static const int TRANSFORMS = 1;
+
+	static void compute(const uint8_t *pixels, const int stride, uint8_t *sample);
+};
+
+typedef FingerprintEngine<FINGERPRINT_ENGINE_DHASH> DHashEngine;
+typedef FingerprintEngine<FINGERPRINT_ENGINE_PHASH> PHashEngine;
+typedef FingerprintEngine<FINGERPRINT_ENGINE_PHASH_16> PHash16Engine;
+
+// Largest sample any engine produces, for callers that need a fixed size buffer.
+static const size_t MAX_SAMPLE_FINGERPRINT_SIZE = 32;
+
+inline size_t getSampleFingerprintSize(const FINGERPRINT_ENGINE engine)
+{
+	switch (engine) {
+		case FINGERPRINT_ENGINE_PHASH:
+			return PHashEngine::SAMPLE_SIZE;
+
+		case FINGERPRINT_ENGINE_PHASH_16:
+			return PHash16Engine::SAMPLE_SIZE;
+
+		case FINGERPRINT_ENGINE_DHASH:
+		default:
+			return DHashEngine::SAMPLE_SIZE;
+	}
+}
+
+inline int getFingerprintTransformCount(const FINGERPRINT_ENGINE engine)
+{
+	switch (engine) {
+		case FINGERPRINT_ENGINE_PHASH:
+			return PHashEngine::TRANSFORMS;
+
+		case FINGERPRINT_ENGINE_PHASH_16:
+			return PHash16Engine::TRANSFORMS;
+
+		case FINGERPRINT_ENGINE_DHASH:
+		default:
+			return DHashEngine::TRANSFORMS;
+	}
+}
+
+inline int popCount(const uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(word);
+#else
+	uint64_t bits = word - ((word >> 1) & 0x5555555555555555ull);
+
+	bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+	bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0full;
+
+	return static_cast<int>((bits * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/*
+ * Number of differing bits between two samples of SIZE bytes. SIZE is a
+ * compile time constant, so this unrolls into a handful of loads and popcounts.
+ */
+template <size_t SIZE>
+inline int getSampleDifference(const uint8_t *sample, const uint8_t *otherSample)
+{
+	static_assert(SIZE % sizeof(uint64_t) == 0, "Sample fingerprints must be a whole number of 64 bit words");
+
+	int diff = 0;
+
+	for (size_t offset = 0; offset < SIZE; offset += sizeof(uint64_t)) {
+		uint64_t word = 0;
+		uint64_t otherWord = 0;
+
+		memcpy(&word, sample + offset, sizeof(word));
+		memcpy(&otherWord, otherSample + offset, sizeof(otherWord));
+
+		diff += popCount(word ^ otherWord);
+	}
+
+	return diff;
+}
+
+/*
+ * Hamming distance over the samples present in both fingerprints, stopping once
+ * more than maxDifference (as a fraction of the compared bits) differ. The
+ * returned difference is only a lower bound when that happens.
+ */
+template <size_t SAMPLE_SIZE>
+inline int getSampledDifference(const uint8_t *fingerprint,
+								const uint8_t *otherFingerprint,
+								uint32_t samples,
+								const double maxDifference,
+								int *comparedBits)
+{
+	int bits = popCount(samples) * static_cast<int>(SAMPLE_SIZE * 8);
+	int limit = static_cast<int>(maxDifference * bits);
+	int diff = 0;
+
+	if (comparedBits)
+		*comparedBits = bits;
+
+	for (size_t i = 0; samples && diff <= limit; i++, samples >>= 1) {
+		if (samples & 1)
+			diff += getSampleDifference<SAMPLE_SIZE>(fingerprint + i * SAMPLE_SIZE, otherFingerprint + i * SAMPLE_SIZE);
+	}
+
+	return diff;
+}
+
+#endif // FINGERPRINTENGINE_H
@@ -0,0 +1,51 @@
+#include <cstring>
+
+#include "fingerprintprofile.h"
+
+/*
+ * Coarse samples are spread over the body of the file, avoiding the intro and
+ * credits. The default profile is what every fingerprint was made with before
+ * there were profiles, which is why fingerprints stored without one are read
+ * back as version 1 of it.
+ */
+static const FingerprintProfile PROFILES[FINGERPRINT_PROFILE_COUNT] = {
+	{ FINGERPRINT_PROFILE_FAST, 1, "fast", 4, (1u << 1) | (1u << 2), 8 },
+	{ FINGERPRINT_PROFILE_DEFAULT, 1, "default", 10, (1u << 1) | (1u << 4) | (1u << 7), 8 },
+	{ FINGERPRINT_PROFILE_ARCHIVE, 1, "archive", 32, (1u << 4) | (1u << 14) | (1u << 24), 16 }
+};
+
+// Ids we don't know, from a newer version or a damaged setting, get the default.
+const FingerprintProfile &FingerprintProfile::get(const int id)
+{
+	if (id < 0 || id >= FINGERPRINT_PROFILE_COUNT)
+		return PROFILES[FINGERPRINT_PROFILE_DEFAULT];
+
+	return PROFILES[id];
+}
+
+// Returns the id of the profile called name, or -1.
+int FingerprintProfile::find(const char *name)
+{
+	for (int id = 0; id < FINGERPRINT_PROFILE_COUNT; id++) {
+		if (!strcmp(PROFILES[id].name, name))
+			return id;
+	}
+
+	return -1;
+}
+
+uint32_t FingerprintProfile::getAllSamples() const
+{
+	return samples >= 32 ? ~0u : (1u << samples) - 1;
+}
+
+// The engine fingerprints are made with when engine is the one asked for.
+FINGERPRINT_ENGINE FingerprintProfile::getEngine(const FINGERPRINT_ENGINE engine) const
+{
+	return hashSize > 8 ? FINGERPRINT_ENGINE_PHASH_16 : engine;
+}
+
+size_t FingerprintProfile::getFingerprintSize(const FINGERPRINT_ENGINE engine) const
+{
+	return getSampleFingerprintSize(engine) * static_cast<size_t>(samples);
+}
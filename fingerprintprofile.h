@@ -0,0 +1,47 @@
+#ifndef FINGERPRINTPROFILE_H
+#define FINGERPRINTPROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "fingerprintengine.h"
+
+/*
+ * How much of a file goes into its fingerprint: how many frames are sampled,
+ * which of them make up the coarse first look, and how large a hash each frame
+ * gets. More samples catch copies that were trimmed or padded, at the cost of a
+ * seek and a decode for each one, so every scan can pick its own trade-off.
+ *
+ * The id and version are stored with every fingerprint, and fingerprints are
+ * only ever compared with ones made by the same version of the same profile.
+ * Whenever the frames a profile takes change, its version goes up: fingerprints
+ * made by the old version are then simply made again, and the ones made by the
+ * other profiles stay valid.
+ */
+enum FINGERPRINT_PROFILE {
+	FINGERPRINT_PROFILE_FAST,
+	FINGERPRINT_PROFILE_DEFAULT,
+	FINGERPRINT_PROFILE_ARCHIVE,
+	FINGERPRINT_PROFILE_COUNT
+};
+
+struct FingerprintProfile
+{
+	FINGERPRINT_PROFILE id;
+	uint32_t version;
+	const char *name;
+	// At most 32, sample masks are 32 bits.
+	int samples;
+	uint32_t coarseSamples;
+	// Side of the hash taken from each frame, the larger one is only made by a pHash.
+	int hashSize;
+
+	static const FingerprintProfile &get(const int id);
+	static int find(const char *name);
+
+	uint32_t getAllSamples() const;
+	FINGERPRINT_ENGINE getEngine(const FINGERPRINT_ENGINE engine) const;
+	size_t getFingerprintSize(const FINGERPRINT_ENGINE engine) const;
+};
+
+#endif // FINGERPRINTPROFILE_H
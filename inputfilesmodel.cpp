@@ -1,14 +1,23 @@
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QFileInfo>
+#include <QImage>
 #include <QFont>
 #include <QBrush>
 #include <cmath>
 #include <cinttypes>
+#include <cstring>
 #include <QDebug>
+#include <QtAlgorithms>
 
 #include <algorithm>
 
+#include "archivereader.h"
+#include "closestpairs.h"
 #include "inputfilesmodel.h"
 #include "mediautility.h"
+#include "pairstore.h"
 
 static QString secondsToTimestamp(double seconds) {
     int64_t minutes = static_cast<int64_t>(seconds / 60);
@@ -42,102 +51,499 @@ QString humanReadableFileSize(const qint64 size)
 	return QString().setNum(s, 'f', 2) + " " + unit;
 }
 
+// The size of a file, or of the archive member at a virtual path.
+qint64 getFileSize(const QString path)
+{
+	if (ArchiveReader::isMemberPath(qPrintable(path)))
+		return qMax<qint64>(0, ArchiveReader::getMemberSize(qPrintable(path)));
+
+	return QFileInfo(path).size();
+}
+
+/*
+ * Identifies a file's contents for anything cached between runs: a file that's
+ * been rewritten gets a new size or modification time and so a new key. Archive
+ * members go by their archive's modification time.
+ */
+QByteArray getFileCacheKey(const QString path)
+{
+	QFileInfo info(path);
+	QFileInfo modified = info;
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	std::string archivePath;
+	std::string memberName;
+
+	if (ArchiveReader::splitPath(qPrintable(path), archivePath, memberName))
+		modified = QFileInfo(QString::fromLocal8Bit(archivePath.c_str()));
+
+	hash.addData(info.absoluteFilePath().toUtf8());
+	hash.addData(QByteArray::number(getFileSize(path)));
+	hash.addData(QByteArray::number(modified.lastModified().toMSecsSinceEpoch()));
+
+	return hash.result();
+}
+
 const int InputFileItem::requiredInfoPieces = 7;
 
-InputFileItem::InputFileItem(const QString path): fingerprint(static_cast<int>(MediaUtility::FINGERPRINT_SIZE * 8))
+InputFileItem::InputFileItem(const QString path): fingerprint(static_cast<int>(FingerprintProfile::get(FINGERPRINT_PROFILE_DEFAULT).getFingerprintSize(FINGERPRINT_ENGINE_DHASH)), 0)
 {
 	this->path = path;
 	this->size = 0;
 	this->duration = 0.0;
 	this->width = 0;
 	this->height = 0;
+	this->memoryEstimate = 0;
 	this->status = Loading;
+	this->fingerprintStatus = Loading;
 	this->currentInfoPieces = 0;
+	this->fingerprintEngine = FINGERPRINT_ENGINE_DHASH;
+	this->fingerprintProfile = FINGERPRINT_PROFILE_DEFAULT;
+	this->fingerprintProfileVersion = FingerprintProfile::get(FINGERPRINT_PROFILE_DEFAULT).version;
+	this->fingerprintSamples = 0;
+	this->missingSamples = 0;
+	this->audioSamples = 0;
 }
 
-int InputFileItem::getInfo()
+void InputFileItem::setMetadata(const MediaUtility &media)
 {
-	this->size = QFileInfo(path).size();
+	switch (media.getMediaType()) {
+		case MEDIA_TYPE_UNKNOWN:
+			this->mediaType = "Unknown";
+			this->duration = 0;
+			this->durationTimestamp = "N/A";
+			this->resolution = "N/A";
+
+			break;
+
+		case MEDIA_TYPE_VIDEO:
+			this->mediaType = "Video";
+			this->duration = media.getDuration();
+			this->durationTimestamp = secondsToTimestamp(media.getDuration());
+			this->width = media.getWidth();
+			this->height = media.getHeight();
+			this->resolution = QString().sprintf("%dx%d", width, height);
+
+			break;
+
+		case MEDIA_TYPE_IMAGE:
+			this->mediaType = "Image";
+			this->duration = 0;
+			this->durationTimestamp = "N/A";
+			this->width = media.getWidth();
+			this->height = media.getHeight();
+			this->resolution = QString().sprintf("%dx%d", width, height);
+
+			break;
+	}
+
+	this->codec = media.getCodec();
+	this->container = media.getContainer();
+	this->memoryEstimate = media.getMemoryEstimate();
+}
+
+void InputFileItem::setError(MediaUtility &media, const int ret)
+{
+	if (media.hasExceededBudget()) {
+		this->status = TimedOut;
+		this->error = QString("Reading file took too long - will not compare for similarity.");
+	} else {
+		this->status = Failed;
+		this->error = QString("Error reading file - will not compare for similarity: %1.").arg(media.getError(ret));
+	}
+
+	this->fingerprintStatus = this->status;
+}
+
+/*
+ * Fills in what the container headers say about the file without decoding
+ * anything, so the table can show it long before the fingerprint is done.
+ */
+int InputFileItem::probe(const qint64 probeSize, const qint64 timeBudget, const std::atomic<bool> *cancelled)
+{
+	this->size = getFileSize(path);
 	int ret = 0;
 
-	MediaUtility media = MediaUtility(qPrintable(path));
+	MediaUtility media(qPrintable(path));
 
-	if ((ret = media.open()) == 0) {
-		switch (media.getMediaType()) {
-			case MEDIA_TYPE_UNKNOWN:
-				this->mediaType = "Unknown";
-				this->duration = 0;
-				this->durationTimestamp = "N/A";
-				this->resolution = "N/A";
+	media.setBudget(timeBudget, 0);
+	media.setCancelFlag(cancelled);
 
-				break;
+	if ((ret = media.probe(probeSize)) == 0) {
+		setMetadata(media);
 
-			case MEDIA_TYPE_VIDEO:
-				this->mediaType = "Video";
-				this->duration = media.getDuration();
-				this->durationTimestamp = secondsToTimestamp(media.getDuration());
-				this->width = media.getWidth();
-				this->height = media.getHeight();
-				this->resolution = QString().sprintf("%dx%d", width, height);
+		this->status = Ready;
+		this->fingerprintStatus = Loading;
+	} else {
+		setError(media, ret);
+	}
 
-				break;
+	return ret;
+}
 
-			case MEDIA_TYPE_IMAGE:
-				this->mediaType = "Image";
-				this->duration = 0;
-				this->durationTimestamp = "N/A";
-				this->width = media.getWidth();
-				this->height = media.getHeight();
-				this->resolution = QString().sprintf("%dx%d", width, height);
+int InputFileItem::getInfo(const qint64 timeBudget, const qint64 byteBudget, const std::atomic<bool> *cancelled, const quint32 samples, const bool audioFirst, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile)
+{
+	this->size = getFileSize(path);
+	int ret = 0;
 
-				break;
-		}
+	MediaUtility media(qPrintable(path));
+
+	media.setBudget(timeBudget, byteBudget);
+	media.setCancelFlag(cancelled);
+	media.setFingerprintEngine(engine);
+	media.setFingerprintProfile(profile);
+
+	if ((ret = media.open(samples, audioFirst)) == 0) {
+		setMetadata(media);
 
-		this->codec = media.getCodec();
-		this->container = media.getContainer();
 		this->status = Ready;
+		this->fingerprintStatus = Ready;
 
 		const uint8_t *mediaFingerprint = media.getFingerprint();
+		const uint8_t *mediaAudioFingerprint = media.getAudioFingerprint();
 
 		if (mediaFingerprint) {
-            for (int byteIndex = 0; byteIndex < static_cast<int>(MediaUtility::FINGERPRINT_SIZE); byteIndex++)
-				for (int bitIndex = 0; bitIndex < 8; bitIndex++)
-					fingerprint.setBit(byteIndex * 8 + bitIndex, mediaFingerprint[byteIndex] & (1 << (7 - bitIndex)));
+			fingerprint = QByteArray(reinterpret_cast<const char *>(mediaFingerprint), static_cast<int>(FingerprintProfile::get(profile).getFingerprintSize(engine)));
+			fingerprintEngine = engine;
+			fingerprintSamples = media.getSampleMask();
 		}
+
+		if (mediaAudioFingerprint) {
+			audioFingerprint = QByteArray(reinterpret_cast<const char *>(mediaAudioFingerprint), static_cast<int>(MediaUtility::getAudioFingerprintSize(profile)));
+			audioSamples = media.getAudioSampleMask();
+		}
+
+		if (mediaFingerprint || mediaAudioFingerprint) {
+			fingerprintProfile = profile;
+			fingerprintProfileVersion = FingerprintProfile::get(profile).version;
+		}
+
+		if (media.getThumbnail()) {
+			QImage image(media.getThumbnail(), media.getThumbnailWidth(), media.getThumbnailHeight(), media.getThumbnailWidth() * 3, QImage::Format_RGB888);
+			QBuffer buffer(&thumbnail);
+
+			buffer.open(QIODevice::WriteOnly);
+			image.save(&buffer, "JPG", 85);
+		}
+
+		// Nothing is missing from a file we couldn't fingerprint at all, there's no point coming back.
+		if (mediaFingerprint || mediaAudioFingerprint)
+			missingSamples = media.getFullSampleMask() & ~fingerprintSamples;
 	} else {
-		this->status = Failed;
-		this->error = QString("Error reading file - will not compare for similarity: %1.").arg(media.getError(ret));
+		setError(media, ret);
 	}
 
 	return ret;
 }
 
+void InputFileItem::setFailed(const QString error)
+{
+	this->status = Failed;
+	this->fingerprintStatus = Failed;
+	this->error = error;
+}
+
+// Used when fingerprinting fails on a file whose headers could be read, which are still worth showing.
+void InputFileItem::setFingerprintFailed(const InputFileItemStatus status, const QString error)
+{
+	this->fingerprintStatus = status;
+	this->error = error;
+}
+
 QString InputFileItem::getFileName() const
 {
 	return QFileInfo(path).fileName();
 }
 
-int InputFileItem::getFingerprintDifference(const InputFileItem otherItem) const
+/*
+ * Only samples present in both fingerprints are compared, so a coarse fingerprint
+ * can be checked against a complete one. Returns -1 if the items can't be compared.
+ */
+int InputFileItem::getFingerprintDifference(const InputFileItem &otherItem, const double maxDifference, int *comparedBits) const
 {
-	if (mediaType == "Image" || mediaType == "Video") {
-		if (otherItem.getMediaType() == "Image" || otherItem.getMediaType() == "Video") {
-			int diff = 0;
+	return getFingerprintDifference(fingerprint, otherItem, maxDifference, comparedBits);
+}
 
-			for (int i = 0; i < fingerprint.size(); i++) {
-				if (fingerprint[i] != otherItem.getFingerprint()[i])
-					diff++;
-			}
+// Compares fingerprint, which is ours or a transformed copy of it, with otherItem's.
+int InputFileItem::getFingerprintDifference(const QByteArray &fingerprint, const InputFileItem &otherItem, const double maxDifference, int *comparedBits) const
+{
+	if (mediaType != "Image" && mediaType != "Video")
+		return -1;
+
+	if (otherItem.mediaType != "Image" && otherItem.mediaType != "Video")
+		return -1;
+
+	if (!isFingerprintCompatible(otherItem))
+		return -1;
+
+	quint32 samples = fingerprintSamples & otherItem.fingerprintSamples;
+
+	if (!samples)
+		return -1;
+
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(fingerprint.constData());
+	const uint8_t *otherData = reinterpret_cast<const uint8_t *>(otherItem.fingerprint.constData());
+
+	switch (fingerprintEngine) {
+		case FINGERPRINT_ENGINE_PHASH:
+			return getSampledDifference<PHashEngine::SAMPLE_SIZE>(data, otherData, samples, maxDifference, comparedBits);
 
-			return diff;
+		case FINGERPRINT_ENGINE_PHASH_16:
+			return getSampledDifference<PHash16Engine::SAMPLE_SIZE>(data, otherData, samples, maxDifference, comparedBits);
+
+		case FINGERPRINT_ENGINE_DHASH:
+		default:
+			return getSampledDifference<DHashEngine::SAMPLE_SIZE>(data, otherData, samples, maxDifference, comparedBits);
+	}
+}
+
+int InputFileItem::getAudioFingerprintDifference(const InputFileItem &otherItem, const double maxDifference, int *comparedBits) const
+{
+	quint32 samples = audioSamples & otherItem.audioSamples;
+
+	if (!samples || !isSameProfile(otherItem))
+		return -1;
+
+	return getSampledDifference<MediaUtility::AUDIO_SAMPLE_FINGERPRINT_SIZE>(reinterpret_cast<const uint8_t *>(audioFingerprint.constData()),
+																			reinterpret_cast<const uint8_t *>(otherItem.audioFingerprint.constData()),
+																			samples,
+																			maxDifference,
+																			comparedBits);
+}
+
+bool InputFileItem::isSimilar(const InputFileItem &otherItem, const double maxDifference) const
+{
+	int bits = 0;
+	int diff = getFingerprintDifference(otherItem, maxDifference, &bits);
+
+	return diff >= 0 && diff <= maxDifference * bits;
+}
+
+// Fingerprints can only be compared if the same engine made them from the same frames.
+bool InputFileItem::isFingerprintCompatible(const InputFileItem &otherItem) const
+{
+	return fingerprintEngine == otherItem.fingerprintEngine && isSameProfile(otherItem);
+}
+
+// Whether our fingerprint is what engine and the current version of profile would make.
+bool InputFileItem::isFingerprintCurrent(const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile) const
+{
+	return fingerprintEngine == engine && fingerprintProfile == profile && fingerprintProfileVersion == FingerprintProfile::get(profile).version;
+}
+
+bool InputFileItem::isSameProfile(const InputFileItem &otherItem) const
+{
+	return fingerprintProfile == otherItem.fingerprintProfile && fingerprintProfileVersion == otherItem.fingerprintProfileVersion;
+}
+
+/*
+ * Our fingerprint as it would be for each mirrored or turned copy of the file, in
+ * the order of FINGERPRINT_TRANSFORM leaving out the untouched one. Empty if the
+ * engine can't work these out.
+ */
+QVector<QByteArray> InputFileItem::getTransformedFingerprints() const
+{
+	QVector<QByteArray> transformedFingerprints;
+	int transforms = getFingerprintTransformCount(fingerprintEngine);
+
+	if ((mediaType != "Image" && mediaType != "Video") || !fingerprintSamples)
+		return transformedFingerprints;
+
+	// Only the dHash has any transforms besides FINGERPRINT_TRANSFORM_NONE.
+	for (int transform = 1; transform < transforms; transform++) {
+		QByteArray transformed(fingerprint.size(), 0);
+		const uint8_t *data = reinterpret_cast<const uint8_t *>(fingerprint.constData());
+		uint8_t *transformedData = reinterpret_cast<uint8_t *>(transformed.data());
+
+		for (int i = 0; i < 32; i++) {
+			int offset = i * static_cast<int>(DHashEngine::SAMPLE_SIZE);
+
+			if ((fingerprintSamples & (1u << i)) && offset + static_cast<int>(DHashEngine::SAMPLE_SIZE) <= fingerprint.size())
+				DHashEngine::transform(data + offset, static_cast<FINGERPRINT_TRANSFORM>(transform), transformedData + offset);
+		}
+
+		transformedFingerprints.append(transformed);
+	}
+
+	return transformedFingerprints;
+}
+
+// Also true if any of transformedFingerprints, from getTransformedFingerprints(), is similar.
+bool InputFileItem::isSimilar(const InputFileItem &otherItem, const double maxDifference, const QVector<QByteArray> &transformedFingerprints) const
+{
+	if (isSimilar(otherItem, maxDifference))
+		return true;
+
+	foreach (QByteArray transformed, transformedFingerprints) {
+		int bits = 0;
+		int diff = getFingerprintDifference(transformed, otherItem, maxDifference, &bits);
+
+		if (diff >= 0 && diff <= maxDifference * bits)
+			return true;
+	}
+
+	return false;
+}
+
+bool InputFileItem::isAudioSimilar(const InputFileItem &otherItem, const double maxDifference) const
+{
+	int bits = 0;
+	int diff = getAudioFingerprintDifference(otherItem, maxDifference, &bits);
+
+	return diff >= 0 && diff <= maxDifference * bits;
+}
+
+/*
+ * The fraction of bits that differ between the closest of the soundtracks, the
+ * pictures and any of transformedFingerprints against otherItem's pictures.
+ * Pictures only count once both fingerprints are complete. Returns -1 if nothing
+ * is within maxDifference.
+ */
+double InputFileItem::getDistance(const InputFileItem &otherItem, const double maxDifference, const QVector<QByteArray> &transformedFingerprints) const
+{
+	double distance = -1.0;
+	int bits = 0;
+	int diff = getAudioFingerprintDifference(otherItem, maxDifference, &bits);
+
+	if (diff >= 0 && bits > 0 && diff <= maxDifference * bits)
+		distance = static_cast<double>(diff) / bits;
+
+	if (!isFingerprintComplete() || !otherItem.isFingerprintComplete())
+		return distance;
+
+	QVector<QByteArray> fingerprints = QVector<QByteArray>() << fingerprint;
+
+	fingerprints += transformedFingerprints;
+
+	foreach (QByteArray transformed, fingerprints) {
+		diff = getFingerprintDifference(transformed, otherItem, maxDifference, &bits);
+
+		if (diff >= 0 && bits > 0 && diff <= maxDifference * bits && (distance < 0 || static_cast<double>(diff) / bits < distance))
+			distance = static_cast<double>(diff) / bits;
+	}
+
+	return distance;
+}
+
+// Takes any samples we don't have yet from otherItem, used when a refinement comes back.
+void InputFileItem::mergeFingerprint(const InputFileItem &otherItem)
+{
+	quint32 samples = otherItem.fingerprintSamples & ~fingerprintSamples;
+	int sampleSize = static_cast<int>(getSampleFingerprintSize(fingerprintEngine));
+
+	// Samples taken at other positions don't mix with ours, and ours are the newer ones.
+	if (!fingerprintSamples && !audioSamples) {
+		fingerprintProfile = otherItem.fingerprintProfile;
+		fingerprintProfileVersion = otherItem.fingerprintProfileVersion;
+	} else if (!isSameProfile(otherItem)) {
+		return;
+	}
+
+	if (!fingerprintSamples) {
+		fingerprint = otherItem.fingerprint;
+		fingerprintEngine = otherItem.fingerprintEngine;
+
+	// The same goes for samples from another engine.
+	} else if (otherItem.fingerprintEngine != fingerprintEngine) {
+		samples = 0;
+	} else {
+		for (int i = 0; i < 32; i++) {
+			if (samples & (1u << i))
+				fingerprint.replace(i * sampleSize, sampleSize, otherItem.fingerprint.mid(i * sampleSize, sampleSize));
 		}
 	}
 
-	return -1;
+	fingerprintSamples |= samples;
+	missingSamples &= ~fingerprintSamples;
+
+	if (!audioSamples && otherItem.audioSamples) {
+		audioFingerprint = otherItem.audioFingerprint;
+		audioSamples = otherItem.audioSamples;
+	}
+}
+
+QDataStream &operator<<(QDataStream &stream, const InputFileItem &item)
+{
+	stream << item.path
+		   << item.mediaType
+		   << item.duration
+		   << item.durationTimestamp
+		   << item.size
+		   << item.width
+		   << item.height
+		   << item.resolution
+		   << item.codec
+		   << item.container
+		   << item.memoryEstimate
+		   << item.fingerprint
+		   << static_cast<qint32>(item.fingerprintEngine)
+		   << item.fingerprintSamples
+		   << item.missingSamples
+		   << item.audioFingerprint
+		   << item.audioSamples
+		   << item.thumbnail
+		   << static_cast<qint32>(item.status)
+		   << static_cast<qint32>(item.fingerprintStatus)
+		   << item.error
+		   << static_cast<qint32>(item.fingerprintProfile)
+		   << item.fingerprintProfileVersion;
+
+	return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, InputFileItem &item)
+{
+	qint32 status = Loading;
+	qint32 fingerprintStatus = Loading;
+	qint32 engine = FINGERPRINT_ENGINE_DHASH;
+	qint32 profile = FINGERPRINT_PROFILE_DEFAULT;
+	quint32 profileVersion = 1;
+
+	stream >> item.path
+		   >> item.mediaType
+		   >> item.duration
+		   >> item.durationTimestamp
+		   >> item.size
+		   >> item.width
+		   >> item.height
+		   >> item.resolution
+		   >> item.codec
+		   >> item.container
+		   >> item.memoryEstimate
+		   >> item.fingerprint
+		   >> engine
+		   >> item.fingerprintSamples
+		   >> item.missingSamples
+		   >> item.audioFingerprint
+		   >> item.audioSamples
+		   >> item.thumbnail
+		   >> status
+		   >> fingerprintStatus
+		   >> item.error;
+
+	// Items stored before there were profiles end here, and were all made by the first default one.
+	if (!stream.atEnd())
+		stream >> profile >> profileVersion;
+
+	item.fingerprintEngine = static_cast<FINGERPRINT_ENGINE>(engine);
+	item.fingerprintProfile = static_cast<FINGERPRINT_PROFILE>(profile);
+	item.fingerprintProfileVersion = profileVersion;
+	item.status = static_cast<InputFileItemStatus>(status);
+	item.fingerprintStatus = static_cast<InputFileItemStatus>(fingerprintStatus);
+
+	return stream;
 }
 
+const double InputFilesModel::COARSE_SLACK = 1.5;
+
 InputFilesModel::InputFilesModel(QObject *parent):
 	QAbstractTableModel(parent)
 {
+	maxDifference = 0.25;
+	transformInvariant = false;
+	compareQueries = true;
+	closestPairs = nullptr;
+	probesPending = 0;
+	fingerprintsPending = 0;
 }
 
 QVariant InputFilesModel::headerData(int section, Qt::Orientation orientation, int role) const
@@ -201,7 +607,8 @@ QVariant InputFilesModel::data(const QModelIndex &index, int role) const
 		return QVariant();
 	}
 
-	InputFileItem item = inputFileItems[index.row()];
+	InputFileItemPtr item = inputFileItems[index.row()];
+	bool reference = referencePaths.contains(item->getPath());
 
 	lock.unlock();
 
@@ -211,16 +618,17 @@ QVariant InputFilesModel::data(const QModelIndex &index, int role) const
 			case 2:
 				// Can't use std::numeric_limits<double>::max() because subtraction from it
 				// apparently doesn't do anything...?
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
                         return static_cast<double>(std::numeric_limits<int>::max() - 1);
 
 					case Ready:
-						if (item.getDurationTimestamp() == "N/A")
+						if (item->getDurationTimestamp() == "N/A")
 							return std::numeric_limits<double>::max();
 
-						return item.getDuration();
+						return item->getDuration();
 
+					case TimedOut:
 					case Failed:
                         return static_cast<double>(std::numeric_limits<int>::max() - 2);
 				}
@@ -228,13 +636,14 @@ QVariant InputFilesModel::data(const QModelIndex &index, int role) const
 				break;
 
 			case 3:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
 						return std::numeric_limits<qint64>::max();;
 
 					case Ready:
-						return item.getSize();
+						return item->getSize();
 
+					case TimedOut:
 					case Failed:
 						return std::numeric_limits<qint64>::max() - 1;
 				}
@@ -242,16 +651,17 @@ QVariant InputFilesModel::data(const QModelIndex &index, int role) const
 				break;
 
 			case 4:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
 						return std::numeric_limits<int>::max() - 1;
 
 					case Ready:
-						if (item.getResolution() == "N/A")
+						if (item->getResolution() == "N/A")
 							return std::numeric_limits<int>::max();
 
-						return item.getWidth() * item.getHeight();
+						return item->getWidth() * item->getHeight();
 
+					case TimedOut:
 					case Failed:
 						return std::numeric_limits<int>::max() - 2;
 				}
@@ -264,92 +674,111 @@ QVariant InputFilesModel::data(const QModelIndex &index, int role) const
 	if (role == Qt::DisplayRole) {
 		switch (index.column()) {
 			case 0:
-				return item.getFileName();
+				return item->getFileName();
 
 			case 1:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
-						return item.getLoadingPlaceholder();
+						return item->getLoadingPlaceholder();
 
 					case Ready:
-						return item.getMediaType();
+						return item->getMediaType();
 
 					case Failed:
-						return item.getErrorPlaceholder();
+						return item->getErrorPlaceholder();
+
+					case TimedOut:
+						return item->getTimedOutPlaceholder();
 				}
 
 				break;
 
 			case 2:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
-						return item.getLoadingPlaceholder();
+						return item->getLoadingPlaceholder();
 
 					case Ready:
-						return item.getDurationTimestamp();
+						return item->getDurationTimestamp();
 
 					case Failed:
-						return item.getErrorPlaceholder();
+						return item->getErrorPlaceholder();
+
+					case TimedOut:
+						return item->getTimedOutPlaceholder();
 				}
 
 				break;
 
 			case 3:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
-						return item.getLoadingPlaceholder();
+						return item->getLoadingPlaceholder();
 
 					case Ready:
-						return humanReadableFileSize(item.getSize());
+						return humanReadableFileSize(item->getSize());
 
 					case Failed:
-						return item.getErrorPlaceholder();
+						return item->getErrorPlaceholder();
+
+					case TimedOut:
+						return item->getTimedOutPlaceholder();
 				}
 
 				break;
 
 			case 4:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
-						return item.getLoadingPlaceholder();
+						return item->getLoadingPlaceholder();
 
 					case Ready:
-						return item.getResolution();
+						return item->getResolution();
 
 					case Failed:
-						return item.getErrorPlaceholder();
+						return item->getErrorPlaceholder();
+
+					case TimedOut:
+						return item->getTimedOutPlaceholder();
 				}
 
 				break;
 
 			case 5:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
-						return item.getLoadingPlaceholder();
+						return item->getLoadingPlaceholder();
 
 					case Ready:
-						return item.getCodec();
+						return item->getCodec();
 
 					case Failed:
-						return item.getErrorPlaceholder();
+						return item->getErrorPlaceholder();
+
+					case TimedOut:
+						return item->getTimedOutPlaceholder();
 				}
 
 				break;
 
 			case 6:
-				switch (item.getStatus()) {
+				switch (item->getStatus()) {
 					case Loading:
-						return item.getLoadingPlaceholder();
+						return item->getLoadingPlaceholder();
 
 					case Ready:
-						return item.getContainer();
+						return item->getContainer();
 
 					case Failed:
-						return item.getErrorPlaceholder();
+						return item->getErrorPlaceholder();
+
+					case TimedOut:
+						return item->getTimedOutPlaceholder();
 				}
 		}
 	} else if (role == Qt::FontRole) {
-		if (index.column() > 0 && item.getStatus() == Loading) {
+		// Rows that are still being fingerprinted can't be matched yet.
+		if ((index.column() > 0 && item->getStatus() == Loading) || (index.column() == 0 && item->getFingerprintStatus() == Loading)) {
 			QFont font = QFont();
 
 			font.setItalic(true);
@@ -357,27 +786,33 @@ QVariant InputFilesModel::data(const QModelIndex &index, int role) const
 			return font;
 		}
 	} else if (role == Qt::ForegroundRole) {
-		if (item.getStatus() == Failed)
+		if (item->getStatus() == Failed || item->getStatus() == TimedOut)
 			return QBrush(Qt::red);
 
-		else if (item.getMediaType() == "Unknown")
+		else if (item->getMediaType() == "Unknown" || item->getFingerprintStatus() == Failed || item->getFingerprintStatus() == TimedOut)
 			return QBrush(Qt::darkRed);
+
+		else if (reference)
+			return QBrush(Qt::darkGray);
 	} else if (role == Qt::ToolTipRole) {
-		if (item.getStatus() == Failed)
-			return item.getError();
+		if (item->getFingerprintStatus() == Failed || item->getFingerprintStatus() == TimedOut)
+			return item->getError();
+
+		else if (reference)
+			return item->getPath() + " (library)";
 
 		else
-			return item.getPath();
+			return item->getPath();
 	}
 
 	return QVariant();
 }
 
-void InputFilesModel::add(const InputFileItem item)
+void InputFilesModel::add(const QString path, const bool reference)
 {
 	QMutexLocker lock(&inputFileItemsMutex);
 
-	if (!inputFileItemsHash.contains(item.getPath())) {
+	if (!inputFileItemsHash.contains(path)) {
 		int index = inputFileItems.length();
 
 		lock.unlock();
@@ -386,8 +821,17 @@ void InputFilesModel::add(const InputFileItem item)
 
 		lock.relock();
 
-		inputFileItems.append(item);
-		inputFileItemsHash[item.getPath()] = index;
+		inputFileItems.append(InputFileItemPtr(new InputFileItem(path)));
+		inputFileItemsHash[path] = index;
+		probesPending++;
+		fingerprintsPending++;
+		cancelTokens[path] = CancelToken(new std::atomic<bool>(false));
+
+		if (reference)
+			referencePaths.insert(path);
+
+		else
+			queryPaths.insert(path);
 
 		lock.unlock();
 
@@ -395,19 +839,58 @@ void InputFilesModel::add(const InputFileItem item)
 	}
 }
 
-void InputFilesModel::update(const InputFileItem item)
+void InputFilesModel::update(InputFileItemPtr item)
 {
 	int index = 0;
+
+	// Previews live in the thumbnail store, the table doesn't need to keep them.
+	if (!item->getThumbnail().isEmpty()) {
+		QSharedPointer<InputFileItem> stripped(new InputFileItem(*item));
+
+		stripped->clearThumbnail();
+		item = stripped;
+	}
+
 	QMutexLocker lock(&inputFileItemsMutex);
 
-	if ((index = inputFileItemsHash.value(item.getPath())) >= 0) {
+	if ((index = inputFileItemsHash.value(item->getPath(), -1)) >= 0) {
 		if (index >= inputFileItems.length())
 			return;
 
-		if (index == 0 && inputFileItems[0].getPath() != item.getPath())
+		InputFileItemPtr current = inputFileItems[index];
+
+		if (current->getPath() != item->getPath())
 			return;
 
-		inputFileItems[index] = item;
+		// A failed refinement shouldn't throw away the coarse fingerprint we already have.
+		if (item->getFingerprintStatus() != Ready && current->getFingerprintStatus() == Ready)
+			return;
+
+		if (current->getStatus() == Loading && item->getStatus() != Loading)
+			probesPending--;
+
+		if (current->getFingerprintStatus() == Loading && item->getFingerprintStatus() != Loading)
+			fingerprintsPending--;
+
+		else if (current->getFingerprintStatus() != Loading && item->getFingerprintStatus() == Loading)
+			fingerprintsPending++;
+
+		// Fingerprinting failed on a file we could probe, keep what the probe found.
+		if (item->getStatus() != Ready && current->getStatus() == Ready) {
+			QSharedPointer<InputFileItem> failed(new InputFileItem(*current));
+
+			failed->setFingerprintFailed(item->getFingerprintStatus(), item->getError());
+			inputFileItems[index] = failed;
+
+		// Only refinements have anything to merge, a file's first result is kept as it is.
+		} else if (current->getFingerprintSamples() || current->getAudioSamples()) {
+			QSharedPointer<InputFileItem> merged(new InputFileItem(*item));
+
+			merged->mergeFingerprint(*current);
+			inputFileItems[index] = merged;
+		} else {
+			inputFileItems[index] = item;
+		}
 
 		lock.unlock();
 
@@ -416,24 +899,44 @@ void InputFilesModel::update(const InputFileItem item)
 }
 
 bool InputFilesModel::removeRow(int row, const QModelIndex &parent)
+{
+	return removeRows(row, 1, parent);
+}
+
+bool InputFilesModel::removeRows(int row, int count, const QModelIndex &parent)
 {
 	QMutexLocker lock(&inputFileItemsMutex);
 
-	if (row < inputFileItems.length()) {
-		lock.unlock();
+	if (parent.isValid() || row < 0 || count <= 0 || row + count > inputFileItems.length())
+		return false;
 
-		beginRemoveRows(parent, row, row);
+	lock.unlock();
 
-		lock.relock();
+	beginRemoveRows(parent, row, row + count - 1);
 
-		inputFileItemsHash.take(inputFileItems.takeAt(row).getPath());
+	lock.relock();
 
-		lock.unlock();
+	for (int i = row; i < row + count; i++) {
+		inputFileItemsHash.remove(inputFileItems[i]->getPath());
+		referencePaths.remove(inputFileItems[i]->getPath());
+		queryPaths.remove(inputFileItems[i]->getPath());
+		cancel(inputFileItems[i]->getPath());
 
-		endRemoveRows();
+		if (inputFileItems[i]->getStatus() == Loading)
+			probesPending--;
+
+		if (inputFileItems[i]->getFingerprintStatus() == Loading)
+			fingerprintsPending--;
 	}
 
-	return false;
+	inputFileItems.remove(row, count);
+	reindex(row);
+
+	lock.unlock();
+
+	endRemoveRows();
+
+	return true;
 }
 
 bool InputFilesModel::removeSelection(const QModelIndexList selection)
@@ -444,12 +947,51 @@ bool InputFilesModel::removeSelection(const QModelIndexList selection)
 		rows.append(index.row());
 	}
 
-	std::sort(rows.begin(), rows.end(), std::greater<int>());
+	if (rows.isEmpty())
+		return false;
+
+	std::sort(rows.begin(), rows.end());
+	rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+	// A single block can be removed in place.
+	if (rows.last() - rows.first() == rows.length() - 1)
+		return removeRows(rows.first(), rows.length());
 
-	foreach (int row, rows) {
-		removeRow(row);
+	// Scattered rows would cost a shift of the whole vector per row, so compact
+	// everything in one pass and reset instead.
+	beginResetModel();
+
+	QMutexLocker lock(&inputFileItemsMutex);
+	QVector<InputFileItemPtr> remaining;
+	int next = 0;
+
+	remaining.reserve(inputFileItems.length() - rows.length());
+
+	for (int i = 0; i < inputFileItems.length(); i++) {
+		if (next < rows.length() && rows[next] == i) {
+			inputFileItemsHash.remove(inputFileItems[i]->getPath());
+			referencePaths.remove(inputFileItems[i]->getPath());
+			queryPaths.remove(inputFileItems[i]->getPath());
+			cancel(inputFileItems[i]->getPath());
+			next++;
+
+			if (inputFileItems[i]->getStatus() == Loading)
+				probesPending--;
+
+			if (inputFileItems[i]->getFingerprintStatus() == Loading)
+				fingerprintsPending--;
+		} else {
+			remaining.append(inputFileItems[i]);
+		}
 	}
 
+	inputFileItems = remaining;
+	reindex(rows.first());
+
+	lock.unlock();
+
+	endResetModel();
+
 	return true;
 }
 
@@ -467,36 +1009,216 @@ void InputFilesModel::clear()
 
 		inputFileItems.clear();
 		inputFileItemsHash.clear();
+		referencePaths.clear();
+		queryPaths.clear();
+		probesPending = 0;
+		fingerprintsPending = 0;
 
 		lock.unlock();
 
 		endRemoveRows();
 	}
+
+	cancelAll();
 }
 
-const QVector<InputFileItem> InputFilesModel::getSimilarItems(const InputFileItem item) const
+QString InputFilesModel::getPath(const int row) const
 {
-	int diff = 0;
-	QVector<InputFileItem> similarItems;
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	if (row < 0 || row >= inputFileItems.length())
+		return QString();
+
+	return inputFileItems[row]->getPath();
+}
+
+int InputFilesModel::getProbesPending() const
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	return probesPending;
+}
+
+int InputFilesModel::getFingerprintsPending() const
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	return fingerprintsPending;
+}
+
+CancelToken InputFilesModel::getCancelToken(const QString path) const
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	return cancelTokens.value(path);
+}
+
+void InputFilesModel::cancelAll()
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	foreach (CancelToken token, cancelTokens) {
+		token->store(true);
+	}
+
+	cancelTokens.clear();
+}
+
+// Must be called with inputFileItemsMutex held.
+void InputFilesModel::cancel(const QString path)
+{
+	CancelToken token = cancelTokens.take(path);
+
+	if (token)
+		token->store(true);
+}
+
+// Must be called with inputFileItemsMutex held.
+void InputFilesModel::reindex(const int from)
+{
+	for (int i = from; i < inputFileItems.length(); i++)
+		inputFileItemsHash[inputFileItems[i]->getPath()] = i;
+}
+
+InputFileItemPtr InputFilesModel::getItem(const QString path) const
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+	int index = inputFileItemsHash.value(path, -1);
+
+	if (index < 0)
+		return InputFileItemPtr(new InputFileItem(path));
+
+	return inputFileItems[index];
+}
+
+void InputFilesModel::setSimilarityThreshold(const int threshold)
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	// A threshold of 100 only matches identical fingerprints, 1 allows almost half
+	// the bits to differ, which is about what unrelated files look like.
+	maxDifference = (100 - threshold) / 200.0;
+}
+
+void InputFilesModel::setTransformInvariant(const bool transformInvariant)
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	this->transformInvariant = transformInvariant;
+}
+
+void InputFilesModel::setCompareQueries(const bool compareQueries)
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	this->compareQueries = compareQueries;
+}
+
+/*
+ * Pairs where either side only has a coarse fingerprint are matched with a looser
+ * threshold. Those matches are candidates to be refined rather than results.
+ *
+ * Files from the reference library are never compared with each other. A library
+ * file only looks through the new files, and a new file looks through everything,
+ * or just the library when new files aren't compared with each other. So the work
+ * grows with the number of new files, however large the library is.
+ */
+const QVector<InputFileItemPtr> InputFilesModel::getSimilarItems(const InputFileItemPtr item) const
+{
+	QVector<InputFileItemPtr> similarItems;
+	QVector<QByteArray> transformedFingerprints;
+	QMutexLocker settingsLock(&inputFileItemsMutex);
+	bool transforms = transformInvariant;
+	bool reference = referencePaths.contains(item->getPath());
+	bool queries = compareQueries;
+	// Sets are shared until they're next changed, so taking a copy is free.
+	QSet<QString> candidates = reference ? queryPaths : QSet<QString>();
+
+	settingsLock.unlock();
+
+	// Transforming our side once is much cheaper than transforming every other item.
+	if (transforms)
+		transformedFingerprints = item->getTransformedFingerprints();
+
+	QSet<QString>::const_iterator candidate = candidates.constBegin();
 
 	for (int i = 0; ; i++) {
-        QMutexLocker lock(&inputFileItemsMutex);
+		QMutexLocker lock(&inputFileItemsMutex);
+		InputFileItemPtr otherItem;
 
-		if (i >= inputFileItems.length()) {
-			lock.unlock();
+		if (reference) {
+			int index = -1;
 
-			break;
+			while (candidate != candidates.constEnd() && (index = inputFileItemsHash.value(*candidate, -1)) < 0)
+				candidate++;
+
+			if (candidate == candidates.constEnd()) {
+				lock.unlock();
+
+				break;
+			}
+
+			otherItem = inputFileItems[index];
+			candidate++;
+		} else {
+			if (i >= inputFileItems.length()) {
+				lock.unlock();
+
+				break;
+			}
+
+			otherItem = inputFileItems[i];
+
+			if (!queries && !referencePaths.contains(otherItem->getPath()))
+				continue;
 		}
 
-		InputFileItem otherItem = inputFileItems[i];
+		// Looking for the closest pairs, the bound tightens as closer ones turn up.
+		bool closest = closestPairs && closestPairs->isEnabled();
+		double limit = closest ? closestPairs->getBound() : maxDifference;
 
 		lock.unlock();
 
-		if (item.getPath() != otherItem.getPath()) {
-			diff = item.getFingerprintDifference(otherItem);
+		if (item->getPath() == otherItem->getPath())
+			continue;
+
+		double threshold = limit * COARSE_SLACK;
+
+		// Finished fingerprints are matched as loosely as the threshold can ever be set,
+		// for PairStore to keep. Partial ones only pick candidates for refining.
+		if (item->isFingerprintComplete() && otherItem->isFingerprintComplete()) {
+			if (!closest)
+				limit = PairStore::MAX_DIFFERENCE;
+
+			threshold = limit;
 		}
+
+		// Either the pictures or the sound matching is enough, so heavily re-encoded video still pairs up.
+		if (item->isSimilar(*otherItem, threshold, transformedFingerprints) || item->isAudioSimilar(*otherItem, limit))
+			similarItems.append(otherItem);
 	}
 
 	return similarItems;
 }
 
+double InputFilesModel::getMaxDifference() const
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+
+	return maxDifference;
+}
+
+/*
+ * The distance of a match that refining can't undo, or -1 if it's not within the
+ * closest pairs' bound, or the loosest threshold when PairStore is keeping them.
+ */
+double InputFilesModel::getDistance(const InputFileItem &item, const InputFileItem &otherItem) const
+{
+	QMutexLocker lock(&inputFileItemsMutex);
+	bool transforms = transformInvariant;
+	double bound = closestPairs && closestPairs->isEnabled() ? closestPairs->getBound() : PairStore::MAX_DIFFERENCE;
+
+	lock.unlock();
+
+	return item.getDistance(otherItem, bound, transforms ? item.getTransformedFingerprints() : QVector<QByteArray>());
+}
@@ -2,46 +2,90 @@
 #define INPUTFILESMODEL_H
 
 #include <QAbstractTableModel>
-#include <QBitArray>
+#include <QByteArray>
+#include <QDataStream>
 #include <QMutex>
+#include <QSet>
+#include <QSharedPointer>
+#include <QVector>
+
+#include <atomic>
+
+#include "fingerprintengine.h"
+#include "fingerprintprofile.h"
+
+class ClosestPairs;
+class MediaUtility;
 
 QString humanReadableFileSize(const qint64 size);
+qint64 getFileSize(const QString path);
+QByteArray getFileCacheKey(const QString path);
+
+// Set once an item is removed, so work still queued or running for it can stop early.
+typedef QSharedPointer<std::atomic<bool>> CancelToken;
 
 enum InputFileItemStatus {
 	Loading,
 	Ready,
-	Failed
+	Failed,
+	TimedOut
 };
 
 class InputFileItem
 {
-	friend class QVector<InputFileItem>;
+	friend QDataStream &operator<<(QDataStream &stream, const InputFileItem &item);
+	friend QDataStream &operator>>(QDataStream &stream, InputFileItem &item);
 
 	public:
 		static const int requiredInfoPieces;
 
 		InputFileItem(const QString path);
-		QString getPath() const { return path; }
+		const QString &getPath() const { return path; }
 		QString getFileName() const;
-		QString getMediaType() const { return mediaType; }
+		const QString &getMediaType() const { return mediaType; }
 		double getDuration() const { return duration; }
-		QString getDurationTimestamp() const { return durationTimestamp; }
+		const QString &getDurationTimestamp() const { return durationTimestamp; }
 		qint64 getSize() const { return size; }
 		int getWidth() const { return width; }
 		int getHeight() const { return height; }
-		QString getResolution() const { return resolution; }
-		QString getCodec() const { return codec; }
-		QString getContainer() const { return container; }
-		QBitArray getFingerprint() const { return fingerprint; }
-		int getFingerprintDifference(const InputFileItem otherItem) const;
+		const QString &getResolution() const { return resolution; }
+		const QString &getCodec() const { return codec; }
+		const QString &getContainer() const { return container; }
+		qint64 getMemoryEstimate() const { return memoryEstimate; }
+		const QByteArray &getFingerprint() const { return fingerprint; }
+		FINGERPRINT_ENGINE getFingerprintEngine() const { return fingerprintEngine; }
+		FINGERPRINT_PROFILE getFingerprintProfile() const { return fingerprintProfile; }
+		quint32 getFingerprintProfileVersion() const { return fingerprintProfileVersion; }
+		bool isFingerprintCompatible(const InputFileItem &otherItem) const;
+		bool isFingerprintCurrent(const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile) const;
+		quint32 getFingerprintSamples() const { return fingerprintSamples; }
+		quint32 getMissingSamples() const { return missingSamples; }
+		bool isFingerprintComplete() const { return fingerprintSamples && !missingSamples; }
+		const QByteArray &getAudioFingerprint() const { return audioFingerprint; }
+		quint32 getAudioSamples() const { return audioSamples; }
+		const QByteArray &getThumbnail() const { return thumbnail; }
+		void clearThumbnail() { thumbnail.clear(); }
+		int getFingerprintDifference(const InputFileItem &otherItem, const double maxDifference = 1.0, int *comparedBits = nullptr) const;
+		int getAudioFingerprintDifference(const InputFileItem &otherItem, const double maxDifference = 1.0, int *comparedBits = nullptr) const;
+		QVector<QByteArray> getTransformedFingerprints() const;
+		bool isSimilar(const InputFileItem &otherItem, const double maxDifference) const;
+		bool isSimilar(const InputFileItem &otherItem, const double maxDifference, const QVector<QByteArray> &transformedFingerprints) const;
+		bool isAudioSimilar(const InputFileItem &otherItem, const double maxDifference) const;
+		double getDistance(const InputFileItem &otherItem, const double maxDifference, const QVector<QByteArray> &transformedFingerprints) const;
 		InputFileItemStatus getStatus() const { return status; }
-		QString getError() { return error; }
-		int getInfo();
+		InputFileItemStatus getFingerprintStatus() const { return fingerprintStatus; }
+		const QString &getError() const { return error; }
+		int probe(const qint64 probeSize, const qint64 timeBudget = 0, const std::atomic<bool> *cancelled = nullptr);
+		int getInfo(const qint64 timeBudget = 0, const qint64 byteBudget = 0, const std::atomic<bool> *cancelled = nullptr, const quint32 samples = ~0u, const bool audioFirst = false, const FINGERPRINT_ENGINE engine = FINGERPRINT_ENGINE_DHASH, const FINGERPRINT_PROFILE profile = FINGERPRINT_PROFILE_DEFAULT);
+		void mergeFingerprint(const InputFileItem &otherItem);
+		void setFailed(const QString error);
+		void setFingerprintFailed(const InputFileItemStatus status, const QString error);
 
-		bool operator ==(const InputFileItem other) const { return path == other.path; }
+		bool operator ==(const InputFileItem &other) const { return path == other.path; }
 
 		static QString getLoadingPlaceholder() { return "Loading..."; }
 		static QString getErrorPlaceholder() { return "Error"; }
+		static QString getTimedOutPlaceholder() { return "Timed out"; }
 
 	private:
 		QString path;
@@ -54,14 +98,37 @@ class InputFileItem
 		QString resolution;
 		QString codec;
 		QString container;
-		QBitArray fingerprint;
+		qint64 memoryEstimate;
+		QByteArray fingerprint;
+		FINGERPRINT_ENGINE fingerprintEngine;
+		// Both the picture and the audio samples were taken as this profile says.
+		FINGERPRINT_PROFILE fingerprintProfile;
+		quint32 fingerprintProfileVersion;
+		quint32 fingerprintSamples;
+		quint32 missingSamples;
+		QByteArray audioFingerprint;
+		quint32 audioSamples;
+		QByteArray thumbnail;
 		InputFileItemStatus status;
+		InputFileItemStatus fingerprintStatus;
 		QString error;
 		int currentInfoPieces;
 
-		InputFileItem() { ; }
+		int getFingerprintDifference(const QByteArray &fingerprint, const InputFileItem &otherItem, const double maxDifference, int *comparedBits) const;
+		bool isSameProfile(const InputFileItem &otherItem) const;
+		void setMetadata(const MediaUtility &media);
+		void setError(MediaUtility &media, const int ret);
 };
 
+/*
+ * Items are never changed once they've been handed to the model, so the same one
+ * is shared between the model, the views and any thread comparing against it.
+ */
+typedef QSharedPointer<const InputFileItem> InputFileItemPtr;
+
+QDataStream &operator<<(QDataStream &stream, const InputFileItem &item);
+QDataStream &operator>>(QDataStream &stream, InputFileItem &item);
+
 class InputFilesModel: public QAbstractTableModel
 {
 	Q_OBJECT
@@ -78,18 +145,46 @@ class InputFilesModel: public QAbstractTableModel
 		QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
 		// Model management:
-		void add(const InputFileItem item);
-		void update(const InputFileItem item);
+		void add(const QString path, const bool reference = false);
+		void update(const InputFileItemPtr item);
 		bool removeRow(int row, const QModelIndex &parent = QModelIndex());
+		bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
 		bool removeSelection(const QModelIndexList selection);
 		void clear();
-
-		const QVector<InputFileItem> getSimilarItems(const InputFileItem item) const;
+		QString getPath(const int row) const;
+		int getProbesPending() const;
+		int getFingerprintsPending() const;
+		CancelToken getCancelToken(const QString path) const;
+		void cancelAll();
+
+		InputFileItemPtr getItem(const QString path) const;
+		void setSimilarityThreshold(const int threshold);
+		void setTransformInvariant(const bool transformInvariant);
+		void setCompareQueries(const bool compareQueries);
+		void setClosestPairs(const ClosestPairs *closestPairs) { this->closestPairs = closestPairs; }
+		const QVector<InputFileItemPtr> getSimilarItems(const InputFileItemPtr item) const;
+		double getMaxDifference() const;
+		double getDistance(const InputFileItem &item, const InputFileItem &otherItem) const;
+
+		static const double COARSE_SLACK;
 
 	private:
-		QVector<InputFileItem> inputFileItems;
+		QVector<InputFileItemPtr> inputFileItems;
+		double maxDifference;
+		bool transformInvariant;
+		bool compareQueries;
+		const ClosestPairs *closestPairs;
+		int probesPending;
+		int fingerprintsPending;
 		QHash<QString, int> inputFileItemsHash;
+		QHash<QString, CancelToken> cancelTokens;
+		// Files from the reference library are only compared with new files, the queries.
+		QSet<QString> referencePaths;
+		QSet<QString> queryPaths;
         mutable QMutex inputFileItemsMutex;
+
+		void cancel(const QString path);
+		void reindex(const int from);
 };
 
 #endif // INPUTFILESMODEL_H
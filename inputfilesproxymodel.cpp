@@ -0,0 +1,402 @@
+#include <algorithm>
+
+#include "inputfilesproxymodel.h"
+
+InputFilesProxyModel::InputFilesProxyModel(QObject *parent): QAbstractProxyModel(parent)
+{
+	sortColumn = -1;
+	sortOrder = Qt::AscendingOrder;
+	filterColumn = 0;
+}
+
+void InputFilesProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+	beginResetModel();
+
+	if (this->sourceModel())
+		this->sourceModel()->disconnect(this);
+
+	QAbstractProxyModel::setSourceModel(sourceModel);
+
+	if (sourceModel) {
+		connect(sourceModel, &QAbstractItemModel::rowsInserted, this, &InputFilesProxyModel::sourceRowsInserted);
+		connect(sourceModel, &QAbstractItemModel::rowsAboutToBeRemoved, this, &InputFilesProxyModel::sourceRowsAboutToBeRemoved);
+		connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, &InputFilesProxyModel::sourceRowsRemoved);
+		connect(sourceModel, &QAbstractItemModel::dataChanged, this, &InputFilesProxyModel::sourceDataChanged);
+		connect(sourceModel, &QAbstractItemModel::modelAboutToBeReset, this, &InputFilesProxyModel::sourceModelAboutToBeReset);
+		connect(sourceModel, &QAbstractItemModel::modelReset, this, &InputFilesProxyModel::sourceModelReset);
+	}
+
+	rebuild();
+
+	endResetModel();
+}
+
+QModelIndex InputFilesProxyModel::index(int row, int column, const QModelIndex &parent) const
+{
+	if (parent.isValid() || row < 0 || row >= proxyToSource.length() || column < 0 || column >= keys.length())
+		return QModelIndex();
+
+	return createIndex(row, column);
+}
+
+QModelIndex InputFilesProxyModel::parent(const QModelIndex &child) const
+{
+	Q_UNUSED(child)
+
+	return QModelIndex();
+}
+
+int InputFilesProxyModel::rowCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : proxyToSource.length();
+}
+
+int InputFilesProxyModel::columnCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : keys.length();
+}
+
+bool InputFilesProxyModel::hasChildren(const QModelIndex &parent) const
+{
+	return !parent.isValid() && !proxyToSource.isEmpty();
+}
+
+QModelIndex InputFilesProxyModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+	if (!proxyIndex.isValid() || !sourceModel() || proxyIndex.row() >= proxyToSource.length())
+		return QModelIndex();
+
+	return sourceModel()->index(proxyToSource[proxyIndex.row()], proxyIndex.column());
+}
+
+QModelIndex InputFilesProxyModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+	if (!sourceIndex.isValid())
+		return QModelIndex();
+
+	int row = findProxyRow(sourceIndex.row());
+
+	if (row < 0)
+		return QModelIndex();
+
+	return createIndex(row, sourceIndex.column());
+}
+
+void InputFilesProxyModel::sort(int column, Qt::SortOrder order)
+{
+	if (column == sortColumn && order == sortOrder)
+		return;
+
+	emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+	QModelIndexList from = persistentIndexList();
+	QModelIndexList sources;
+	QModelIndexList to;
+
+	foreach (QModelIndex index, from) {
+		sources.append(mapToSource(index));
+	}
+
+	sortColumn = column < keys.length() ? column : -1;
+	sortOrder = order;
+
+	// Every key is already here, so this never goes back to the source model.
+	std::sort(proxyToSource.begin(), proxyToSource.end(), [this](const int row, const int otherRow) {
+		return lessThan(row, otherRow);
+	});
+
+	foreach (QModelIndex index, sources) {
+		to.append(mapFromSource(index));
+	}
+
+	changePersistentIndexList(from, to);
+
+	emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+void InputFilesProxyModel::setFilterKeyColumn(const int column)
+{
+	if (column == filterColumn)
+		return;
+
+	filterColumn = column;
+
+	if (!filterValues.isEmpty()) {
+		beginResetModel();
+		rebuild();
+		endResetModel();
+	}
+}
+
+void InputFilesProxyModel::setFilterValues(const QStringList values)
+{
+	QSet<QString> filter = values.toSet();
+
+	if (filter == filterValues)
+		return;
+
+	filterValues = filter;
+
+	beginResetModel();
+	rebuild();
+	endResetModel();
+}
+
+int InputFilesProxyModel::compare(const SortKey &key, const SortKey &otherKey)
+{
+	if (key.numeric != otherKey.numeric)
+		return key.numeric ? -1 : 1;
+
+	if (key.numeric) {
+		if (key.number < otherKey.number)
+			return -1;
+
+		return key.number > otherKey.number ? 1 : 0;
+	}
+
+	return QString::compare(key.text, otherKey.text);
+}
+
+bool InputFilesProxyModel::lessThan(const int sourceRow, const int otherSourceRow) const
+{
+	if (sortColumn >= 0) {
+		int diff = compare(keys[sortColumn][sourceRow], keys[sortColumn][otherSourceRow]);
+
+		if (diff != 0)
+			return sortOrder == Qt::AscendingOrder ? diff < 0 : diff > 0;
+	}
+
+	// Ties keep the source order whichever way we sort, so the order stays total.
+	return sourceRow < otherSourceRow;
+}
+
+// Uses the keys the row was last placed with, so call it before reading new ones.
+int InputFilesProxyModel::findProxyRow(const int sourceRow) const
+{
+	if (sourceRow < 0 || static_cast<size_t>(sourceRow) >= accepted.size() || !accepted[static_cast<size_t>(sourceRow)])
+		return -1;
+
+	int row = findInsertRow(sourceRow, 0, proxyToSource.length());
+
+	if (row >= proxyToSource.length() || proxyToSource[row] != sourceRow)
+		return -1;
+
+	return row;
+}
+
+int InputFilesProxyModel::findInsertRow(const int sourceRow, const int from, const int to) const
+{
+	QVector<int>::const_iterator position = std::lower_bound(proxyToSource.constBegin() + from, proxyToSource.constBegin() + to, sourceRow, [this](const int row, const int otherRow) {
+		return lessThan(row, otherRow);
+	});
+
+	return static_cast<int>(position - proxyToSource.constBegin());
+}
+
+void InputFilesProxyModel::readRow(const int sourceRow)
+{
+	for (int column = 0; column < keys.length(); column++) {
+		// The source gives numbers for columns with a special sort order and the display text otherwise.
+		QVariant value = sourceModel()->data(sourceModel()->index(sourceRow, column), Qt::UserRole);
+		SortKey &key = keys[column][sourceRow];
+
+		key.numeric = value.type() != QVariant::String;
+		key.number = key.numeric ? value.toDouble() : 0.0;
+		key.text = key.numeric ? QString() : value.toString();
+	}
+
+	accepted[static_cast<size_t>(sourceRow)] = filterAcceptsRow(sourceRow);
+}
+
+bool InputFilesProxyModel::filterAcceptsRow(const int sourceRow) const
+{
+	if (filterValues.isEmpty())
+		return true;
+
+	if (filterColumn < 0 || filterColumn >= keys.length())
+		return false;
+
+	return filterValues.contains(keys[filterColumn][sourceRow].text);
+}
+
+// Must be called between beginResetModel() and endResetModel().
+void InputFilesProxyModel::rebuild()
+{
+	int rows = sourceModel() ? sourceModel()->rowCount() : 0;
+	int columns = sourceModel() ? sourceModel()->columnCount() : 0;
+
+	keys.resize(columns);
+
+	for (int column = 0; column < columns; column++)
+		keys[column].resize(rows);
+
+	accepted.assign(static_cast<size_t>(rows), false);
+	proxyToSource.clear();
+
+	for (int row = 0; row < rows; row++) {
+		readRow(row);
+
+		if (accepted[static_cast<size_t>(row)])
+			proxyToSource.append(row);
+	}
+
+	if (sortColumn >= columns)
+		sortColumn = -1;
+
+	std::sort(proxyToSource.begin(), proxyToSource.end(), [this](const int row, const int otherRow) {
+		return lessThan(row, otherRow);
+	});
+}
+
+void InputFilesProxyModel::sourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+	if (parent.isValid())
+		return;
+
+	int count = last - first + 1;
+
+	for (int column = 0; column < keys.length(); column++)
+		keys[column].insert(first, count, SortKey());
+
+	// Rows are nearly always appended, in which case nobody else moves.
+	if (static_cast<size_t>(first) < accepted.size()) {
+		for (int i = 0; i < proxyToSource.length(); i++) {
+			if (proxyToSource[i] >= first)
+				proxyToSource[i] += count;
+		}
+	}
+
+	accepted.insert(accepted.begin() + first, static_cast<size_t>(count), false);
+
+	for (int sourceRow = first; sourceRow <= last; sourceRow++) {
+		readRow(sourceRow);
+
+		if (!accepted[static_cast<size_t>(sourceRow)])
+			continue;
+
+		int row = findInsertRow(sourceRow, 0, proxyToSource.length());
+
+		beginInsertRows(QModelIndex(), row, row);
+		proxyToSource.insert(row, sourceRow);
+		endInsertRows();
+	}
+}
+
+void InputFilesProxyModel::sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+	if (parent.isValid())
+		return;
+
+	QVector<int> rows;
+
+	for (int sourceRow = first; sourceRow <= last; sourceRow++) {
+		int row = findProxyRow(sourceRow);
+
+		if (row >= 0)
+			rows.append(row);
+	}
+
+	std::sort(rows.begin(), rows.end());
+
+	// Remove consecutive proxy rows together, from the back so the rest stay where they are.
+	int end = rows.length();
+
+	while (end > 0) {
+		int start = end - 1;
+
+		while (start > 0 && rows[start - 1] == rows[start] - 1)
+			start--;
+
+		beginRemoveRows(QModelIndex(), rows[start], rows[end - 1]);
+		proxyToSource.remove(rows[start], end - start);
+		endRemoveRows();
+
+		end = start;
+	}
+}
+
+void InputFilesProxyModel::sourceRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+	if (parent.isValid())
+		return;
+
+	int count = last - first + 1;
+
+	for (int column = 0; column < keys.length(); column++)
+		keys[column].remove(first, count);
+
+	accepted.erase(accepted.begin() + first, accepted.begin() + last + 1);
+
+	// Shifting every later row down by the same amount keeps them in order.
+	for (int i = 0; i < proxyToSource.length(); i++) {
+		if (proxyToSource[i] > last)
+			proxyToSource[i] -= count;
+	}
+}
+
+void InputFilesProxyModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+	if (!topLeft.isValid() || !bottomRight.isValid() || topLeft.parent().isValid())
+		return;
+
+	for (int sourceRow = topLeft.row(); sourceRow <= bottomRight.row(); sourceRow++) {
+		int oldRow = findProxyRow(sourceRow);
+		int row = oldRow;
+
+		readRow(sourceRow);
+
+		if (!accepted[static_cast<size_t>(sourceRow)]) {
+			if (oldRow >= 0) {
+				beginRemoveRows(QModelIndex(), oldRow, oldRow);
+				proxyToSource.remove(oldRow);
+				endRemoveRows();
+			}
+
+			continue;
+		}
+
+		if (oldRow < 0) {
+			row = findInsertRow(sourceRow, 0, proxyToSource.length());
+
+			beginInsertRows(QModelIndex(), row, row);
+			proxyToSource.insert(row, sourceRow);
+			endInsertRows();
+
+			continue;
+		}
+
+		// Everything around the row is still in order, so only one side needs searching.
+		if (oldRow > 0 && lessThan(sourceRow, proxyToSource[oldRow - 1])) {
+			row = findInsertRow(sourceRow, 0, oldRow);
+
+			beginMoveRows(QModelIndex(), oldRow, oldRow, QModelIndex(), row);
+			proxyToSource.remove(oldRow);
+			proxyToSource.insert(row, sourceRow);
+			endMoveRows();
+		} else if (oldRow < proxyToSource.length() - 1 && lessThan(proxyToSource[oldRow + 1], sourceRow)) {
+			int destination = findInsertRow(sourceRow, oldRow + 1, proxyToSource.length());
+
+			beginMoveRows(QModelIndex(), oldRow, oldRow, QModelIndex(), destination);
+			proxyToSource.remove(oldRow);
+			proxyToSource.insert(destination - 1, sourceRow);
+			endMoveRows();
+
+			row = destination - 1;
+		}
+
+		emit dataChanged(index(row, topLeft.column()), index(row, bottomRight.column()));
+	}
+}
+
+void InputFilesProxyModel::sourceModelAboutToBeReset()
+{
+	beginResetModel();
+}
+
+void InputFilesProxyModel::sourceModelReset()
+{
+	rebuild();
+
+	endResetModel();
+}
@@ -0,0 +1,77 @@
+#ifndef INPUTFILESPROXYMODEL_H
+#define INPUTFILESPROXYMODEL_H
+
+#include <QAbstractProxyModel>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include <vector>
+
+/*
+ * Sorting and filtering proxy for the flat input files table. Every row's sort
+ * keys are read from the source once, when the row arrives or changes, and kept
+ * here along with whether the filter accepts it. A changed row is then moved to
+ * its new place with a binary search rather than re-sorting or re-filtering the
+ * whole table, and picking another sort column only sorts the stored keys.
+ *
+ * Rows are ordered by their key and then by source row, so every row has exactly
+ * one place and the proxy row of a source row can be found by binary search too.
+ */
+class InputFilesProxyModel: public QAbstractProxyModel
+{
+	Q_OBJECT
+
+	public:
+		explicit InputFilesProxyModel(QObject *parent = nullptr);
+
+		void setSourceModel(QAbstractItemModel *sourceModel) override;
+
+		QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+		QModelIndex parent(const QModelIndex &child) const override;
+		int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+		int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+		bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+		QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+		QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+		void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+		// Only rows whose filter column shows one of these exactly are accepted, all rows if empty.
+		void setFilterKeyColumn(const int column);
+		void setFilterValues(const QStringList values);
+
+	private:
+		// Numbers sort before text, text is compared the way QSortFilterProxyModel does by default.
+		struct SortKey {
+			bool numeric;
+			double number;
+			QString text;
+		};
+
+		// Stored per column, so a sort only walks the keys of the column it uses.
+		QVector<QVector<SortKey>> keys;
+		std::vector<bool> accepted;
+		QVector<int> proxyToSource;
+		int sortColumn;
+		Qt::SortOrder sortOrder;
+		int filterColumn;
+		QSet<QString> filterValues;
+
+		static int compare(const SortKey &key, const SortKey &otherKey);
+		bool lessThan(const int sourceRow, const int otherSourceRow) const;
+		int findProxyRow(const int sourceRow) const;
+		int findInsertRow(const int sourceRow, const int from, const int to) const;
+		void readRow(const int sourceRow);
+		bool filterAcceptsRow(const int sourceRow) const;
+		void rebuild();
+
+	private slots:
+		void sourceRowsInserted(const QModelIndex &parent, int first, int last);
+		void sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
+		void sourceRowsRemoved(const QModelIndex &parent, int first, int last);
+		void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+		void sourceModelAboutToBeReset();
+		void sourceModelReset();
+};
+
+#endif // INPUTFILESPROXYMODEL_H
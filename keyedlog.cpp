@@ -0,0 +1,190 @@
+#include <QDataStream>
+#include <QMultiMap>
+#include <QSaveFile>
+
+#include "keyedlog.h"
+
+const double KeyedLog::COMPACT_SHARE = 0.5;
+
+KeyedLog::KeyedLog()
+{
+	magic = 0;
+	version = 0;
+	replaced = 0;
+}
+
+/*
+ * The file starts with magic and version, one with any others is started over
+ * rather than trusted. A torn last record, left by a crash while it was being
+ * written, is cut off.
+ */
+bool KeyedLog::open(const QString path, const quint32 magic, const quint32 version)
+{
+	this->magic = magic;
+	this->version = version;
+
+	offsets.clear();
+	replaced = 0;
+	file.setFileName(path);
+
+	if (!file.open(QIODevice::ReadWrite))
+		return false;
+
+	QDataStream in(&file);
+	quint32 storedMagic = 0;
+	quint32 storedVersion = 0;
+
+	in.setVersion(QDataStream::Qt_5_0);
+	in >> storedMagic >> storedVersion;
+
+	if (in.status() != QDataStream::Ok || storedMagic != magic || storedVersion != version) {
+		file.resize(0);
+		file.seek(0);
+
+		QDataStream out(&file);
+
+		out.setVersion(QDataStream::Qt_5_0);
+		out << magic << version;
+	} else {
+		qint64 end = file.pos();
+
+		while (!in.atEnd()) {
+			QByteArray key;
+			quint32 length = 0;
+
+			in >> key >> length;
+
+			if (in.status() != QDataStream::Ok || in.skipRawData(static_cast<int>(length)) != static_cast<int>(length))
+				break;
+
+			if (offsets.contains(key))
+				replaced++;
+
+			offsets.insert(key, end);
+			end = file.pos();
+		}
+
+		file.resize(end);
+	}
+
+	// A log that can't be compacted is still good to use as it is.
+	if (replaced > COMPACT_SHARE * (replaced + offsets.size()))
+		compact();
+
+	return file.isOpen() && file.seek(file.size());
+}
+
+bool KeyedLog::contains(const QByteArray key) const
+{
+	return offsets.contains(key);
+}
+
+// In the order they're stored, so getting every record is one pass over the file.
+QList<QByteArray> KeyedLog::getKeys() const
+{
+	QMultiMap<qint64, QByteArray> keys;
+
+	for (QHash<QByteArray, qint64>::const_iterator offset = offsets.constBegin(); offset != offsets.constEnd(); offset++)
+		keys.insert(offset.value(), offset.key());
+
+	return keys.values();
+}
+
+// Returns a null array if there's no record for key or it can't be read.
+QByteArray KeyedLog::get(const QByteArray key)
+{
+	QHash<QByteArray, qint64>::const_iterator offset = offsets.constFind(key);
+
+	if (offset == offsets.constEnd() || !file.seek(offset.value()))
+		return QByteArray();
+
+	QDataStream in(&file);
+	QByteArray storedKey;
+	QByteArray record;
+	quint32 length = 0;
+
+	in.setVersion(QDataStream::Qt_5_0);
+	in >> storedKey >> length;
+
+	record.resize(static_cast<int>(length));
+
+	bool ok = in.status() == QDataStream::Ok && storedKey == key && in.readRawData(record.data(), record.size()) == record.size();
+
+	// Writes always go on the end.
+	file.seek(file.size());
+
+	return ok ? record : QByteArray();
+}
+
+bool KeyedLog::append(const QByteArray key, const QByteArray record)
+{
+	if (!file.isOpen())
+		return false;
+
+	QDataStream out(&file);
+	qint64 offset = file.size();
+
+	out.setVersion(QDataStream::Qt_5_0);
+	out << key << static_cast<quint32>(record.size());
+
+	if (out.writeRawData(record.constData(), record.size()) != record.size()) {
+		file.resize(offset);
+		file.seek(offset);
+
+		return false;
+	}
+
+	file.flush();
+
+	if (offsets.contains(key))
+		replaced++;
+
+	offsets.insert(key, offset);
+
+	return true;
+}
+
+/*
+ * Writes the latest records to a new file that then takes this one's place, so
+ * a crash on the way leaves the old one as it was. Records that can't be read
+ * back are dropped.
+ */
+bool KeyedLog::compact()
+{
+	QSaveFile compacted(file.fileName());
+	QHash<QByteArray, qint64> compactedOffsets;
+
+	if (!compacted.open(QIODevice::WriteOnly))
+		return false;
+
+	QDataStream out(&compacted);
+
+	out.setVersion(QDataStream::Qt_5_0);
+	out << magic << version;
+
+	foreach (QByteArray key, getKeys()) {
+		QByteArray record = get(key);
+
+		if (record.isNull())
+			continue;
+
+		compactedOffsets.insert(key, compacted.pos());
+
+		out << key << static_cast<quint32>(record.size());
+		out.writeRawData(record.constData(), record.size());
+	}
+
+	if (out.status() != QDataStream::Ok)
+		return false;
+
+	file.close();
+
+	bool committed = compacted.commit();
+
+	if (committed) {
+		offsets = compactedOffsets;
+		replaced = 0;
+	}
+
+	return file.open(QIODevice::ReadWrite) && committed;
+}
@@ -0,0 +1,45 @@
+#ifndef KEYEDLOG_H
+#define KEYEDLOG_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+/*
+ * A file of records that are only ever appended, each a key and the bytes stored
+ * under it, where a later record for a key replaces the earlier ones. Only where
+ * the latest record of each key starts is kept in memory, which is read back by
+ * skipping from record to record when the log is opened.
+ *
+ * Replaced records stay where they are until the log is next opened. If they're
+ * more than COMPACT_SHARE of the records by then, the log is written out again
+ * with just the latest ones, in the order they were in.
+ */
+class KeyedLog
+{
+	public:
+		static const double COMPACT_SHARE;
+
+		KeyedLog();
+
+		bool open(const QString path, const quint32 magic, const quint32 version);
+		bool isOpen() const { return file.isOpen(); }
+		bool contains(const QByteArray key) const;
+		QList<QByteArray> getKeys() const;
+		QByteArray get(const QByteArray key);
+		bool append(const QByteArray key, const QByteArray record);
+
+	private:
+		QFile file;
+		quint32 magic;
+		quint32 version;
+		QHash<QByteArray, qint64> offsets;
+		// Records in the file that a later one for the same key replaced.
+		int replaced;
+
+		bool compact();
+};
+
+#endif // KEYEDLOG_H
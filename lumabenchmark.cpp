@@ -0,0 +1,202 @@
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <cmath>
+#include <cstdlib>
+
+extern "C" {
+	#include <libavutil/frame.h>
+	#include <libavutil/pixdesc.h>
+	#include <libswscale/swscale.h>
+}
+
+#include "fingerprintengine.h"
+#include "lumabenchmark.h"
+#include "lumascaler.h"
+
+const char *LumaBenchmark::ARGUMENT = "--bench-luma";
+// A tenth of the bits is well inside the default threshold, which allows a quarter.
+const double LumaBenchmark::HAMMING_TOLERANCE = 0.1;
+
+// Every format getLumaScaler() has a kernel for.
+static const AVPixelFormat FORMATS[] = {
+	AV_PIX_FMT_YUV420P,
+	AV_PIX_FMT_YUV422P,
+	AV_PIX_FMT_YUV444P,
+	AV_PIX_FMT_NV12,
+	AV_PIX_FMT_NV21,
+	AV_PIX_FMT_YUVJ420P,
+	AV_PIX_FMT_YUVJ422P,
+	AV_PIX_FMT_YUVJ444P,
+	AV_PIX_FMT_GRAY8,
+	AV_PIX_FMT_YUV420P10,
+	AV_PIX_FMT_YUV422P10,
+	AV_PIX_FMT_P010
+};
+
+static const int SIZES[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+/*
+ * A frame of format with soft bands for the fingerprints to pick up and a little
+ * noise on top, so the two ways of averaging it down don't see flat areas. It's
+ * drawn in full range 4:4:4 and converted, which isn't timed.
+ */
+static AVFrame *makeFrame(const AVPixelFormat format, const int width, const int height)
+{
+	AVFrame *source = av_frame_alloc();
+	AVFrame *frame = av_frame_alloc();
+	SwsContext *context = nullptr;
+	uint32_t seed = 1;
+	bool ok = false;
+
+	source->format = AV_PIX_FMT_YUVJ444P;
+	source->width = width;
+	source->height = height;
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+
+	if (av_frame_get_buffer(source, 32) >= 0 && av_frame_get_buffer(frame, 32) >= 0) {
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				double bands = 70.0 * sin(2.0 * M_PI * (3.0 * x / width + 0.3)) * cos(2.0 * M_PI * 2.0 * y / height);
+
+				seed = seed * 1664525u + 1013904223u;
+
+				source->data[0][y * source->linesize[0] + x] = static_cast<uint8_t>(qBound(0.0, 108.0 + bands + 40.0 * x / width + (seed >> 28), 255.0));
+				source->data[1][y * source->linesize[1] + x] = static_cast<uint8_t>(96 + 64 * x / width);
+				source->data[2][y * source->linesize[2] + x] = static_cast<uint8_t>(96 + 64 * y / height);
+			}
+		}
+
+		context = sws_getContext(width, height, AV_PIX_FMT_YUVJ444P, width, height, format, SWS_POINT, nullptr, nullptr, nullptr);
+		ok = context && sws_scale(context, (uint8_t const *const *)source->data, source->linesize, 0, height, frame->data, frame->linesize) >= 0;
+	}
+
+	sws_freeContext(context);
+	av_frame_free(&source);
+
+	if (!ok)
+		av_frame_free(&frame);
+
+	return frame;
+}
+
+/*
+ * Writes one row of the table for the picture Engine takes, or returns -1 if
+ * swscale can't take the frame. Returns 1 if the fingerprints differ by more
+ * than the tolerance and 0 otherwise. The swscale path is set up like
+ * MediaUtility sets it up, once per file, so only scaling is timed.
+ */
+template <typename Engine>
+static int compareScalers(QTextStream &out, const AVFrame *frame, const char *engineName, const int iterations)
+{
+	uint8_t lumaPixels[Engine::WIDTH * Engine::HEIGHT];
+	uint8_t swsPixels[Engine::WIDTH * Engine::HEIGHT];
+	uint8_t lumaSample[Engine::SAMPLE_SIZE];
+	uint8_t swsSample[Engine::SAMPLE_SIZE];
+	uint8_t *data[4] = { swsPixels, nullptr, nullptr, nullptr };
+	int linesize[4] = { Engine::WIDTH, 0, 0, 0 };
+	LumaScaler scaler = getLumaScaler(frame->format);
+	SwsContext *context = sws_getContext(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+										 Engine::WIDTH, Engine::HEIGHT, AV_PIX_FMT_GRAY8, 0, nullptr, nullptr, nullptr);
+	QElapsedTimer timer;
+	qint64 lumaTime = 0;
+	qint64 swsTime = 0;
+	int deviation = 0;
+
+	if (!context)
+		return -1;
+
+	// The first run of each only warms up the caches.
+	for (int i = 0; i <= iterations; i++) {
+		timer.start();
+		scaler(frame->data[0], frame->linesize[0], frame->width, frame->height, lumaPixels, Engine::WIDTH, Engine::HEIGHT);
+		lumaTime += i ? timer.nsecsElapsed() : 0;
+
+		timer.start();
+		sws_scale(context, (uint8_t const *const *)frame->data, frame->linesize, 0, frame->height, data, linesize);
+		swsTime += i ? timer.nsecsElapsed() : 0;
+	}
+
+	sws_freeContext(context);
+
+	for (int i = 0; i < Engine::WIDTH * Engine::HEIGHT; i++)
+		deviation = qMax(deviation, abs(lumaPixels[i] - swsPixels[i]));
+
+	Engine::compute(lumaPixels, Engine::WIDTH, lumaSample);
+	Engine::compute(swsPixels, Engine::WIDTH, swsSample);
+
+	int bits = static_cast<int>(Engine::SAMPLE_SIZE * 8);
+	int diff = getSampleDifference<Engine::SAMPLE_SIZE>(lumaSample, swsSample);
+	bool over = diff > HAMMING_TOLERANCE * bits;
+
+	out << frame->width << 'x' << frame->height << '\t'
+		<< av_get_pix_fmt_name(static_cast<AVPixelFormat>(frame->format)) << '\t'
+		<< engineName << '\t'
+		<< QString::number(lumaTime / (iterations * 1e6), 'f', 3) << '\t'
+		<< QString::number(swsTime / (iterations * 1e6), 'f', 3) << '\t'
+		<< QString::number(static_cast<double>(swsTime) / qMax<qint64>(lumaTime, 1), 'f', 1) << '\t'
+		<< deviation << '\t'
+		<< diff << '/' << bits << '\t'
+		<< (over ? "over" : "ok") << '\n';
+
+	return over ? 1 : 0;
+}
+
+// Optionally takes how many times each frame is scaled.
+int LumaBenchmark::runCommand(const QStringList arguments)
+{
+	QTextStream out(stdout);
+	QTextStream err(stderr);
+	int iterations = 20;
+	bool ok = true;
+	int failed = 0;
+
+	if (arguments.length() > 0)
+		iterations = arguments[0].toInt(&ok);
+
+	if (arguments.length() > 1 || !ok || iterations < 1) {
+		err << "Usage: SameDifference " << ARGUMENT << " [iterations]\n";
+
+		return 2;
+	}
+
+	out << "frame\tformat\tengine\tluma_ms\tswscale_ms\tspeedup\tmax_pixel_deviation\thamming\ttolerance\n";
+
+	for (const int *size : SIZES) {
+		for (AVPixelFormat format : FORMATS) {
+			AVFrame *frame = makeFrame(format, size[0], size[1]);
+
+			// Only happens with an FFmpeg built without some formats, the rest are still worth seeing.
+			if (!frame) {
+				err << "Could not make a " << av_get_pix_fmt_name(format) << " frame at " << size[0] << 'x' << size[1] << "\n";
+
+				continue;
+			}
+
+			int ret[3] = {
+				compareScalers<DHashEngine>(out, frame, "dhash", iterations),
+				compareScalers<PHashEngine>(out, frame, "phash", iterations),
+				compareScalers<PHash16Engine>(out, frame, "phash16", iterations)
+			};
+
+			av_frame_free(&frame);
+
+			for (int i = 0; i < 3; i++) {
+				if (ret[i] < 0)
+					err << "swscale can't take " << av_get_pix_fmt_name(format) << " at " << size[0] << 'x' << size[1] << "\n";
+
+				else
+					failed += ret[i];
+			}
+
+			out.flush();
+		}
+	}
+
+	if (failed)
+		err << failed << " fingerprints differ by more than " << HAMMING_TOLERANCE * 100 << "% of their bits\n";
+
+	return failed ? 1 : 0;
+}
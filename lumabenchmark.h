@@ -0,0 +1,25 @@
+#ifndef LUMABENCHMARK_H
+#define LUMABENCHMARK_H
+
+#include <QStringList>
+
+/*
+ * Checks the luma scalers against swscale, which they replaced for the formats
+ * they handle. Frames of each supported pixel format are made at 1080p and 4K
+ * and downscaled both ways for the picture of every fingerprint engine. For
+ * each, the time per frame of both, the largest difference of any grey pixel
+ * and how many fingerprint bits differ are written to standard output as a
+ * table. Fails when more than HAMMING_TOLERANCE of a fingerprint's bits differ
+ * anywhere, which would mean files fingerprinted before and after no longer
+ * match.
+ */
+class LumaBenchmark
+{
+	public:
+		static const char *ARGUMENT;
+		static const double HAMMING_TOLERANCE;
+
+		static int runCommand(const QStringList arguments);
+};
+
+#endif // LUMABENCHMARK_H
@@ -0,0 +1,243 @@
+extern "C" {
+	#include <libavutil/pixfmt.h>
+}
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+	#include <immintrin.h>
+	#define LUMA_SCALER_X86
+#endif
+
+#include "lumascaler.h"
+
+/*
+ * Row sums are the only hot loop: every source pixel goes through one of these
+ * once. The AVX2 versions are compiled for that target on their own and only
+ * picked when the CPU has it, so the rest of the build stays baseline x86-64.
+ */
+typedef uint32_t (*RowSum8)(const uint8_t *row, const int count);
+typedef uint32_t (*RowSum16)(const uint16_t *row, const int count);
+
+static uint32_t sumRow8(const uint8_t *row, const int count)
+{
+	uint32_t sum = 0;
+
+	for (int x = 0; x < count; x++)
+		sum += row[x];
+
+	return sum;
+}
+
+static uint32_t sumRow16(const uint16_t *row, const int count)
+{
+	uint32_t sum = 0;
+
+	for (int x = 0; x < count; x++)
+		sum += row[x];
+
+	return sum;
+}
+
+#ifdef LUMA_SCALER_X86
+static inline uint32_t sumLanes32(const __m128i lanes)
+{
+	__m128i sum = _mm_add_epi32(lanes, _mm_srli_si128(lanes, 8));
+
+	sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+}
+
+static uint32_t sumRow8Sse2(const uint8_t *row, const int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	int x = 0;
+
+	// SAD against zero adds up 8 bytes into each 64 bit half.
+	for (; x + 16 <= count; x += 16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x)), zero));
+
+	return sumLanes32(acc) + sumRow8(row + x, count - x);
+}
+
+static uint32_t sumRow16Sse2(const uint16_t *row, const int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	int x = 0;
+
+	for (; x + 8 <= count; x += 8) {
+		__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+
+		acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(samples, zero));
+		acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(samples, zero));
+	}
+
+	return sumLanes32(acc) + sumRow16(row + x, count - x);
+}
+
+/*
+ * The AVX2 versions finish off their tails themselves rather than calling the
+ * SSE2 ones, as going from 256 bit code to legacy SSE code without clearing the
+ * upper halves first costs more than the whole row.
+ */
+__attribute__((target("avx2")))
+static uint32_t sumRow8Avx2(const uint8_t *row, const int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = zero;
+	int x = 0;
+
+	for (; x + 32 <= count; x += 32)
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x)), zero));
+
+	__m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+	if (x + 16 <= count) {
+		half = _mm_add_epi64(half, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x)), _mm_setzero_si128()));
+		x += 16;
+	}
+
+	uint32_t sum = sumLanes32(half);
+
+	for (; x < count; x++)
+		sum += row[x];
+
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static uint32_t sumRow16Avx2(const uint16_t *row, const int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = zero;
+	int x = 0;
+
+	for (; x + 16 <= count; x += 16) {
+		__m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x));
+
+		acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(samples, zero));
+		acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(samples, zero));
+	}
+
+	uint32_t sum = sumLanes32(_mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+
+	for (; x < count; x++)
+		sum += row[x];
+
+	return sum;
+}
+
+static bool hasAvx2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+
+	return avx2;
+}
+#endif
+
+template <typename Sample>
+static uint32_t sumRow(const Sample *row, const int count);
+
+template <>
+inline uint32_t sumRow<uint8_t>(const uint8_t *row, const int count)
+{
+#ifdef LUMA_SCALER_X86
+	static const RowSum8 sum = hasAvx2() ? sumRow8Avx2 : sumRow8Sse2;
+
+	return sum(row, count);
+#else
+	return sumRow8(row, count);
+#endif
+}
+
+template <>
+inline uint32_t sumRow<uint16_t>(const uint16_t *row, const int count)
+{
+#ifdef LUMA_SCALER_X86
+	static const RowSum16 sum = hasAvx2() ? sumRow16Avx2 : sumRow16Sse2;
+
+	return sum(row, count);
+#else
+	return sumRow16(row, count);
+#endif
+}
+
+/*
+ * BITS is where the most significant bit of a sample sits, so 10 for the usual
+ * planar 10 bit formats and 16 for P010, which keeps its samples in the top bits.
+ * Limited range input is stretched to full range, like swscale does for GRAY8.
+ * This runs for every frame, so the scratch space is on the stack.
+ */
+template <typename Sample, int BITS, bool FULL_RANGE>
+static void scaleLuma(const uint8_t *plane,
+					  const int linesize,
+					  const int width,
+					  const int height,
+					  uint8_t *pixels,
+					  const int pixelsWidth,
+					  const int pixelsHeight)
+{
+	int edges[LUMA_SCALER_MAX_WIDTH + 1];
+	uint64_t sums[LUMA_SCALER_MAX_WIDTH];
+	const double scale = 1.0 / (1 << (BITS - 8));
+
+	for (int x = 0; x <= pixelsWidth; x++)
+		edges[x] = static_cast<int>(static_cast<int64_t>(x) * width / pixelsWidth);
+
+	for (int y = 0; y < pixelsHeight; y++) {
+		int top = static_cast<int>(static_cast<int64_t>(y) * height / pixelsHeight);
+		int bottom = static_cast<int>(static_cast<int64_t>(y + 1) * height / pixelsHeight);
+
+		std::fill(sums, sums + pixelsWidth, 0);
+
+		for (int row = top; row < bottom; row++) {
+			const Sample *samples = reinterpret_cast<const Sample *>(plane + static_cast<ptrdiff_t>(row) * linesize);
+
+			for (int x = 0; x < pixelsWidth; x++)
+				sums[x] += sumRow<Sample>(samples + edges[x], edges[x + 1] - edges[x]);
+		}
+
+		for (int x = 0; x < pixelsWidth; x++) {
+			double count = double(bottom - top) * (edges[x + 1] - edges[x]);
+			double value = count > 0 ? sums[x] / count * scale : 0.0;
+
+			if (!FULL_RANGE)
+				value = (value - 16.0) * 255.0 / 219.0;
+
+			pixels[y * pixelsWidth + x] = static_cast<uint8_t>(std::min(255.0, std::max(0.0, std::round(value))));
+		}
+	}
+}
+
+LumaScaler getLumaScaler(const int format)
+{
+	// Only the luma plane is read, so how the chroma is laid out doesn't matter.
+	switch (format) {
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUV422P:
+		case AV_PIX_FMT_YUV444P:
+		case AV_PIX_FMT_NV12:
+		case AV_PIX_FMT_NV21:
+			return scaleLuma<uint8_t, 8, false>;
+
+		case AV_PIX_FMT_YUVJ420P:
+		case AV_PIX_FMT_YUVJ422P:
+		case AV_PIX_FMT_YUVJ444P:
+		case AV_PIX_FMT_GRAY8:
+			return scaleLuma<uint8_t, 8, true>;
+
+		case AV_PIX_FMT_YUV420P10:
+		case AV_PIX_FMT_YUV422P10:
+			return scaleLuma<uint16_t, 10, false>;
+
+		case AV_PIX_FMT_P010:
+			return scaleLuma<uint16_t, 16, false>;
+
+		default:
+			return nullptr;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef LUMASCALER_H
+#define LUMASCALER_H
+
+#include <cstdint>
+
+/*
+ * Downscales the luma plane of a planar or semi-planar YUV frame straight to a
+ * tiny greyscale picture by averaging the box of source pixels behind each output
+ * pixel. Fingerprints only need a few dozen grey pixels, so this skips everything
+ * swscale would do with chroma and reads the Y plane exactly once.
+ */
+typedef void (*LumaScaler)(const uint8_t *plane,
+						   const int linesize,
+						   const int width,
+						   const int height,
+						   uint8_t *pixels,
+						   const int pixelsWidth,
+						   const int pixelsHeight);
+
+// The widest picture a scaler can make, enough for every fingerprint engine.
+static const int LUMA_SCALER_MAX_WIDTH = 32;
+
+// Returns nullptr for pixel formats without a kernel, those have to go through swscale.
+LumaScaler getLumaScaler(const int format);
+
+#endif // LUMASCALER_H
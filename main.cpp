@@ -1,24 +1,66 @@
 #include <QApplication>
 #include <QThreadPool>
 
+#include <cstring>
+
 extern "C" {
 	#include <libavformat/avformat.h>
     #include <libavutil/log.h>
 }
 
+#include "allpairsengine.h"
+#include "fingerprintcatalog.h"
+#include "lumabenchmark.h"
 #include "mainwindow.h"
+#include "scancommand.h"
+#include "workerpool.h"
 
 int main(int argc, char *argv[])
 {
 	av_log_set_level(AV_LOG_QUIET);
 
+	// Decoder helper processes don't need a GUI, they just serve WorkerPool over their pipes.
+	if (argc > 1 && strcmp(argv[1], WorkerPool::WORKER_ARGUMENT) == 0) {
+		QCoreApplication a(argc, argv);
+
+		return WorkerPool::runWorker();
+	}
+
 	QThreadPool::globalInstance()->setExpiryTimeout(-1);
 
 	QCoreApplication::setOrganizationName("Simon Allen");
 	QCoreApplication::setOrganizationDomain("simonallen.org");
 	QCoreApplication::setApplicationName("SameDifference");
 
+	// Batch comparisons of whole archives run without a window, after the names so the cache is found.
+	if (argc > 1 && strcmp(argv[1], FingerprintCatalog::ARGUMENT) == 0) {
+		QCoreApplication a(argc, argv);
+
+		return FingerprintCatalog::runExport(a.arguments().mid(2));
+	}
+
+	if (argc > 1 && strcmp(argv[1], AllPairsEngine::ARGUMENT) == 0) {
+		QCoreApplication a(argc, argv);
+
+		return AllPairsEngine::runCommand(a.arguments().mid(2));
+	}
+
+	if (argc > 1 && strcmp(argv[1], ScanCommand::ARGUMENT) == 0) {
+		QCoreApplication a(argc, argv);
+
+		return ScanCommand::runCommand(a.arguments().mid(2));
+	}
+
+	if (argc > 1 && strcmp(argv[1], LumaBenchmark::ARGUMENT) == 0) {
+		QCoreApplication a(argc, argv);
+
+		return LumaBenchmark::runCommand(a.arguments().mid(2));
+	}
+
 	qRegisterMetaType<QVector<int>>("QVector<int>");
+	qRegisterMetaType<InputFileItemPtr>("InputFileItemPtr");
+	qRegisterMetaType<QVector<InputFileItemPtr>>("QVector<InputFileItemPtr>");
+	qRegisterMetaType<QVector<QStringList>>("QVector<QStringList>");
 
 	QApplication a(argc, argv);
 	MainWindow w;
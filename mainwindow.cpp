@@ -2,37 +2,85 @@
 #include <QDirIterator>
 #include <QtConcurrent/QtConcurrentRun>
 #include <QCloseEvent>
+#include <QLabel>
+#include <QScrollBar>
+#include <QStandardPaths>
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "preferences.h"
-#include "mediautility.h"
+#include "archivereader.h"
+#include "fileverifier.h"
+#include "tracer.h"
 
-MainWindow::MainWindow(QWidget *parent): QMainWindow(parent), ui(new Ui::MainWindow)
+MainWindow::MainWindow(QWidget *parent): QMainWindow(parent), ui(new Ui::MainWindow), pipeline(inputFilesModel, pairStore)
 {
 	ui->setupUi(this);
 
 	timeToDie = false;
+	similarityThreshold = 0;
 	prefs = new Preferences(this);
 
 	sortProxyModel.setSourceModel(&inputFilesModel);
-	sortProxyModel.setDynamicSortFilter(true);
-	sortProxyModel.setSortRole(Qt::UserRole);
 	sortProxyModel.setFilterKeyColumn(1);
 
 	ui->inputFilesTableView->setModel(&sortProxyModel);
 	ui->inputFilesTableView->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
 	ui->inputFilesTableView->horizontalHeader()->setSortIndicator(0, Qt::AscendingOrder);
 
+	// Without somewhere to keep them we just go without previews.
+	if (thumbnailStore.open(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))) {
+		duplicateGroupsModel.setThumbnailStore(&thumbnailStore);
+		pipeline.setThumbnailStore(&thumbnailStore);
+	}
+
+	// Without it library files are decoded like any other.
+	if (fingerprintCache.open(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)))
+		pipeline.setFingerprintCache(&fingerprintCache);
+
+	inputFilesModel.setClosestPairs(&closestPairs);
+	pipeline.setClosestPairs(&closestPairs);
+	pipeline.setDuplicateGroups(&duplicateGroupsModel);
+
+	ui->duplicateGroupsTreeView->setModel(&duplicateGroupsModel);
+	ui->duplicateGroupsTreeView->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+	ui->duplicateGroupsTreeView->header()->setSortIndicator(DuplicateGroupsModel::COLUMN_RECLAIMABLE, Qt::DescendingOrder);
+
 	connect(ui->inputFilesTableView->selectionModel(),
 			&QItemSelectionModel::selectionChanged,	this,
 			&MainWindow::inputFileSelectionChanged);
 
 	connect(this, &MainWindow::fileAdded, this, &MainWindow::addFile, Qt::BlockingQueuedConnection);
-	connect(this, &MainWindow::fileInfoAdded, this, &MainWindow::addFileInfo, Qt::BlockingQueuedConnection);
+	connect(&pipeline, &ScanPipeline::fileUpdated, this, &MainWindow::updateInputFileCounter);
+	connect(&pipeline, &ScanPipeline::closestPairsChanged, this, &MainWindow::scheduleClosestPairsUpdate, Qt::QueuedConnection);
+	connect(&pipeline, &ScanPipeline::concurrencyChanged, this, &MainWindow::updateConcurrencyLabel);
+	connect(this, &MainWindow::duplicatesVerified, this, &MainWindow::addVerification, Qt::QueuedConnection);
+	connect(this, &MainWindow::verificationFinished, this, &MainWindow::finishVerification, Qt::QueuedConnection);
 
 	connect(prefs, &Preferences::accepted, this, &MainWindow::applyPreferences);
 
+	// Files on screen are fingerprinted first. Scrolling and sorting only restart the
+	// timer, so the scheduler is reprioritised at most once per burst.
+	visibleFilesTimer.setSingleShot(true);
+	visibleFilesTimer.setInterval(100);
+
+	connect(&visibleFilesTimer, &QTimer::timeout, this, &MainWindow::updateVisibleFiles);
+	connect(ui->inputFilesTableView->verticalScrollBar(), &QScrollBar::valueChanged, &visibleFilesTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+	connect(&sortProxyModel, &InputFilesProxyModel::layoutChanged, &visibleFilesTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+	connect(&sortProxyModel, &InputFilesProxyModel::rowsInserted, &visibleFilesTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+	connect(&sortProxyModel, &InputFilesProxyModel::rowsMoved, &visibleFilesTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+	connect(&sortProxyModel, &InputFilesProxyModel::rowsRemoved, &visibleFilesTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+
+	// The closest pairs change with nearly every comparison early on, the groups are rebuilt from them once a second at most.
+	closestPairsTimer.setSingleShot(true);
+	closestPairsTimer.setInterval(1000);
+
+	connect(&closestPairsTimer, &QTimer::timeout, this, &MainWindow::updateClosestPairs);
+
+	// How many files are read and decoded at once, as the pipeline has tuned it.
+	concurrencyLabel = new QLabel(this);
+	ui->statusBar->addPermanentWidget(concurrencyLabel);
+
 	// Configure app with our preferences.
 	applyPreferences();
 }
@@ -49,6 +97,10 @@ void MainWindow::closeEvent(QCloseEvent *event)
 	Q_UNUSED(event)
 
 	timeToDie = true;
+
+	stopVerification();
+	inputFilesModel.cancelAll();
+	pipeline.stop();
 }
 
 void MainWindow::inputFileSelectionChanged(const QItemSelection &selected, const QItemSelection &deselected)
@@ -67,7 +119,7 @@ void MainWindow::addFiles()
 			if (timeToDie)
 				return;
 
-			emit fileAdded(path);
+			findFiles(path);
 		}
 	});
 }
@@ -87,24 +139,69 @@ void MainWindow::addDir()
 				QFileInfo info(iter.next());
 
 				if (info.isFile())
-					emit fileAdded(info.filePath());
+					findFiles(info.filePath());
 			}
 		});
 	}
 }
 
+// Files in a library are only compared with the files added the usual way, which are the new ones.
+void MainWindow::addLibrary()
+{
+	QString dirPath = QFileDialog::getExistingDirectory(this, tr("Select library folder"), QDir::homePath());
+
+	if (!dirPath.isEmpty()) {
+		QtConcurrent::run([=]() {
+			QDirIterator iter(dirPath, QDirIterator::Subdirectories);
+
+			while (iter.hasNext()) {
+				if (timeToDie)
+					return;
+
+				QFileInfo info(iter.next());
+
+				if (info.isFile())
+					findFiles(info.filePath(), true);
+			}
+		});
+	}
+}
+
+// Runs on the thread looking for files. Archives are opened up and their members added instead.
+void MainWindow::findFiles(const QString path, const bool reference)
+{
+	std::vector<ArchiveReader::Member> members;
+
+	if (!ArchiveReader::isArchive(qPrintable(path)) || ArchiveReader::list(qPrintable(path), members) < 0) {
+		emit fileAdded(path, reference);
+
+		return;
+	}
+
+	for (size_t i = 0; i < members.size() && !timeToDie; i++)
+		emit fileAdded(path + ArchiveReader::SEPARATOR + QString::fromLocal8Bit(members[i].name.c_str()), reference);
+}
+
 void MainWindow::removeFiles()
 {
 	QItemSelectionModel *selection = ui->inputFilesTableView->selectionModel();
 
 	if (selection->hasSelection()) {
 		QModelIndexList rows;
+		QStringList paths;
 
 		foreach (QModelIndex row, selection->selectedRows()) {
 			rows.append(sortProxyModel.mapToSource(row));
+			paths.append(inputFilesModel.getPath(rows.last().row()));
 		}
 
+		// The groups being verified may be about to change.
+		stopVerification();
 		inputFilesModel.removeSelection(rows);
+		duplicateGroupsModel.removeFiles(paths);
+		closestPairs.removeFiles(paths);
+		pairStore.removeFiles(paths);
+		pipeline.prune();
 
 		updateInputFileCounter();
 	}
@@ -112,7 +209,12 @@ void MainWindow::removeFiles()
 
 void MainWindow::clearFiles()
 {
+	stopVerification();
 	inputFilesModel.clear();
+	duplicateGroupsModel.clear();
+	closestPairs.clear();
+	pairStore.clear();
+	pipeline.clear();
 	updateInputFileCounter();
 }
 
@@ -121,6 +223,93 @@ void MainWindow::showPreferences()
 	prefs->show();
 }
 
+void MainWindow::saveTrace()
+{
+	QString path = QFileDialog::getSaveFileName(this, tr("Save Trace"), QDir::homePath(), tr("Trace files (*.json)"));
+
+	if (path.isEmpty())
+		return;
+
+	if (Tracer::save(path))
+		ui->statusBar->showMessage(QString("Trace saved to %1").arg(QDir::toNativeSeparators(path)), 5000);
+
+	else
+		ui->statusBar->showMessage(QString("Could not save trace to %1").arg(QDir::toNativeSeparators(path)), 5000);
+}
+
+void MainWindow::verifyDuplicates()
+{
+	QVector<QStringList> groups = duplicateGroupsModel.getUnverifiedGroups();
+
+	if (groups.isEmpty()) {
+		ui->statusBar->showMessage("Every group has been verified", 5000);
+
+		return;
+	}
+
+	ui->verifyPushButton->setEnabled(false);
+	ui->statusBar->showMessage(QString("Verifying %1 groups...").arg(groups.length()));
+
+	CancelToken token(new std::atomic<bool>(false));
+
+	verification = token;
+
+	// Groups are read one after another, reading several at once would only make the disks seek.
+	QtConcurrent::run([=]() {
+		foreach (QStringList paths, groups) {
+			if (*token)
+				break;
+
+			QVector<QStringList> identical = FileVerifier::findIdentical(paths, token);
+
+			if (!*token)
+				emit duplicatesVerified(paths, identical);
+		}
+
+		if (!timeToDie)
+			emit verificationFinished();
+	});
+}
+
+void MainWindow::stopVerification()
+{
+	if (verification)
+		*verification = true;
+}
+
+void MainWindow::addVerification(const QStringList paths, const QVector<QStringList> identical)
+{
+	duplicateGroupsModel.setVerified(paths, identical);
+}
+
+void MainWindow::finishVerification()
+{
+	ui->verifyPushButton->setEnabled(true);
+	ui->statusBar->showMessage("Verification finished", 5000);
+}
+
+void MainWindow::scheduleClosestPairsUpdate()
+{
+	if (!closestPairsTimer.isActive())
+		closestPairsTimer.start();
+}
+
+void MainWindow::updateClosestPairs()
+{
+	QVector<QPair<InputFileItemPtr, InputFileItemPtr>> pairs;
+
+	if (!closestPairs.isEnabled())
+		return;
+
+	foreach (ClosestPairs::Pair pair, closestPairs.getPairs(pairStore)) {
+		// Files removed since they were compared mustn't come back as a group.
+		if (inputFilesModel.getCancelToken(pair.path) && inputFilesModel.getCancelToken(pair.otherPath))
+			pairs.append(qMakePair(inputFilesModel.getItem(pair.path), inputFilesModel.getItem(pair.otherPath)));
+	}
+
+	duplicateGroupsModel.setPairs(pairs);
+}
+
 void MainWindow::applyPreferences()
 {
 	switch (prefs->getCheckFiles()) {
@@ -149,25 +338,64 @@ void MainWindow::applyPreferences()
 			break;
 	}
 
+	pipeline.setBudget(prefs->getDecodeTimeBudget(), prefs->getDecodeByteBudget());
+	pipeline.setMemoryBudget(prefs->getMemoryBudget());
+	pipeline.setFingerprinting(prefs->getFingerprintEngine(), prefs->getFingerprintProfile(), prefs->getProgressiveFingerprints(), prefs->getAudioPrefilter());
+	pipeline.setIsolateDecoders(prefs->getIsolateDecoders());
+	pipeline.setConcurrencyBounds(prefs->getMaxReadWorkers(), prefs->getMaxDecodeWorkers());
+	inputFilesModel.setSimilarityThreshold(prefs->getSimilarityThreshold());
+	inputFilesModel.setTransformInvariant(prefs->getTransformInvariant());
+	inputFilesModel.setCompareQueries(prefs->getCompareQueries());
+
+	bool closestPairsEnabled = closestPairs.isEnabled();
+
+	closestPairs.setLimits(prefs->getClosestPairs(), prefs->getMatchesPerFile());
+	updateClosestPairs();
+
+	// Every pair within reach of the slider was kept, so the groups are just rebuilt from those.
+	if (!closestPairs.isEnabled() && (closestPairsEnabled || prefs->getSimilarityThreshold() != similarityThreshold))
+		duplicateGroupsModel.regroup(pairStore, inputFilesModel.getMaxDifference());
+
+	// Except for the ones the closest pairs' bound cut short, which are looked for again.
+	if (!closestPairs.isEnabled() && closestPairsEnabled)
+		pipeline.compareAll();
+
+	similarityThreshold = prefs->getSimilarityThreshold();
+
+	Tracer::setEnabled(prefs->getTraceScan());
+	ui->saveTracePushButton->setVisible(prefs->getTraceScan());
+
 	toggleShowHiddenFiles(ui->showHiddenCheckBox->isChecked());
 }
 
+void MainWindow::updateConcurrencyLabel()
+{
+	concurrencyLabel->setText(pipeline.getConcurrency().getSummary());
+}
+
 void MainWindow::updateInputFileCounter()
 {
 	int total = inputFilesModel.rowCount();
 	int filteredTotal = sortProxyModel.rowCount();
-	int loading = inputFilesModel.match(sortProxyModel.index(0, 1), Qt::DisplayRole, "Loading", -1).length();
+	int loading = inputFilesModel.getProbesPending();
+	int fingerprinting = inputFilesModel.getFingerprintsPending();
 
 	ui->clearFilesPushButton->setEnabled(total > 0);
 
 	if (ui->showHiddenCheckBox->isChecked()) {
-		if (loading == 0)
+		if (loading == 0 && fingerprinting > 0)
+			ui->statusBar->showMessage(QString("%1 files loaded, fingerprinting %2...").arg(total).arg(fingerprinting));
+
+		else if (loading == 0)
 			ui->statusBar->showMessage(QString("%1 files loaded").arg(total));
 
 		else
 			ui->statusBar->showMessage(QString("Processing... %1 / %2 files loaded").arg(total - loading).arg(total));
 	} else {
-		if (loading == 0)
+		if (loading == 0 && fingerprinting > 0)
+			ui->statusBar->showMessage(QString("%1 files loaded, fingerprinting %2...").arg(filteredTotal).arg(fingerprinting));
+
+		else if (loading == 0)
 			ui->statusBar->showMessage(QString("%1 files loaded").arg(filteredTotal));
 
 		else
@@ -178,26 +406,26 @@ void MainWindow::updateInputFileCounter()
 void MainWindow::toggleShowHiddenFiles(const bool show)
 {
 	if (show) {
-		sortProxyModel.setFilterFixedString(QString());
+		sortProxyModel.setFilterValues(QStringList());
 	} else {
 		switch (prefs->getCheckFiles()) {
 			case VideosAndImages:
-				sortProxyModel.setFilterRegExp("(Video|Image)");
+				sortProxyModel.setFilterValues(QStringList() << "Video" << "Image");
 
 				break;
 
 			case Videos:
-				sortProxyModel.setFilterFixedString("Video");
+				sortProxyModel.setFilterValues(QStringList() << "Video");
 
 				break;
 
 			case Images:
-				sortProxyModel.setFilterFixedString("Image");
+				sortProxyModel.setFilterValues(QStringList() << "Image");
 
 				break;
 
 			case All:
-				sortProxyModel.setFilterRegExp("(Video|Image|Unknown)");
+				sortProxyModel.setFilterValues(QStringList() << "Video" << "Image" << "Unknown");
 
 				break;
 		}
@@ -206,33 +434,28 @@ void MainWindow::toggleShowHiddenFiles(const bool show)
 	updateInputFileCounter();
 }
 
-void MainWindow::addFile(const QString path)
+void MainWindow::addFile(const QString path, const bool reference)
 {
-	inputFilesModel.add(path);
+	pipeline.add(path, reference);
 
 	updateInputFileCounter();
-
-	QtConcurrent::run([=]() {
-		if (timeToDie)
-			return;
-
-		InputFileItem item(path);
-
-		item.getInfo();
-
-		emit fileInfoAdded(item);
-	});
 }
 
-void MainWindow::addFileInfo(const InputFileItem item)
+void MainWindow::updateVisibleFiles()
 {
-	inputFilesModel.update(item);
+	QTableView *view = ui->inputFilesTableView;
+	int first = view->rowAt(0);
+	int last = view->rowAt(view->viewport()->height() - 1);
+	QStringList paths;
 
-	updateInputFileCounter();
+	if (first >= 0) {
+		if (last < 0)
+			last = sortProxyModel.rowCount() - 1;
 
-	//if (inputFilesModel.rowCount() % 100 == 0) {
-		QtConcurrent::run([=]() {
-			inputFilesModel.getSimilarItems(item);
-		});
-	//}
+		for (int row = first; row <= last; row++)
+			paths.append(inputFilesModel.getPath(sortProxyModel.mapToSource(sortProxyModel.index(row, 0)).row()));
+	}
+
+	pipeline.setVisible(paths);
 }
+
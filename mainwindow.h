@@ -2,9 +2,16 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <QSortFilterProxyModel>
+#include <QTimer>
 
+#include <closestpairs.h>
+#include <duplicategroupsmodel.h>
+#include <fingerprintcache.h>
 #include <inputfilesmodel.h>
+#include <inputfilesproxymodel.h>
+#include <pairstore.h>
+#include <scanpipeline.h>
+#include <thumbnailstore.h>
 
 namespace Ui {
 	class MainWindow;
@@ -12,6 +19,7 @@ namespace Ui {
 
 class InputFilesModel;
 class QItemSelection;
+class QLabel;
 class Preferences;
 
 class MainWindow: public QMainWindow
@@ -27,28 +35,52 @@ class MainWindow: public QMainWindow
 		Ui::MainWindow *ui;
 		Preferences *prefs;
 		InputFilesModel inputFilesModel;
-		QSortFilterProxyModel sortProxyModel;
+		InputFilesProxyModel sortProxyModel;
+		DuplicateGroupsModel duplicateGroupsModel;
+		ThumbnailStore thumbnailStore;
+		FingerprintCache fingerprintCache;
+		ClosestPairs closestPairs;
+		QTimer closestPairsTimer;
+		PairStore pairStore;
+		int similarityThreshold;
+		ScanPipeline pipeline;
+		QTimer visibleFilesTimer;
+		QLabel *concurrencyLabel;
 		bool timeToDie;
+		// Set to stop the verification that's running, if any.
+		CancelToken verification;
 		QString addFilesDialogTitle;
 
+		void stopVerification();
+		void findFiles(const QString path, const bool reference = false);
+
 	signals:
-		void fileAdded(QString path);
-		void fileInfoAdded(InputFileItem item);
+		void fileAdded(QString path, bool reference);
+		void duplicatesVerified(const QStringList paths, const QVector<QStringList> identical);
+		void verificationFinished();
 
 	public slots:
 		void inputFileSelectionChanged(const QItemSelection &selected, const QItemSelection &deselected);
 		void addFiles();
 		void addDir();
+		void addLibrary();
 		void removeFiles();
 		void clearFiles();
 		void showPreferences();
+		void saveTrace();
+		void verifyDuplicates();
 		void updateInputFileCounter();
 
 	private slots:
-		void addFile(const QString path);
-		void addFileInfo(const InputFileItem item);
+		void addFile(const QString path, const bool reference);
+		void addVerification(const QStringList paths, const QVector<QStringList> identical);
+		void finishVerification();
+		void scheduleClosestPairsUpdate();
+		void updateClosestPairs();
 		void applyPreferences();
 		void toggleShowHiddenFiles(const bool show);
+		void updateVisibleFiles();
+		void updateConcurrencyLabel();
 };
 
 #endif // MAINWINDOW_H
@@ -2,44 +2,143 @@ extern "C" {
 	#include <libavcodec/avcodec.h>
 	#include <libavformat/avformat.h>
 	#include <libavutil/avutil.h>
+	#include <libavutil/channel_layout.h>
 	#include <libavutil/imgutils.h>
+	#include <libavutil/time.h>
+	#include <libswresample/swresample.h>
 	#include <libswscale/swscale.h>
 }
 
+#include <algorithm>
+#include <cmath>
+
+#include "archivereader.h"
+#include "lumascaler.h"
 #include "mediautility.h"
+#include "tracer.h"
+
+/*
+ * Audio fingerprints follow Haitsma & Kalker: the mono signal at a low sample rate
+ * is split into overlapping frames, the energy of each frame is measured in log
+ * spaced bands, and each bit is the sign of the energy difference between
+ * neighbouring bands, compared with the previous frame.
+ */
+static const int AUDIO_SAMPLE_RATE = 5512;
+static const int AUDIO_FRAME_SIZE = 512;
+static const int AUDIO_FRAME_HOP = 256;
+static const int AUDIO_FRAMES = 5;
+static const int AUDIO_BANDS = 33;
+static const int AUDIO_WINDOW_SIZE = AUDIO_FRAME_SIZE + (AUDIO_FRAMES - 1) * AUDIO_FRAME_HOP;
+static const double AUDIO_MIN_FREQUENCY = 300.0;
+static const double AUDIO_MAX_FREQUENCY = 2000.0;
+
+static_assert((AUDIO_FRAMES - 1) * (AUDIO_BANDS - 1) / 8 == 16, "Audio sample fingerprint size doesn't match the frame and band counts");
+
+struct AudioTables {
+	float window[AUDIO_FRAME_SIZE];
+	float cosine[AUDIO_FRAME_SIZE];
+	float sine[AUDIO_FRAME_SIZE];
+	int bandEdges[AUDIO_BANDS + 1];
+
+	AudioTables() {
+		for (int n = 0; n < AUDIO_FRAME_SIZE; n++) {
+			window[n] = static_cast<float>(0.5 - 0.5 * cos(2 * M_PI * n / (AUDIO_FRAME_SIZE - 1)));
+			cosine[n] = static_cast<float>(cos(2 * M_PI * n / AUDIO_FRAME_SIZE));
+			sine[n] = static_cast<float>(sin(2 * M_PI * n / AUDIO_FRAME_SIZE));
+		}
+
+		double binWidth = double(AUDIO_SAMPLE_RATE) / AUDIO_FRAME_SIZE;
+
+		for (int band = 0; band <= AUDIO_BANDS; band++) {
+			double frequency = AUDIO_MIN_FREQUENCY * pow(AUDIO_MAX_FREQUENCY / AUDIO_MIN_FREQUENCY, double(band) / AUDIO_BANDS);
+
+			bandEdges[band] = static_cast<int>(lround(frequency / binWidth));
+
+			// The lowest bands are narrower than a bin, make sure each gets one.
+			if (band > 0 && bandEdges[band] <= bandEdges[band - 1])
+				bandEdges[band] = bandEdges[band - 1] + 1;
+		}
+	}
+};
+
+static const AudioTables &audioTables()
+{
+	static const AudioTables tables;
 
-const size_t MediaUtility::FRAME_FINGERPRINT_SIZE = 8;
-const size_t MediaUtility::TWO_WAY_FRAME_FINGERPRINT_SIZE = MediaUtility::FRAME_FINGERPRINT_SIZE * 2;
-const size_t MediaUtility::NUM_FINGERPRINT_FRAMES = 10;
-const size_t MediaUtility::FINGERPRINT_SIZE = MediaUtility::TWO_WAY_FRAME_FINGERPRINT_SIZE * MediaUtility::NUM_FINGERPRINT_FRAMES;
-const size_t MediaUtility::BUFFER_SIZE_GREY_FRAME_9x8 = av_image_get_buffer_size(AV_PIX_FMT_GRAY8, 9, 8, 1) * static_cast<int>(sizeof(uint8_t));
-const size_t MediaUtility::BUFFER_SIZE_GREY_FRAME_8x9 = av_image_get_buffer_size(AV_PIX_FMT_GRAY8, 8, 9, 1) * static_cast<int>(sizeof(uint8_t));
+	return tables;
+}
+
+const uint32_t MediaUtility::ALL_SAMPLES = ~0u;
+// Enough for the headers of nearly every container, probes don't need to read further.
+const int64_t MediaUtility::PROBE_SIZE = 1 << 20;
+// Longest side of a thumbnail, enough for a list icon while staying a few kB once compressed.
+const int MediaUtility::THUMBNAIL_SIZE = 64;
+const int MediaUtility::ARCHIVE_BUFFER_SIZE = 64 * 1024;
+static const int64_t DECODER_MEMORY_OVERHEAD = 16 << 20;
+const size_t MediaUtility::AUDIO_SAMPLE_FINGERPRINT_SIZE;
 
 MediaUtility::MediaUtility(const char *path)
 {
 	this->path = strdup(path);
 	position = 0.0;
     avFormatContext = nullptr;
+	avioContext = nullptr;
+	archive = nullptr;
     avCodecContext = nullptr;
+	avAudioCodecContext = nullptr;
+	swrContext = nullptr;
 	avVideoStreamIndex = -1;
+	avAudioStreamIndex = -1;
+	audioFingerprint = nullptr;
+	audioSampleMask = 0;
+	thumbnail = nullptr;
+	thumbnailWidth = 0;
+	thumbnailHeight = 0;
 	mediaType = MEDIA_TYPE_UNKNOWN;
+	engine = FINGERPRINT_ENGINE_DHASH;
+	profile = FINGERPRINT_PROFILE_DEFAULT;
     fingerprint = nullptr;
-    swsContext9x8 = nullptr;
-    swsContext8x9 = nullptr;
+	sampleMask = 0;
+	fullSampleMask = 0;
+    swsContext = nullptr;
+	timeBudget = 0;
+	byteBudget = 0;
+	deadline = 0;
+	budgetExceeded = false;
+	cancelled = nullptr;
 }
 
 MediaUtility::~MediaUtility()
 {
 	avcodec_free_context(&avCodecContext);
+	avcodec_free_context(&avAudioCodecContext);
+	swr_free(&swrContext);
+	sws_freeContext(swsContext);
 	avformat_close_input(&avFormatContext);
 
+	// FFmpeg leaves our own I/O context alone, and may have swapped its buffer for another.
+	if (avioContext) {
+		av_freep(&avioContext->buffer);
+		avio_context_free(&avioContext);
+	}
+
+	delete archive;
+
 	free(fingerprint);
+	free(audioFingerprint);
+	free(thumbnail);
 	free(path);
 
     fingerprint = nullptr;
     path = nullptr;
 }
 
+// The soundtrack is sampled at the same positions as the pictures.
+size_t MediaUtility::getAudioFingerprintSize(const FINGERPRINT_PROFILE profile)
+{
+	return AUDIO_SAMPLE_FINGERPRINT_SIZE * static_cast<size_t>(FingerprintProfile::get(profile).samples);
+}
+
 const char *MediaUtility::getError(const int errNum) {
 
 	av_strerror(errNum, error, AV_ERROR_MAX_STRING_SIZE);
@@ -47,24 +146,158 @@ const char *MediaUtility::getError(const int errNum) {
 	return error;
 }
 
-int MediaUtility::open() {
+void MediaUtility::setBudget(const int64_t milliseconds, const int64_t bytes)
+{
+	timeBudget = milliseconds;
+	byteBudget = bytes;
+}
+
+int MediaUtility::interruptCallback(void *opaque)
+{
+	return static_cast<MediaUtility *>(opaque)->isInterrupted();
+}
+
+int MediaUtility::readArchive(void *opaque, uint8_t *buffer, int size)
+{
+	int ret = static_cast<ArchiveReader *>(opaque)->read(buffer, size);
+
+	return ret == 0 ? AVERROR_EOF : (ret < 0 ? AVERROR(-ret) : ret);
+}
+
+int64_t MediaUtility::seekArchive(void *opaque, int64_t offset, int whence)
+{
+	ArchiveReader *archive = static_cast<ArchiveReader *>(opaque);
+
+	if (whence & AVSEEK_SIZE)
+		return archive->getSize();
+
+	int64_t ret = archive->seek(offset, whence & ~AVSEEK_FORCE);
+
+	return ret < 0 ? AVERROR(-ret) : ret;
+}
+
+bool MediaUtility::isOverBudget()
+{
+	if (budgetExceeded)
+		return true;
+
+	if (timeBudget > 0 && av_gettime_relative() > deadline)
+		budgetExceeded = true;
+
+	else if (byteBudget > 0 && avFormatContext && avFormatContext->pb && avFormatContext->pb->bytes_read > byteBudget)
+		budgetExceeded = true;
+
+	return budgetExceeded;
+}
+
+bool MediaUtility::isInterrupted()
+{
+	return isCancelled() || isOverBudget();
+}
+
+/*
+ * Opens the container and finds the video stream. With a probeSize only that many
+ * bytes are read to work out the format, and the streams are only analysed (which
+ * can mean decoding) if the headers don't already say what they contain.
+ */
+int MediaUtility::openInput(const int64_t probeSize, AVCodec **avCodec)
+{
 	int ret = 0;
-    AVCodec *avCodec = nullptr;
+	AVDictionary *options = nullptr;
+
 	avFormatContext = avformat_alloc_context();
 
-    if ((ret = avformat_open_input(&avFormatContext, path, nullptr, nullptr)) != 0) {
+	// FFmpeg polls this during blocking I/O and probing, which is where damaged files stall.
+	deadline = av_gettime_relative() + timeBudget * 1000;
+	avFormatContext->interrupt_callback.callback = interruptCallback;
+	avFormatContext->interrupt_callback.opaque = this;
+
+	// Members of archives are read in place, through an I/O context of our own.
+	if (ArchiveReader::isMemberPath(path)) {
+		uint8_t *buffer = nullptr;
+
+		archive = new ArchiveReader();
+
+		if ((ret = archive->open(path)) < 0)
+			return AVERROR(-ret);
+
+		if (!(buffer = static_cast<uint8_t *>(av_malloc(ARCHIVE_BUFFER_SIZE))))
+			return AVERROR(ENOMEM);
+
+		if (!(avioContext = avio_alloc_context(buffer, ARCHIVE_BUFFER_SIZE, 0, archive, readArchive, nullptr, seekArchive))) {
+			av_free(buffer);
+
+			return AVERROR(ENOMEM);
+		}
+
+		avFormatContext->pb = avioContext;
+		avFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+
+	if (probeSize > 0) {
+		av_dict_set_int(&options, "probesize", probeSize, 0);
+		av_dict_set_int(&options, "analyzeduration", 0, 0);
+	}
+
+	{
+		TRACE_SPAN("open");
+
+		ret = avformat_open_input(&avFormatContext, path, nullptr, &options);
+	}
+
+	av_dict_free(&options);
+
+	if (ret != 0)
 		return ret;
+
+	if (probeSize <= 0 || !hasStreamParameters()) {
+		TRACE_SPAN("probe");
+
+		if ((ret = avformat_find_stream_info(avFormatContext, nullptr)) < 0)
+			return ret;
 	}
 
-    if ((ret = avformat_find_stream_info(avFormatContext, nullptr)) < 0) {
+	if ((ret = av_find_best_stream(avFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, avCodec, 0)) < 0)
 		return ret;
+
+	avVideoStreamIndex = ret;
+
+	return 0;
+}
+
+bool MediaUtility::hasStreamParameters() const
+{
+	for (unsigned int i = 0; i < avFormatContext->nb_streams; i++) {
+		const AVCodecParameters *parameters = avFormatContext->streams[i]->codecpar;
+
+		if (parameters->codec_type == AVMEDIA_TYPE_VIDEO && (parameters->codec_id == AV_CODEC_ID_NONE || !parameters->width || !parameters->height))
+			return false;
 	}
 
-	if ((ret = av_find_best_stream(avFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &avCodec, 0)) < 0) {
+	return true;
+}
+
+int MediaUtility::probe(const int64_t probeSize)
+{
+	int ret = 0;
+
+	if ((ret = openInput(probeSize, nullptr)) < 0)
+		return isInterrupted() ? AVERROR_EXIT : ret;
+
+	// Without decoding a frame, a stream without a duration is the best hint we have of an image.
+	mediaType = avFormatContext->duration == AV_NOPTS_VALUE ? MEDIA_TYPE_IMAGE : MEDIA_TYPE_VIDEO;
+
+	return 0;
+}
+
+int MediaUtility::open(const uint32_t samples, const bool audioFirst) {
+	int ret = 0;
+    AVCodec *avCodec = nullptr;
+
+	if ((ret = openInput(0, &avCodec)) < 0) {
 		return ret;
 	}
 
-	avVideoStreamIndex = ret;
 	avCodecContext = avcodec_alloc_context3(avCodec);
 
 	if ((ret = avcodec_parameters_to_context(avCodecContext, avFormatContext->streams[avVideoStreamIndex]->codecpar)) < 0) {
@@ -90,9 +323,17 @@ int MediaUtility::open() {
 
 		seek(0.0);
 
-		computeFingerprint();
+		fullSampleMask = getNumSamples() == 1 ? 1u : FingerprintProfile::get(profile).getAllSamples();
+
+		// Audio is much cheaper to decode, so if asked we only fingerprint that for now
+		// and leave it to the caller to come back for the video if it's needed.
+		if (!(audioFirst && mediaType == MEDIA_TYPE_VIDEO && openAudio() >= 0 && computeAudioFingerprint() >= 0))
+			computeFingerprint(samples);
 	}
 
+	if (budgetExceeded || isCancelled())
+		return AVERROR_EXIT;
+
 	return ret;
 }
 
@@ -104,19 +345,20 @@ double MediaUtility::getDuration() const {
 	return double(avFormatContext->duration) / AV_TIME_BASE;
 }
 
+// These come from the stream rather than the decoder, so they also work after probe().
 int MediaUtility::getWidth() const
 {
-	return avCodecContext->width;
+	return avFormatContext->streams[avVideoStreamIndex]->codecpar->width;
 }
 
 int MediaUtility::getHeight() const
 {
-	return avCodecContext->height;
+	return avFormatContext->streams[avVideoStreamIndex]->codecpar->height;
 }
 
 const char *MediaUtility::getCodec() const
 {
-	return avCodecContext->codec->name;
+	return avcodec_get_name(avFormatContext->streams[avVideoStreamIndex]->codecpar->codec_id);
 }
 
 const char *MediaUtility::getContainer() const
@@ -124,11 +366,87 @@ const char *MediaUtility::getContainer() const
 	return avFormatContext->iformat->long_name;
 }
 
-int MediaUtility::computeFingerprint()
+/*
+ * Rough peak memory of decoding the video stream, from what the headers say:
+ * the frames the decoder keeps for reference, the two readFrame() holds, one
+ * more for swscale's buffers, and an allowance for the codec context and packets.
+ */
+int64_t MediaUtility::getMemoryEstimate() const
+{
+	const AVCodecParameters *parameters = avFormatContext->streams[avVideoStreamIndex]->codecpar;
+	int64_t frameSize = av_image_get_buffer_size(static_cast<AVPixelFormat>(parameters->format), parameters->width, parameters->height, 1);
+	int64_t references = 4;
+
+	// Not known until a frame is decoded, so assume 16 bit RGBA rather than risk too little.
+	if (frameSize <= 0)
+		frameSize = static_cast<int64_t>(std::max(parameters->width, 1)) * std::max(parameters->height, 1) * 8;
+
+	switch (parameters->codec_id) {
+		case AV_CODEC_ID_H264:
+		case AV_CODEC_ID_HEVC:
+			references = 16;
+
+			break;
+
+		case AV_CODEC_ID_VP9:
+		case AV_CODEC_ID_AV1:
+			references = 8;
+
+			break;
+
+		default:
+			if (mediaType == MEDIA_TYPE_IMAGE)
+				references = 0;
+
+			break;
+	}
+
+	return DECODER_MEMORY_OVERHEAD + frameSize * (references + 3);
+}
+
+int MediaUtility::getNumSamples() const
+{
+	// If this is an image or a really short video, just get one frame.
+	if (mediaType == MEDIA_TYPE_IMAGE || getDuration() == 0.0)
+		return 1;
+
+	return FingerprintProfile::get(profile).samples;
+}
+
+double MediaUtility::getSamplePosition(const int index) const
+{
+	double duration = getDuration();
+	int samples = FingerprintProfile::get(profile).samples;
+
+	if (index == samples - 1)
+		return duration;
+
+	return duration / (samples - 1) * index;
+}
+
+int MediaUtility::computeFingerprint(const uint32_t samples)
+{
+	switch (engine) {
+		case FINGERPRINT_ENGINE_PHASH:
+			return computeFingerprint<PHashEngine>(samples);
+
+		case FINGERPRINT_ENGINE_PHASH_16:
+			return computeFingerprint<PHash16Engine>(samples);
+
+		case FINGERPRINT_ENGINE_DHASH:
+		default:
+			return computeFingerprint<DHashEngine>(samples);
+	}
+}
+
+template <typename Engine>
+int MediaUtility::computeFingerprint(const uint32_t samples)
 {
 	/*
-	 * We take 10 frames from the file, 1 at the start, 8 at evenly spaced intervals,
-	 * and one at the end of the file.
+	 * We take as many frames as the profile asks for, one at the start, one at the
+	 * end of the file and the rest evenly spaced in between. Only the frames in
+	 * samples are decoded, which lets a cheap subset be taken first and the rest
+	 * filled in later.
 	 */
 	double duration = getDuration();
 
@@ -138,40 +456,26 @@ int MediaUtility::computeFingerprint()
 	int ret = 0;
 	double pos = 0;
     AVFrame *frame = nullptr;
-	fingerprint = (uint8_t *)calloc(FINGERPRINT_SIZE, 1);
-
-	if (!swsContext9x8 && !(swsContext9x8 = sws_getContext(avCodecContext->width,
-														   avCodecContext->height,
-														   avCodecContext->pix_fmt,
-														   9,
-														   8,
-														   AV_PIX_FMT_GRAY8,
-														   0,
-                                                           nullptr,
-                                                           nullptr,
-                                                           nullptr)))
-		return AVERROR_INVALIDDATA;
 
-	if (!swsContext8x9 && !(swsContext8x9 = sws_getContext(avCodecContext->width,
-														   avCodecContext->height,
-														   avCodecContext->pix_fmt,
-														   8,
-														   9,
-														   AV_PIX_FMT_GRAY8,
-														   0,
-                                                           nullptr,
-                                                           nullptr,
-                                                           nullptr)))
-		return AVERROR_INVALIDDATA;
+	if (!fingerprint)
+		fingerprint = (uint8_t *)calloc(FingerprintProfile::get(profile).getFingerprintSize(Engine::ID), 1);
 
-	int numFrames = NUM_FINGERPRINT_FRAMES;
+	int numFrames = getNumSamples();
 
-	// If this is an image or a really short video, just get one frame.
-	if (mediaType == MEDIA_TYPE_IMAGE || duration == 0.0)
-		numFrames = 1;
+	// A single frame is all there is, so any request gets it.
+	uint32_t wanted = numFrames == 1 ? (samples ? 1u : 0u) : (samples & fullSampleMask);
 
 	for (int i = 0; i < numFrames; i++) {
-		i == NUM_FINGERPRINT_FRAMES - 1 ? pos = duration : pos = duration / (NUM_FINGERPRINT_FRAMES - 1) * i;
+		if (!(wanted & (1u << i)))
+			continue;
+
+		if (isInterrupted()) {
+			ret = AVERROR_EXIT;
+
+			break;
+		}
+
+		pos = getSamplePosition(i);
 
 		if ((ret = seek(pos)) < 0)
 			break;
@@ -182,16 +486,25 @@ int MediaUtility::computeFingerprint()
 			break;
 		}
 
-		computeFrameFingerprint(frame, fingerprint + (16 * i), GREY_FRAME_TYPE_9x8);
-		computeFrameFingerprint(frame, fingerprint + (16 * i) + 8, GREY_FRAME_TYPE_8x9);
+		ret = computeFrameFingerprint<Engine>(frame, fingerprint + Engine::SAMPLE_SIZE * i);
+
+		// The frame is already decoded, so a preview only costs one small scale.
+		if (ret >= 0 && i == getThumbnailSample())
+			captureThumbnail(frame);
 
 		av_frame_free(&frame);
+
+		if (ret < 0)
+			break;
+
+		sampleMask |= 1u << i;
 	}
 
 	if (ret < 0) {
 		free(fingerprint);
 
         fingerprint = nullptr;
+		sampleMask = 0;
 	}
 
 	seek(0.0);
@@ -199,131 +512,281 @@ int MediaUtility::computeFingerprint()
 	return ret;
 }
 
-int MediaUtility::computeFrameFingerprint(const AVFrame *frame, uint8_t *frameFingerprint, const GREY_FRAME_TYPE frameType) const
+template <typename Engine>
+int MediaUtility::computeFrameFingerprint(const AVFrame *frame, uint8_t *frameFingerprint)
 {
-	AVFrame *greyFrame = av_frame_alloc();
-    uint8_t *buffer = nullptr;
-	int xStart = 0;
-	int yStart = 0;
+	uint8_t pixels[Engine::WIDTH * Engine::HEIGHT];
+	LumaScaler scaler = getLumaScaler(frame->format);
 	int ret = 0;
-	uint8_t pixel = 0;
-	uint8_t comparisonPixel = 0;
-    SwsContext *swsContext = nullptr;
-
-	switch (frameType) {
-		case GREY_FRAME_TYPE_9x8:
-            buffer = static_cast<uint8_t *>(av_malloc(BUFFER_SIZE_GREY_FRAME_9x8));
-			greyFrame->width = 9;
-			greyFrame->height = 8;
-			xStart = 1;
-			swsContext = swsContext9x8;
 
-			break;
+	{
+		TRACE_SPAN("scale");
 
-		case GREY_FRAME_TYPE_8x9:
-            buffer = static_cast<uint8_t *>(av_malloc(BUFFER_SIZE_GREY_FRAME_8x9));
-			greyFrame->width = 8;
-			greyFrame->height = 9;
-			yStart = 1;
-			swsContext = swsContext8x9;
+		// Common YUV formats only need their luma plane averaged down, anything else goes through swscale.
+		if (scaler && Engine::WIDTH <= LUMA_SCALER_MAX_WIDTH && frame->width >= Engine::WIDTH && frame->height >= Engine::HEIGHT) {
+			scaler(frame->data[0], frame->linesize[0], frame->width, frame->height, pixels, Engine::WIDTH, Engine::HEIGHT);
+		} else {
+			uint8_t *data[4] = { pixels, nullptr, nullptr, nullptr };
+			int linesize[4] = { Engine::WIDTH, 0, 0, 0 };
+
+			if (!swsContext && !(swsContext = sws_getContext(avCodecContext->width,
+															 avCodecContext->height,
+															 avCodecContext->pix_fmt,
+															 Engine::WIDTH,
+															 Engine::HEIGHT,
+															 AV_PIX_FMT_GRAY8,
+															 0,
+															 nullptr,
+															 nullptr,
+															 nullptr)))
+				return AVERROR_INVALIDDATA;
+
+			if ((ret = sws_scale(swsContext,
+								 (uint8_t const *const *)frame->data,
+								 frame->linesize,
+								 0,
+								 avCodecContext->height,
+								 data,
+								 linesize)) < 0)
+				return ret;
+		}
+	}
 
-			break;
+	{
+		TRACE_SPAN("hash");
+
+		Engine::compute(pixels, Engine::WIDTH, frameFingerprint);
 	}
 
-	if ((ret = av_image_fill_arrays(greyFrame->data,
-									greyFrame->linesize,
-									buffer,
-									AV_PIX_FMT_GRAY8,
-									greyFrame->width,
-									greyFrame->height,
-									1)) < 0) {
-		av_frame_free(&greyFrame);
-		av_freep(&buffer);
+	return static_cast<int>(Engine::SAMPLE_SIZE);
+}
+
+int MediaUtility::openAudio()
+{
+	int ret = 0;
+	AVCodec *avCodec = nullptr;
 
+	if ((ret = av_find_best_stream(avFormatContext, AVMEDIA_TYPE_AUDIO, -1, avVideoStreamIndex, &avCodec, 0)) < 0)
 		return ret;
-	}
 
-	if ((ret = sws_scale(swsContext,
-						 (uint8_t const *const *)frame->data,
-						 frame->linesize,
-						 0,
-						 avCodecContext->height,
-						 greyFrame->data,
-						 greyFrame->linesize)) < 0) {
-		av_frame_free(&greyFrame);
-		av_freep(&buffer);
+	avAudioStreamIndex = ret;
+	avAudioCodecContext = avcodec_alloc_context3(avCodec);
+
+	if ((ret = avcodec_parameters_to_context(avAudioCodecContext, avFormatContext->streams[avAudioStreamIndex]->codecpar)) < 0)
+		return ret;
 
+	if ((ret = avcodec_open2(avAudioCodecContext, avCodec, nullptr)) < 0)
 		return ret;
+
+	int64_t channelLayout = avAudioCodecContext->channel_layout;
+
+	if (!channelLayout)
+		channelLayout = av_get_default_channel_layout(avAudioCodecContext->channels);
+
+	if (!(swrContext = swr_alloc_set_opts(nullptr,
+										  AV_CH_LAYOUT_MONO,
+										  AV_SAMPLE_FMT_FLT,
+										  AUDIO_SAMPLE_RATE,
+										  channelLayout,
+										  avAudioCodecContext->sample_fmt,
+										  avAudioCodecContext->sample_rate,
+										  0,
+										  nullptr)))
+		return AVERROR(ENOMEM);
+
+	return swr_init(swrContext);
+}
+
+int MediaUtility::computeAudioFingerprint()
+{
+	// Same positions as the video samples, pulled back so the last window fits.
+	double windowLength = double(AUDIO_WINDOW_SIZE) / AUDIO_SAMPLE_RATE;
+	float samples[AUDIO_WINDOW_SIZE];
+
+	if (!audioFingerprint)
+		audioFingerprint = (uint8_t *)calloc(getAudioFingerprintSize(profile), 1);
+
+	for (int i = 0; i < getNumSamples(); i++) {
+		if (isInterrupted())
+			break;
+
+		double pos = std::max(0.0, std::min(getSamplePosition(i), getDuration() - windowLength));
+
+		// A sample we can't read (usually a short track) just isn't compared.
+		if (readAudio(pos, samples, AUDIO_WINDOW_SIZE) < 0)
+			continue;
+
+		computeAudioSampleFingerprint(samples, audioFingerprint + AUDIO_SAMPLE_FINGERPRINT_SIZE * i);
+
+		audioSampleMask |= 1u << i;
 	}
 
-	int byte = 0;
-	int bit = 0;
+	if (isInterrupted() || !audioSampleMask) {
+		free(audioFingerprint);
 
-	for (int y = yStart; y < greyFrame->height; y++) {
-		bit = 0;
+		audioFingerprint = nullptr;
+		audioSampleMask = 0;
 
-		for (int x = xStart; x < greyFrame->width; x++) {
-			pixel = *(greyFrame->data[0] + (y * greyFrame->width) + x);
-			comparisonPixel = *(greyFrame->data[0] + ((y - yStart) * greyFrame->width) + (x - xStart));
+		return isInterrupted() ? AVERROR_EXIT : AVERROR_INVALIDDATA;
+	}
 
-			if (pixel > comparisonPixel)
-				frameFingerprint[byte] |= (1 << (7 - bit));
+	return 0;
+}
 
-			bit++;
+int MediaUtility::readAudio(const double seconds, float *samples, const int count)
+{
+	AVStream *stream = avFormatContext->streams[avAudioStreamIndex];
+	double timeBase = av_q2d(stream->time_base);
+	AVPacket avPacket;
+	AVFrame *avFrame = nullptr;
+	int collected = 0;
+	int ret = 0;
+
+	TRACE_SPAN("decode audio");
+
+	avcodec_flush_buffers(avAudioCodecContext);
+
+	if ((ret = av_seek_frame(avFormatContext, avAudioStreamIndex, static_cast<int64_t>(seconds / timeBase), AVSEEK_FLAG_BACKWARD)) < 0)
+		return ret;
+
+	// Throw away anything the resampler buffered from before the seek.
+	if ((ret = swr_init(swrContext)) < 0)
+		return ret;
+
+	avFrame = av_frame_alloc();
+
+	av_init_packet(&avPacket);
+    avPacket.data = nullptr;
+	avPacket.size = 0;
+
+	while (collected < count && !isInterrupted() && av_read_frame(avFormatContext, &avPacket) >= 0) {
+		if (avPacket.stream_index != avAudioStreamIndex || avcodec_send_packet(avAudioCodecContext, &avPacket) < 0) {
+			av_packet_unref(&avPacket);
+
+			continue;
 		}
 
-		byte++;
+		av_packet_unref(&avPacket);
+
+		while (collected < count && avcodec_receive_frame(avAudioCodecContext, avFrame) >= 0) {
+			uint8_t *out = reinterpret_cast<uint8_t *>(samples + collected);
+			int converted = swr_convert(swrContext, &out, count - collected, const_cast<const uint8_t **>(avFrame->extended_data), avFrame->nb_samples);
+			int skip = 0;
+
+			if (converted <= 0)
+				continue;
+
+			// The seek lands on the packet before our position, drop the samples in between.
+			if (avFrame->best_effort_timestamp != AV_NOPTS_VALUE && avFrame->best_effort_timestamp * timeBase < seconds)
+				skip = std::min(converted, static_cast<int>((seconds - avFrame->best_effort_timestamp * timeBase) * AUDIO_SAMPLE_RATE));
+
+			memmove(samples + collected, samples + collected + skip, sizeof(float) * static_cast<size_t>(converted - skip));
+
+			collected += converted - skip;
+		}
+	}
+
+	av_packet_unref(&avPacket);
+	av_frame_free(&avFrame);
+
+	return collected < count ? AVERROR_EOF : 0;
+}
+
+void MediaUtility::computeAudioSampleFingerprint(const float *samples, uint8_t *sampleFingerprint) const
+{
+	const AudioTables &tables = audioTables();
+	double energy[AUDIO_FRAMES][AUDIO_BANDS];
+	float frame[AUDIO_FRAME_SIZE];
+
+	// Only the bins inside our bands are needed, so a direct DFT over those is cheap enough.
+	for (int f = 0; f < AUDIO_FRAMES; f++) {
+		for (int n = 0; n < AUDIO_FRAME_SIZE; n++)
+			frame[n] = samples[f * AUDIO_FRAME_HOP + n] * tables.window[n];
+
+		for (int band = 0; band < AUDIO_BANDS; band++) {
+			energy[f][band] = 0.0;
+
+			for (int bin = tables.bandEdges[band]; bin < tables.bandEdges[band + 1]; bin++) {
+				float real = 0.0f;
+				float imaginary = 0.0f;
+
+				for (int n = 0; n < AUDIO_FRAME_SIZE; n++) {
+					int index = (bin * n) % AUDIO_FRAME_SIZE;
+
+					real += frame[n] * tables.cosine[index];
+					imaginary -= frame[n] * tables.sine[index];
+				}
+
+				energy[f][band] += double(real) * real + double(imaginary) * imaginary;
+			}
+		}
 	}
 
-	av_frame_free(&greyFrame);
-	av_freep(&buffer);
+	int bit = 0;
 
-	return FRAME_FINGERPRINT_SIZE;
+	for (int f = 1; f < AUDIO_FRAMES; f++) {
+		for (int band = 0; band < AUDIO_BANDS - 1; band++, bit++) {
+			double difference = (energy[f][band] - energy[f][band + 1]) - (energy[f - 1][band] - energy[f - 1][band + 1]);
+
+			if (difference > 0)
+				sampleFingerprint[bit / 8] |= (1 << (7 - bit % 8));
+		}
+	}
 }
 
-void MediaUtility::save(AVFrame *frame, int index)
+// The middle sample is the least likely to be a title card or a fade to black.
+int MediaUtility::getThumbnailSample() const
 {
-	SwsContext *swsContext = sws_getContext(avCodecContext->width,
-				 avCodecContext->height,
-				 avCodecContext->pix_fmt,
-				 64,
-				 64,
-				 AV_PIX_FMT_GRAY8,
-				 0,
-                 nullptr,
-                 nullptr,
-                 nullptr
-				 );
+	return getNumSamples() == 1 ? 0 : getNumSamples() / 2 - 1;
+}
 
-	AVFrame *greyFrame = av_frame_alloc();
+int MediaUtility::captureThumbnail(const AVFrame *frame)
+{
+	int width = frame->width;
+	int height = frame->height;
 
-    size_t numBytes = static_cast<size_t>(av_image_get_buffer_size(AV_PIX_FMT_GRAY8, 64, 64, 1));
-    uint8_t *buffer = static_cast<uint8_t *>(av_malloc(numBytes * sizeof(uint8_t)));
+	if (width <= 0 || height <= 0)
+		return AVERROR_INVALIDDATA;
 
-	av_image_fill_arrays(greyFrame->data, greyFrame->linesize, buffer, AV_PIX_FMT_GRAY8, 64, 64, 1);
+	if (width >= height) {
+		thumbnailWidth = std::min(width, THUMBNAIL_SIZE);
+		thumbnailHeight = std::max(1, static_cast<int>(int64_t(height) * thumbnailWidth / width));
+	} else {
+		thumbnailHeight = std::min(height, THUMBNAIL_SIZE);
+		thumbnailWidth = std::max(1, static_cast<int>(int64_t(width) * thumbnailHeight / height));
+	}
 
-	sws_scale(swsContext, (uint8_t const * const *)frame->data,
-		  frame->linesize, 0, avCodecContext->height,
-		  greyFrame->data, greyFrame->linesize);
+	SwsContext *thumbnailContext = sws_getContext(width,
+												  height,
+												  static_cast<AVPixelFormat>(frame->format),
+												  thumbnailWidth,
+												  thumbnailHeight,
+												  AV_PIX_FMT_RGB24,
+												  SWS_AREA,
+												  nullptr,
+												  nullptr,
+												  nullptr);
+
+	if (!thumbnailContext)
+		return AVERROR_INVALIDDATA;
 
-	FILE *pFile;
-	char szFilename[32];
+	free(thumbnail);
 
-	// Open file
-	sprintf(szFilename, "/home/simon/frame%d.ppm", index);
-	pFile=fopen(szFilename, "wb");
+	thumbnail = (uint8_t *)malloc(static_cast<size_t>(thumbnailWidth * thumbnailHeight * 3));
 
-    if(pFile==nullptr)
-		return;
+	uint8_t *data[4] = { thumbnail, nullptr, nullptr, nullptr };
+	int linesize[4] = { thumbnailWidth * 3, 0, 0, 0 };
+	int ret = sws_scale(thumbnailContext, (uint8_t const *const *)frame->data, frame->linesize, 0, height, data, linesize);
 
-	// Write header
-	fprintf(pFile, "P5\n%d %d\n255\n", 64, 64);
+	sws_freeContext(thumbnailContext);
 
-	// Write pixel data
-	fwrite(greyFrame->data[0], 64, 64, pFile);
+	if (ret < 0) {
+		free(thumbnail);
 
-	// Close file
-	fclose(pFile);
+		thumbnail = nullptr;
+	}
+
+	return ret;
 }
 
 int MediaUtility::seek(const double seconds)
@@ -332,6 +795,8 @@ int MediaUtility::seek(const double seconds)
     int64_t timestamp = static_cast<int64_t>(seconds * (static_cast<double>(timeBase.den) / timeBase.num));
 	int ret = 0;
 
+	TRACE_SPAN("seek");
+
 	avcodec_flush_buffers(avCodecContext);
 
 	if ((ret = av_seek_frame(avFormatContext, avVideoStreamIndex, timestamp, AVSEEK_FLAG_BACKWARD)) >= 0)
@@ -349,12 +814,18 @@ AVFrame *MediaUtility::readFrame()
 	int ret = 0;
 	double newPosition = 0;
 
+	TRACE_SPAN("decode");
+
 	av_init_packet(&avPacket);
     avPacket.data = nullptr;
 	avPacket.size = 0;
 
 	// Keep trying to receive a packet until EOF (or unrecoverable error).
 	while ((ret = avcodec_receive_frame(avCodecContext, nextAvFrame)) >= 0 || ret == AVERROR(EAGAIN)) {
+		// Decoding up to a far seek target can take a long time, so give up here too.
+		if (isInterrupted())
+			break;
+
 		// We received a valid frame.
 		if (ret >= 0) {
 			// Swap our next/current frames.
@@ -398,8 +869,8 @@ AVFrame *MediaUtility::readFrame()
 	av_packet_unref(&avPacket);
 	av_frame_free(&nextAvFrame);
 
-    // Doesn't look like there was a frame to decode... return nullptr.
-    if (avFrame->best_effort_timestamp == AV_NOPTS_VALUE)
+    // Doesn't look like there was a frame to decode (or we were interrupted)... return nullptr.
+    if (avFrame->best_effort_timestamp == AV_NOPTS_VALUE || budgetExceeded || isCancelled())
 		av_frame_free(&avFrame);
 
 	return avFrame;
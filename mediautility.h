@@ -1,16 +1,24 @@
 #ifndef MEDIAUTILITY_H
 #define MEDIAUTILITY_H
 
+#include <atomic>
 #include <cstdint>
 
 extern "C" {
 	#include <libavutil/error.h>
 }
 
+#include "fingerprintengine.h"
+#include "fingerprintprofile.h"
+
+class ArchiveReader;
+struct AVCodec;
 struct AVFormatContext;
+struct AVIOContext;
 struct AVCodecContext;
 struct AVFrame;
 struct SwsContext;
+struct SwrContext;
 
 enum MEDIA_TYPE {
 	MEDIA_TYPE_UNKNOWN,
@@ -21,49 +29,96 @@ enum MEDIA_TYPE {
 class MediaUtility
 {
 	public:
-        static const size_t FINGERPRINT_SIZE;
+		static const uint32_t ALL_SAMPLES;
+		static const int64_t PROBE_SIZE;
+		static const int THUMBNAIL_SIZE;
+		static const int ARCHIVE_BUFFER_SIZE;
+		// Needed as a compile time constant for the unrolled comparisons.
+		static const size_t AUDIO_SAMPLE_FINGERPRINT_SIZE = 16;
 
 		MediaUtility(const char *path);
 		~MediaUtility();
 
+		static size_t getAudioFingerprintSize(const FINGERPRINT_PROFILE profile);
+
 		const char *getError(const int errNum);
-		int open();
+		void setBudget(const int64_t milliseconds, const int64_t bytes);
+		bool hasExceededBudget() const { return budgetExceeded; }
+		void setCancelFlag(const std::atomic<bool> *cancelled) { this->cancelled = cancelled; }
+		bool isCancelled() const { return cancelled && cancelled->load(std::memory_order_relaxed); }
+		void setFingerprintEngine(const FINGERPRINT_ENGINE engine) { this->engine = engine; }
+		FINGERPRINT_ENGINE getFingerprintEngine() const { return engine; }
+		void setFingerprintProfile(const FINGERPRINT_PROFILE profile) { this->profile = profile; }
+		FINGERPRINT_PROFILE getFingerprintProfile() const { return profile; }
+		int probe(const int64_t probeSize);
+		int open(const uint32_t samples = ALL_SAMPLES, const bool audioFirst = false);
 		double getDuration() const;
 		int getHeight() const;
 		int getWidth() const;
 		const char *getCodec() const;
 		const char *getContainer() const;
+		int64_t getMemoryEstimate() const;
 		const uint8_t *getFingerprint() const { return fingerprint; }
+		uint32_t getSampleMask() const { return sampleMask; }
+		uint32_t getFullSampleMask() const { return fullSampleMask; }
+		const uint8_t *getAudioFingerprint() const { return audioFingerprint; }
+		uint32_t getAudioSampleMask() const { return audioSampleMask; }
+		// RGB24 with no padding between rows, only there if the middle sample was decoded.
+		const uint8_t *getThumbnail() const { return thumbnail; }
+		int getThumbnailWidth() const { return thumbnailWidth; }
+		int getThumbnailHeight() const { return thumbnailHeight; }
 		MEDIA_TYPE getMediaType() const { return mediaType; }
 
 	private:
-        static const size_t FRAME_FINGERPRINT_SIZE;
-        static const size_t TWO_WAY_FRAME_FINGERPRINT_SIZE;
-        static const size_t NUM_FINGERPRINT_FRAMES;
-        static const size_t BUFFER_SIZE_GREY_FRAME_9x8;
-        static const size_t BUFFER_SIZE_GREY_FRAME_8x9;
-
-		enum GREY_FRAME_TYPE {
-			GREY_FRAME_TYPE_9x8,
-			GREY_FRAME_TYPE_8x9
-		};
-
 		char *path;
 		char error[AV_ERROR_MAX_STRING_SIZE];
 		double position;
+		FINGERPRINT_ENGINE engine;
+		FINGERPRINT_PROFILE profile;
 		uint8_t *fingerprint;
+		uint32_t sampleMask;
+		uint32_t fullSampleMask;
+		uint8_t *audioFingerprint;
+		uint32_t audioSampleMask;
+		uint8_t *thumbnail;
+		int thumbnailWidth;
+		int thumbnailHeight;
 		MEDIA_TYPE mediaType;
 		AVFormatContext *avFormatContext;
+		AVIOContext *avioContext;
+		ArchiveReader *archive;
 		AVCodecContext *avCodecContext;
-		SwsContext *swsContext9x8;
-		SwsContext *swsContext8x9;
+		AVCodecContext *avAudioCodecContext;
+		SwsContext *swsContext;
+		SwrContext *swrContext;
 		int avVideoStreamIndex;
+		int avAudioStreamIndex;
+		int64_t timeBudget;
+		int64_t byteBudget;
+		int64_t deadline;
+		bool budgetExceeded;
+		const std::atomic<bool> *cancelled;
 
-		int computeFingerprint();
+		static int interruptCallback(void *opaque);
+		static int readArchive(void *opaque, uint8_t *buffer, int size);
+		static int64_t seekArchive(void *opaque, int64_t offset, int whence);
+		bool isOverBudget();
+		bool isInterrupted();
+		int openInput(const int64_t probeSize, AVCodec **avCodec);
+		bool hasStreamParameters() const;
+		int getNumSamples() const;
+		double getSamplePosition(const int index) const;
+		int computeFingerprint(const uint32_t samples);
+		template <typename Engine> int computeFingerprint(const uint32_t samples);
+		int openAudio();
+		int computeAudioFingerprint();
+		int readAudio(const double seconds, float *samples, const int count);
+		void computeAudioSampleFingerprint(const float *samples, uint8_t *sampleFingerprint) const;
 		int seek(const double seconds);
 		AVFrame *readFrame();
-		int computeFrameFingerprint(const AVFrame *frame, uint8_t *frameFingerprint, const GREY_FRAME_TYPE) const;
-		void save(AVFrame *frame, int index);
+		template <typename Engine> int computeFrameFingerprint(const AVFrame *frame, uint8_t *frameFingerprint);
+		int getThumbnailSample() const;
+		int captureThumbnail(const AVFrame *frame);
 };
 
 #endif // MEDIAUTILITY_H
@@ -0,0 +1,309 @@
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cstdint>
+
+#include "pairstore.h"
+
+// The similarity slider goes no lower.
+const int PairStore::LOOSEST_THRESHOLD = 25;
+const double PairStore::MAX_DIFFERENCE = (100 - PairStore::LOOSEST_THRESHOLD) / 200.0;
+
+static const quint32 PAIRS_MAGIC = 0x53445052;
+static const quint32 PAIRS_VERSION = 1;
+// Pairs are read and written in pieces, QIODevice only takes an int at a time.
+static const int PAIRS_CHUNK = 1 << 20;
+
+static bool lessThan(const PairStore::Pair &pair, const PairStore::Pair &otherPair)
+{
+	if (pair.distance != otherPair.distance)
+		return pair.distance < otherPair.distance;
+
+	if (pair.id != otherPair.id)
+		return pair.id < otherPair.id;
+
+	return pair.otherId < otherPair.otherId;
+}
+
+// Orders pairs by the files they're between, whichever way round they were found.
+static bool isBefore(const PairStore::Pair &pair, const PairStore::Pair &otherPair)
+{
+	if (qMin(pair.id, pair.otherId) != qMin(otherPair.id, otherPair.otherId))
+		return qMin(pair.id, pair.otherId) < qMin(otherPair.id, otherPair.otherId);
+
+	return qMax(pair.id, pair.otherId) < qMax(otherPair.id, otherPair.otherId);
+}
+
+static bool isSamePair(const PairStore::Pair &pair, const PairStore::Pair &otherPair)
+{
+	return !isBefore(pair, otherPair) && !isBefore(otherPair, pair);
+}
+
+PairStore::PairStore()
+{
+}
+
+void PairStore::add(const InputFileItem &item, const InputFileItem &otherItem, const double distance)
+{
+	QMutexLocker lock(&mutex);
+	Pair pair;
+
+	pair.distance = static_cast<float>(distance);
+	pair.id = getFileId(item);
+	pair.otherId = getFileId(otherItem);
+
+	if (pair.id == pair.otherId)
+		return;
+
+	pending.append(pair);
+}
+
+// For pairs that are only ever found once.
+void PairStore::add(const QVector<Pair> newPairs)
+{
+	QMutexLocker lock(&mutex);
+
+	pending += newPairs;
+}
+
+/*
+ * The pairs within maxDifference, closest first. The paths and sizes of the
+ * files they number are copied out along with them, since more can be added
+ * as soon as the lock is let go.
+ */
+QVector<PairStore::Pair> PairStore::getPairs(const double maxDifference, QVector<QString> *filePaths, QVector<qint64> *fileSizes)
+{
+	QMutexLocker lock(&mutex);
+	Pair limit;
+
+	merge();
+
+	limit.distance = static_cast<float>(maxDifference);
+	limit.id = UINT32_MAX;
+	limit.otherId = UINT32_MAX;
+
+	QVector<Pair>::const_iterator end = std::upper_bound(pairs.constBegin(), pairs.constEnd(), limit, lessThan);
+
+	if (filePaths)
+		*filePaths = paths;
+
+	if (fileSizes)
+		*fileSizes = sizes;
+
+	return pairs.mid(0, static_cast<int>(end - pairs.constBegin()));
+}
+
+/*
+ * At most pairLimit of the closest pairs. With a fileLimit, a pair is left out
+ * once either of its files has that many closer ones. Only as much of the sorted
+ * pairs is walked as that takes.
+ */
+QVector<PairStore::Pair> PairStore::getClosestPairs(const int pairLimit, const int fileLimit, QVector<QString> *filePaths)
+{
+	QMutexLocker lock(&mutex);
+	QHash<quint32, int> counts;
+	QVector<Pair> closest;
+
+	merge();
+
+	for (int i = 0; i < pairs.length() && closest.length() < pairLimit; i++) {
+		const Pair &pair = pairs[i];
+
+		if (fileLimit > 0 && (counts.value(pair.id) >= fileLimit || counts.value(pair.otherId) >= fileLimit))
+			continue;
+
+		counts[pair.id]++;
+		counts[pair.otherId]++;
+		closest.append(pair);
+	}
+
+	if (filePaths)
+		*filePaths = paths;
+
+	return closest;
+}
+
+void PairStore::removeFiles(const QStringList removedPaths)
+{
+	QMutexLocker lock(&mutex);
+	QVector<bool> removed(paths.length(), false);
+	bool found = false;
+
+	foreach (QString path, removedPaths) {
+		QHash<QString, quint32>::iterator id = fileIds.find(path);
+
+		if (id == fileIds.end())
+			continue;
+
+		removed[static_cast<int>(id.value())] = true;
+		paths[static_cast<int>(id.value())].clear();
+		fileIds.erase(id);
+		found = true;
+	}
+
+	if (!found)
+		return;
+
+	// Their ids aren't reused, a file added again is numbered like a new one.
+	auto isRemoved = [&removed](const Pair &pair) {
+		return removed[static_cast<int>(pair.id)] || removed[static_cast<int>(pair.otherId)];
+	};
+
+	pairs.erase(std::remove_if(pairs.begin(), pairs.end(), isRemoved), pairs.end());
+	pending.erase(std::remove_if(pending.begin(), pending.end(), isRemoved), pending.end());
+}
+
+void PairStore::clear()
+{
+	QMutexLocker lock(&mutex);
+
+	fileIds.clear();
+	paths.clear();
+	sizes.clear();
+	pairs.clear();
+	pending.clear();
+}
+
+/*
+ * Writes the sorted pairs to path, marked with source so load() can tell whether
+ * they still belong to what the caller numbered its files from.
+ */
+bool PairStore::save(const QString path, const QByteArray source)
+{
+	QMutexLocker lock(&mutex);
+	QSaveFile file(path);
+
+	merge();
+
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	QDataStream out(&file);
+
+	out.setVersion(QDataStream::Qt_5_0);
+	out << PAIRS_MAGIC << PAIRS_VERSION << source << MAX_DIFFERENCE << static_cast<quint64>(pairs.length());
+
+	for (int i = 0; i < pairs.length(); i += PAIRS_CHUNK) {
+		int length = qMin(PAIRS_CHUNK, pairs.length() - i) * static_cast<int>(sizeof(Pair));
+
+		if (out.writeRawData(reinterpret_cast<const char *>(pairs.constData() + i), length) != length)
+			return false;
+	}
+
+	return out.status() == QDataStream::Ok && file.commit();
+}
+
+// Replaces whatever is here with the pairs at path, if they were saved for the same source.
+bool PairStore::load(const QString path, const QByteArray source)
+{
+	QMutexLocker lock(&mutex);
+	QFile file(path);
+	quint32 magic = 0;
+	quint32 version = 0;
+	QByteArray savedSource;
+	double maxDifference = 0.0;
+	quint64 count = 0;
+
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream in(&file);
+
+	in.setVersion(QDataStream::Qt_5_0);
+	in >> magic >> version >> savedSource >> maxDifference >> count;
+
+	// Pairs saved with a tighter radius would be missing some, those are compared again.
+	if (in.status() != QDataStream::Ok || magic != PAIRS_MAGIC || version != PAIRS_VERSION || savedSource != source || maxDifference < MAX_DIFFERENCE)
+		return false;
+
+	if (count > static_cast<quint64>(file.size()) / sizeof(Pair))
+		return false;
+
+	QVector<Pair> loaded(static_cast<int>(count));
+
+	for (int i = 0; i < loaded.length(); i += PAIRS_CHUNK) {
+		int length = qMin(PAIRS_CHUNK, loaded.length() - i) * static_cast<int>(sizeof(Pair));
+
+		if (in.readRawData(reinterpret_cast<char *>(loaded.data() + i), length) != length)
+			return false;
+	}
+
+	fileIds.clear();
+	paths.clear();
+	sizes.clear();
+	pending.clear();
+	pairs = loaded;
+
+	return true;
+}
+
+quint32 PairStore::getFileId(const InputFileItem &item)
+{
+	QHash<QString, quint32>::const_iterator existing = fileIds.constFind(item.getPath());
+
+	if (existing != fileIds.constEnd())
+		return existing.value();
+
+	quint32 id = static_cast<quint32>(paths.length());
+
+	fileIds.insert(item.getPath(), id);
+	paths.append(item.getPath());
+	sizes.append(item.getSize());
+
+	return id;
+}
+
+/*
+ * Sorts the pending pairs into the rest. A pair found more than once keeps its
+ * closest distance: the pending pairs are sorted by file to drop their own
+ * repeats, then each pair already here is looked up among them and whichever
+ * of the two is further away goes.
+ */
+void PairStore::merge()
+{
+	if (pending.isEmpty())
+		return;
+
+	QVector<Pair> merged;
+	QVector<bool> dropped(pending.length(), false);
+	int kept = 0;
+
+	// Closest first within each pair, so unique() keeps the closest.
+	std::sort(pending.begin(), pending.end(), [](const Pair &pair, const Pair &otherPair) {
+		return isBefore(pair, otherPair) || (!isBefore(otherPair, pair) && pair.distance < otherPair.distance);
+	});
+
+	pending.erase(std::unique(pending.begin(), pending.end(), isSamePair), pending.end());
+
+	auto isReplaced = [this, &dropped](const Pair &pair) {
+		QVector<Pair>::const_iterator found = std::lower_bound(pending.constBegin(), pending.constEnd(), pair, isBefore);
+
+		if (found == pending.constEnd() || !isSamePair(*found, pair))
+			return false;
+
+		if (found->distance < pair.distance)
+			return true;
+
+		dropped[static_cast<int>(found - pending.constBegin())] = true;
+
+		return false;
+	};
+
+	pairs.erase(std::remove_if(pairs.begin(), pairs.end(), isReplaced), pairs.end());
+
+	for (int i = 0; i < pending.length(); i++) {
+		if (!dropped[i])
+			pending[kept++] = pending[i];
+	}
+
+	pending.resize(kept);
+	std::sort(pending.begin(), pending.end(), lessThan);
+	merged.resize(pairs.length() + pending.length());
+
+	std::merge(pairs.constBegin(), pairs.constEnd(), pending.constBegin(), pending.constEnd(), merged.begin(), lessThan);
+
+	pairs = merged;
+	pending.clear();
+}
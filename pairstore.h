@@ -0,0 +1,65 @@
+#ifndef PAIRSTORE_H
+#define PAIRSTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+
+#include "inputfilesmodel.h"
+
+/*
+ * Every pair of files found within the loosest threshold the similarity slider
+ * allows, with its exact distance, so moving the slider only picks a different
+ * prefix of what's already been found. Pairs are kept in a flat array sorted by
+ * distance, twelve bytes each, and the pairs within a threshold are found with a
+ * binary search.
+ *
+ * Pairs come in from many comparing threads at once, so new ones are appended to
+ * a pending list and merged in when the pairs are next asked for. A pair can be
+ * found again, when a file is refined or both sides compare with each other, and
+ * only its closest distance is kept. That's sorted out while merging, with the
+ * pending pairs sorted by file and looked up for each pair already here, so
+ * nothing is kept per pair beyond its twelve bytes.
+ *
+ * The sorted pairs can be saved and loaded again, which is how --all-pairs skips
+ * comparing a catalog that hasn't changed since its pairs were saved. Files are
+ * numbered by whoever adds the pairs, only the numbers are saved.
+ */
+class PairStore
+{
+	public:
+		static const int LOOSEST_THRESHOLD;
+		static const double MAX_DIFFERENCE;
+
+		struct Pair {
+			float distance;
+			quint32 id;
+			quint32 otherId;
+		};
+
+		PairStore();
+
+		void add(const InputFileItem &item, const InputFileItem &otherItem, const double distance);
+		void add(const QVector<Pair> newPairs);
+		QVector<Pair> getPairs(const double maxDifference, QVector<QString> *filePaths = nullptr, QVector<qint64> *fileSizes = nullptr);
+		QVector<Pair> getClosestPairs(const int pairLimit, const int fileLimit, QVector<QString> *filePaths = nullptr);
+		void removeFiles(const QStringList removedPaths);
+		void clear();
+		bool save(const QString path, const QByteArray source);
+		bool load(const QString path, const QByteArray source);
+
+	private:
+		QMutex mutex;
+		QHash<QString, quint32> fileIds;
+		QVector<QString> paths;
+		QVector<qint64> sizes;
+		QVector<Pair> pairs;
+		QVector<Pair> pending;
+
+		quint32 getFileId(const InputFileItem &item);
+		void merge();
+};
+
+#endif // PAIRSTORE_H
@@ -1,18 +1,53 @@
 #include <QPushButton>
+#include <QThread>
 
 #include "preferences.h"
 #include "ui_preferences.h"
+#include "pairstore.h"
 
 const CheckFiles Preferences::DEFAULT_CHECK_FILES = VideosAndImages;
 const int Preferences::DEFAULT_SIMILARITY_THRESHOLD = 50;
+const bool Preferences::DEFAULT_ISOLATE_DECODERS = false;
+const int Preferences::DEFAULT_DECODE_TIME_BUDGET = 60;
+const int Preferences::DEFAULT_DECODE_BYTE_BUDGET = 1024;
+const int Preferences::DEFAULT_MEMORY_BUDGET = 2048;
+const bool Preferences::DEFAULT_PROGRESSIVE_FINGERPRINTS = false;
+const bool Preferences::DEFAULT_AUDIO_PREFILTER = false;
+const FINGERPRINT_ENGINE Preferences::DEFAULT_FINGERPRINT_ENGINE = FINGERPRINT_ENGINE_DHASH;
+const FINGERPRINT_PROFILE Preferences::DEFAULT_FINGERPRINT_PROFILE = FINGERPRINT_PROFILE_DEFAULT;
+const bool Preferences::DEFAULT_TRANSFORM_INVARIANT = false;
+const bool Preferences::DEFAULT_TRACE_SCAN = false;
+const bool Preferences::DEFAULT_COMPARE_QUERIES = true;
+const int Preferences::DEFAULT_CLOSEST_PAIRS = 0;
+const int Preferences::DEFAULT_MATCHES_PER_FILE = 0;
+const int Preferences::DEFAULT_MAX_READ_WORKERS = 16;
+const int Preferences::DEFAULT_MAX_DECODE_WORKERS = 0;
 
 const QString Preferences::SETTING_SIMILARITY_THRESHOLD = "similarityThreshold";
 const QString Preferences::SETTING_CHECK_FILES = "checkFiles";
+const QString Preferences::SETTING_ISOLATE_DECODERS = "isolateDecoders";
+const QString Preferences::SETTING_DECODE_TIME_BUDGET = "decodeTimeBudget";
+const QString Preferences::SETTING_DECODE_BYTE_BUDGET = "decodeByteBudget";
+const QString Preferences::SETTING_MEMORY_BUDGET = "memoryBudget";
+const QString Preferences::SETTING_PROGRESSIVE_FINGERPRINTS = "progressiveFingerprints";
+const QString Preferences::SETTING_AUDIO_PREFILTER = "audioPrefilter";
+const QString Preferences::SETTING_FINGERPRINT_ENGINE = "fingerprintEngine";
+const QString Preferences::SETTING_FINGERPRINT_PROFILE = "fingerprintProfile";
+const QString Preferences::SETTING_TRANSFORM_INVARIANT = "transformInvariant";
+const QString Preferences::SETTING_TRACE_SCAN = "traceScan";
+const QString Preferences::SETTING_COMPARE_QUERIES = "compareQueries";
+const QString Preferences::SETTING_CLOSEST_PAIRS = "closestPairs";
+const QString Preferences::SETTING_MATCHES_PER_FILE = "matchesPerFile";
+const QString Preferences::SETTING_MAX_READ_WORKERS = "maxReadWorkers";
+const QString Preferences::SETTING_MAX_DECODE_WORKERS = "maxDecodeWorkers";
 
 Preferences::Preferences(QWidget *parent): QDialog(parent),	ui(new Ui::Preferences)
 {
 	ui->setupUi(this);
 
+	// Pairs are only kept as far apart as this, anything looser would mean comparing again.
+	ui->similarityThresholdHorizontalSlider->setMinimum(PairStore::LOOSEST_THRESHOLD);
+
 	connect(ui->buttonBox->button(QDialogButtonBox::RestoreDefaults),
 			&QPushButton::clicked,
 			this,
@@ -31,15 +66,28 @@ void Preferences::restoreDefaults()
 {
 	ui->similarityThresholdHorizontalSlider->setValue(DEFAULT_SIMILARITY_THRESHOLD);
 	ui->checkFilesComboBox->setCurrentIndex(DEFAULT_CHECK_FILES);
+	ui->isolateDecodersCheckBox->setChecked(DEFAULT_ISOLATE_DECODERS);
+	ui->decodeTimeBudgetSpinBox->setValue(DEFAULT_DECODE_TIME_BUDGET);
+	ui->decodeByteBudgetSpinBox->setValue(DEFAULT_DECODE_BYTE_BUDGET);
+	ui->memoryBudgetSpinBox->setValue(DEFAULT_MEMORY_BUDGET);
+	ui->progressiveFingerprintsCheckBox->setChecked(DEFAULT_PROGRESSIVE_FINGERPRINTS);
+	ui->audioPrefilterCheckBox->setChecked(DEFAULT_AUDIO_PREFILTER);
+	ui->fingerprintEngineComboBox->setCurrentIndex(DEFAULT_FINGERPRINT_ENGINE);
+	ui->fingerprintProfileComboBox->setCurrentIndex(DEFAULT_FINGERPRINT_PROFILE);
+	ui->transformInvariantCheckBox->setChecked(DEFAULT_TRANSFORM_INVARIANT);
+	ui->traceScanCheckBox->setChecked(DEFAULT_TRACE_SCAN);
+	ui->compareQueriesCheckBox->setChecked(DEFAULT_COMPARE_QUERIES);
+	ui->closestPairsSpinBox->setValue(DEFAULT_CLOSEST_PAIRS);
+	ui->matchesPerFileSpinBox->setValue(DEFAULT_MATCHES_PER_FILE);
+	ui->maxReadWorkersSpinBox->setValue(DEFAULT_MAX_READ_WORKERS);
+	ui->maxDecodeWorkersSpinBox->setValue(DEFAULT_MAX_DECODE_WORKERS);
 }
 
 void Preferences::updateSimilarityThresholdLabel(const int value)
 {
 	QString desc;
 
-	if (value < 25) {
-		desc = "%1 - Only a little bit similar";
-	} else if (value < 50) {
+	if (value < 50) {
 		desc = "%1 - Somewhat similar";
 	} else if (value < 75) {
 		desc = "%1 - Quite similar";
@@ -50,21 +98,57 @@ void Preferences::updateSimilarityThresholdLabel(const int value)
 	ui->similarityThresholdLabel->setText(desc.arg(value));
 }
 
+// Profiles with larger hashes bring their own engine, the method is only there for the others.
+void Preferences::updateFingerprintProfile(const int index)
+{
+	ui->fingerprintEngineComboBox->setEnabled(FingerprintProfile::get(index).hashSize <= 8);
+}
+
 void Preferences::applySettings()
 {
 	settings.setValue(SETTING_SIMILARITY_THRESHOLD, ui->similarityThresholdHorizontalSlider->value());
 	settings.setValue(SETTING_CHECK_FILES, ui->checkFilesComboBox->currentIndex());
+	settings.setValue(SETTING_ISOLATE_DECODERS, ui->isolateDecodersCheckBox->isChecked());
+	settings.setValue(SETTING_DECODE_TIME_BUDGET, ui->decodeTimeBudgetSpinBox->value());
+	settings.setValue(SETTING_DECODE_BYTE_BUDGET, ui->decodeByteBudgetSpinBox->value());
+	settings.setValue(SETTING_MEMORY_BUDGET, ui->memoryBudgetSpinBox->value());
+	settings.setValue(SETTING_PROGRESSIVE_FINGERPRINTS, ui->progressiveFingerprintsCheckBox->isChecked());
+	settings.setValue(SETTING_AUDIO_PREFILTER, ui->audioPrefilterCheckBox->isChecked());
+	settings.setValue(SETTING_FINGERPRINT_ENGINE, ui->fingerprintEngineComboBox->currentIndex());
+	settings.setValue(SETTING_FINGERPRINT_PROFILE, ui->fingerprintProfileComboBox->currentIndex());
+	settings.setValue(SETTING_TRANSFORM_INVARIANT, ui->transformInvariantCheckBox->isChecked());
+	settings.setValue(SETTING_TRACE_SCAN, ui->traceScanCheckBox->isChecked());
+	settings.setValue(SETTING_COMPARE_QUERIES, ui->compareQueriesCheckBox->isChecked());
+	settings.setValue(SETTING_CLOSEST_PAIRS, ui->closestPairsSpinBox->value());
+	settings.setValue(SETTING_MATCHES_PER_FILE, ui->matchesPerFileSpinBox->value());
+	settings.setValue(SETTING_MAX_READ_WORKERS, ui->maxReadWorkersSpinBox->value());
+	settings.setValue(SETTING_MAX_DECODE_WORKERS, ui->maxDecodeWorkersSpinBox->value());
 }
 
 void Preferences::cancelSettings()
 {
 	ui->similarityThresholdHorizontalSlider->setValue(settings.value(SETTING_SIMILARITY_THRESHOLD, DEFAULT_SIMILARITY_THRESHOLD).toInt());
 	ui->checkFilesComboBox->setCurrentIndex(settings.value(SETTING_CHECK_FILES, DEFAULT_CHECK_FILES).toInt());
+	ui->isolateDecodersCheckBox->setChecked(settings.value(SETTING_ISOLATE_DECODERS, DEFAULT_ISOLATE_DECODERS).toBool());
+	ui->decodeTimeBudgetSpinBox->setValue(settings.value(SETTING_DECODE_TIME_BUDGET, DEFAULT_DECODE_TIME_BUDGET).toInt());
+	ui->decodeByteBudgetSpinBox->setValue(settings.value(SETTING_DECODE_BYTE_BUDGET, DEFAULT_DECODE_BYTE_BUDGET).toInt());
+	ui->memoryBudgetSpinBox->setValue(settings.value(SETTING_MEMORY_BUDGET, DEFAULT_MEMORY_BUDGET).toInt());
+	ui->progressiveFingerprintsCheckBox->setChecked(settings.value(SETTING_PROGRESSIVE_FINGERPRINTS, DEFAULT_PROGRESSIVE_FINGERPRINTS).toBool());
+	ui->audioPrefilterCheckBox->setChecked(settings.value(SETTING_AUDIO_PREFILTER, DEFAULT_AUDIO_PREFILTER).toBool());
+	ui->fingerprintEngineComboBox->setCurrentIndex(settings.value(SETTING_FINGERPRINT_ENGINE, DEFAULT_FINGERPRINT_ENGINE).toInt());
+	ui->fingerprintProfileComboBox->setCurrentIndex(settings.value(SETTING_FINGERPRINT_PROFILE, DEFAULT_FINGERPRINT_PROFILE).toInt());
+	ui->transformInvariantCheckBox->setChecked(settings.value(SETTING_TRANSFORM_INVARIANT, DEFAULT_TRANSFORM_INVARIANT).toBool());
+	ui->traceScanCheckBox->setChecked(settings.value(SETTING_TRACE_SCAN, DEFAULT_TRACE_SCAN).toBool());
+	ui->compareQueriesCheckBox->setChecked(settings.value(SETTING_COMPARE_QUERIES, DEFAULT_COMPARE_QUERIES).toBool());
+	ui->closestPairsSpinBox->setValue(settings.value(SETTING_CLOSEST_PAIRS, DEFAULT_CLOSEST_PAIRS).toInt());
+	ui->matchesPerFileSpinBox->setValue(settings.value(SETTING_MATCHES_PER_FILE, DEFAULT_MATCHES_PER_FILE).toInt());
+	ui->maxReadWorkersSpinBox->setValue(settings.value(SETTING_MAX_READ_WORKERS, DEFAULT_MAX_READ_WORKERS).toInt());
+	ui->maxDecodeWorkersSpinBox->setValue(settings.value(SETTING_MAX_DECODE_WORKERS, DEFAULT_MAX_DECODE_WORKERS).toInt());
 }
 
 int Preferences::getSimilarityThreshold() const
 {
-	return settings.value(SETTING_SIMILARITY_THRESHOLD, DEFAULT_SIMILARITY_THRESHOLD).toInt();
+	return qMax(settings.value(SETTING_SIMILARITY_THRESHOLD, DEFAULT_SIMILARITY_THRESHOLD).toInt(), PairStore::LOOSEST_THRESHOLD);
 }
 
 CheckFiles Preferences::getCheckFiles() const
@@ -72,3 +156,90 @@ CheckFiles Preferences::getCheckFiles() const
 	return (CheckFiles)settings.value(SETTING_CHECK_FILES, DEFAULT_CHECK_FILES).toInt();
 }
 
+
+bool Preferences::getIsolateDecoders() const
+{
+	return settings.value(SETTING_ISOLATE_DECODERS, DEFAULT_ISOLATE_DECODERS).toBool();
+}
+
+// Returned in milliseconds, 0 means unlimited.
+qint64 Preferences::getDecodeTimeBudget() const
+{
+	return settings.value(SETTING_DECODE_TIME_BUDGET, DEFAULT_DECODE_TIME_BUDGET).toLongLong() * 1000;
+}
+
+// Returned in bytes, 0 means unlimited.
+qint64 Preferences::getDecodeByteBudget() const
+{
+	return settings.value(SETTING_DECODE_BYTE_BUDGET, DEFAULT_DECODE_BYTE_BUDGET).toLongLong() * 1000 * 1000;
+}
+
+// Returned in bytes, 0 means unlimited.
+qint64 Preferences::getMemoryBudget() const
+{
+	return settings.value(SETTING_MEMORY_BUDGET, DEFAULT_MEMORY_BUDGET).toLongLong() * 1000 * 1000;
+}
+
+bool Preferences::getProgressiveFingerprints() const
+{
+	return settings.value(SETTING_PROGRESSIVE_FINGERPRINTS, DEFAULT_PROGRESSIVE_FINGERPRINTS).toBool();
+}
+
+bool Preferences::getAudioPrefilter() const
+{
+	return settings.value(SETTING_AUDIO_PREFILTER, DEFAULT_AUDIO_PREFILTER).toBool();
+}
+
+// The engine the profile in use makes fingerprints with, which isn't always the method chosen.
+FINGERPRINT_ENGINE Preferences::getFingerprintEngine() const
+{
+	FINGERPRINT_ENGINE engine = (FINGERPRINT_ENGINE)settings.value(SETTING_FINGERPRINT_ENGINE, DEFAULT_FINGERPRINT_ENGINE).toInt();
+
+	return FingerprintProfile::get(getFingerprintProfile()).getEngine(engine);
+}
+
+FINGERPRINT_PROFILE Preferences::getFingerprintProfile() const
+{
+	return FingerprintProfile::get(settings.value(SETTING_FINGERPRINT_PROFILE, DEFAULT_FINGERPRINT_PROFILE).toInt()).id;
+}
+
+bool Preferences::getTransformInvariant() const
+{
+	return settings.value(SETTING_TRANSFORM_INVARIANT, DEFAULT_TRANSFORM_INVARIANT).toBool();
+}
+
+bool Preferences::getTraceScan() const
+{
+	return settings.value(SETTING_TRACE_SCAN, DEFAULT_TRACE_SCAN).toBool();
+}
+
+bool Preferences::getCompareQueries() const
+{
+	return settings.value(SETTING_COMPARE_QUERIES, DEFAULT_COMPARE_QUERIES).toBool();
+}
+
+int Preferences::getClosestPairs() const
+{
+	return settings.value(SETTING_CLOSEST_PAIRS, DEFAULT_CLOSEST_PAIRS).toInt();
+}
+
+int Preferences::getMatchesPerFile() const
+{
+	return settings.value(SETTING_MATCHES_PER_FILE, DEFAULT_MATCHES_PER_FILE).toInt();
+}
+
+// 0 means one per core.
+int Preferences::getMaxReadWorkers() const
+{
+	int workers = settings.value(SETTING_MAX_READ_WORKERS, DEFAULT_MAX_READ_WORKERS).toInt();
+
+	return workers > 0 ? workers : QThread::idealThreadCount();
+}
+
+// 0 means one per core.
+int Preferences::getMaxDecodeWorkers() const
+{
+	int workers = settings.value(SETTING_MAX_DECODE_WORKERS, DEFAULT_MAX_DECODE_WORKERS).toInt();
+
+	return workers > 0 ? workers : QThread::idealThreadCount();
+}
@@ -4,6 +4,9 @@
 #include <QDialog>
 #include <QSettings>
 
+#include "fingerprintengine.h"
+#include "fingerprintprofile.h"
+
 namespace Ui {
 	class Preferences;
 }
@@ -24,22 +27,68 @@ class Preferences : public QDialog
 	public:
 		static const int DEFAULT_SIMILARITY_THRESHOLD;
 		static const CheckFiles DEFAULT_CHECK_FILES;
+		static const bool DEFAULT_ISOLATE_DECODERS;
+		static const int DEFAULT_DECODE_TIME_BUDGET;
+		static const int DEFAULT_DECODE_BYTE_BUDGET;
+		static const int DEFAULT_MEMORY_BUDGET;
+		static const bool DEFAULT_PROGRESSIVE_FINGERPRINTS;
+		static const bool DEFAULT_AUDIO_PREFILTER;
+		static const FINGERPRINT_ENGINE DEFAULT_FINGERPRINT_ENGINE;
+		static const FINGERPRINT_PROFILE DEFAULT_FINGERPRINT_PROFILE;
+		static const bool DEFAULT_TRANSFORM_INVARIANT;
+		static const bool DEFAULT_TRACE_SCAN;
+		static const bool DEFAULT_COMPARE_QUERIES;
+		static const int DEFAULT_CLOSEST_PAIRS;
+		static const int DEFAULT_MATCHES_PER_FILE;
+		static const int DEFAULT_MAX_READ_WORKERS;
+		static const int DEFAULT_MAX_DECODE_WORKERS;
 
 		explicit Preferences(QWidget *parent = 0);
 		~Preferences();
 
 		int getSimilarityThreshold() const;
 		CheckFiles getCheckFiles() const;
+		bool getIsolateDecoders() const;
+		qint64 getDecodeTimeBudget() const;
+		qint64 getDecodeByteBudget() const;
+		qint64 getMemoryBudget() const;
+		bool getProgressiveFingerprints() const;
+		bool getAudioPrefilter() const;
+		bool getTransformInvariant() const;
+		bool getTraceScan() const;
+		bool getCompareQueries() const;
+		int getClosestPairs() const;
+		int getMatchesPerFile() const;
+		int getMaxReadWorkers() const;
+		int getMaxDecodeWorkers() const;
+		FINGERPRINT_ENGINE getFingerprintEngine() const;
+		FINGERPRINT_PROFILE getFingerprintProfile() const;
 
 	private slots:
 		void restoreDefaults();
 		void updateSimilarityThresholdLabel(const int value);
+		void updateFingerprintProfile(const int index);
 		void applySettings();
 		void cancelSettings();
 
 	private:
 		static const QString SETTING_SIMILARITY_THRESHOLD;
 		static const QString SETTING_CHECK_FILES;
+		static const QString SETTING_ISOLATE_DECODERS;
+		static const QString SETTING_DECODE_TIME_BUDGET;
+		static const QString SETTING_DECODE_BYTE_BUDGET;
+		static const QString SETTING_MEMORY_BUDGET;
+		static const QString SETTING_PROGRESSIVE_FINGERPRINTS;
+		static const QString SETTING_AUDIO_PREFILTER;
+		static const QString SETTING_FINGERPRINT_ENGINE;
+		static const QString SETTING_FINGERPRINT_PROFILE;
+		static const QString SETTING_TRANSFORM_INVARIANT;
+		static const QString SETTING_TRACE_SCAN;
+		static const QString SETTING_COMPARE_QUERIES;
+		static const QString SETTING_CLOSEST_PAIRS;
+		static const QString SETTING_MATCHES_PER_FILE;
+		static const QString SETTING_MAX_READ_WORKERS;
+		static const QString SETTING_MAX_DECODE_WORKERS;
 
 		Ui::Preferences *ui;
 		QSettings settings;
@@ -0,0 +1,196 @@
+#include <QDirIterator>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include "scancommand.h"
+#include "fingerprintprofile.h"
+#include "preferences.h"
+
+const char *ScanCommand::ARGUMENT = "--scan";
+
+// Returned in bytes, or -1 where we can't tell.
+static qint64 getPeakMemory()
+{
+#ifdef Q_OS_UNIX
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+#ifdef Q_OS_DARWIN
+	return static_cast<qint64>(usage.ru_maxrss);
+#else
+	return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Takes the directory to scan, and optionally the similarity threshold, the most
+ * files to decode at once, "fast" or "thorough" for the fingerprint method, the
+ * name of the fingerprint profile, "inprocess" or "isolated" for where files are
+ * decoded and "full" or "progressive" for how much of each is decoded first.
+ */
+int ScanCommand::runCommand(const QStringList arguments)
+{
+	QTextStream out(stdout);
+	QTextStream err(stderr);
+	int threshold = Preferences::DEFAULT_SIMILARITY_THRESHOLD;
+	int threads = QThread::idealThreadCount();
+	FINGERPRINT_ENGINE engine = Preferences::DEFAULT_FINGERPRINT_ENGINE;
+	int profile = Preferences::DEFAULT_FINGERPRINT_PROFILE;
+	bool isolateDecoders = Preferences::DEFAULT_ISOLATE_DECODERS;
+	bool progressive = Preferences::DEFAULT_PROGRESSIVE_FINGERPRINTS;
+	bool ok = true;
+
+	if (arguments.length() > 1)
+		threshold = arguments[1].toInt(&ok);
+
+	if (ok && arguments.length() > 2)
+		threads = arguments[2].toInt(&ok);
+
+	if (ok && arguments.length() > 3)
+		ok = arguments[3] == "fast" || arguments[3] == "thorough";
+
+	if (ok && arguments.length() > 4)
+		profile = FingerprintProfile::find(qPrintable(arguments[4]));
+
+	if (ok && arguments.length() > 5)
+		ok = arguments[5] == "inprocess" || arguments[5] == "isolated";
+
+	if (ok && arguments.length() > 6)
+		ok = arguments[6] == "full" || arguments[6] == "progressive";
+
+	if (arguments.isEmpty() || arguments.length() > 7 || !ok || threshold < PairStore::LOOSEST_THRESHOLD || threshold > 100 || threads < 1 || profile < 0) {
+		err << "Usage: SameDifference " << ARGUMENT << " <directory> [threshold " << PairStore::LOOSEST_THRESHOLD
+			<< "-100] [threads] [fast|thorough] [fast|default|archive] [inprocess|isolated] [full|progressive]\n";
+
+		return 2;
+	}
+
+	if (arguments.length() > 3)
+		engine = arguments[3] == "thorough" ? FINGERPRINT_ENGINE_PHASH : FINGERPRINT_ENGINE_DHASH;
+
+	if (arguments.length() > 5)
+		isolateDecoders = arguments[5] == "isolated";
+
+	if (arguments.length() > 6)
+		progressive = arguments[6] == "progressive";
+
+	engine = FingerprintProfile::get(profile).getEngine(engine);
+
+	QElapsedTimer timer;
+	QStringList paths;
+
+	timer.start();
+
+	QDirIterator files(arguments[0], QDir::Files, QDirIterator::Subdirectories);
+
+	while (files.hasNext())
+		paths.append(files.next());
+
+	if (paths.isEmpty()) {
+		err << "No files found in " << arguments[0] << "\n";
+
+		return 1;
+	}
+
+	qRegisterMetaType<InputFileItemPtr>("InputFileItemPtr");
+	qRegisterMetaType<QVector<InputFileItemPtr>>("QVector<InputFileItemPtr>");
+
+	ScanCommand command(threshold, threads, engine, static_cast<FINGERPRINT_PROFILE>(profile), isolateDecoders, progressive);
+
+	// Listing the directory is part of the scan, as it is when a folder is added.
+	command.timer = timer;
+	command.scan(paths);
+
+	double seconds = qMax<qint64>(timer.elapsed(), 1) / 1000.0;
+	QVector<QString> pairPaths;
+	QVector<PairStore::Pair> matched = command.pairs.getPairs(command.maxDifference, &pairPaths);
+	qint64 peakMemory = getPeakMemory();
+	qint64 firstPair = command.firstPair.load();
+	int fingerprinted = 0;
+
+	foreach (QString path, paths) {
+		if (command.model.getItem(path)->getFingerprintStatus() == Ready)
+			fingerprinted++;
+	}
+
+	foreach (PairStore::Pair pair, matched) {
+		out << QString::number(static_cast<double>(pair.distance), 'f', 4) << '\t'
+			<< pairPaths[static_cast<int>(pair.id)] << '\t'
+			<< pairPaths[static_cast<int>(pair.otherId)] << '\n';
+	}
+
+	out.flush();
+
+	err << "files=" << paths.length()
+		<< " fingerprinted=" << fingerprinted
+		<< " seconds=" << QString::number(seconds, 'f', 3)
+		<< " files_per_second=" << QString::number(paths.length() / seconds, 'f', 1)
+		<< " first_pair_seconds=" << (firstPair < 0 ? QString("-1") : QString::number(firstPair / 1000.0, 'f', 3))
+		<< " peak_rss_mb=" << (peakMemory < 0 ? QString("-1") : QString::number(peakMemory / (1000.0 * 1000.0), 'f', 1))
+		<< " pairs=" << matched.length()
+		<< " read_limit=" << command.pipeline.getConcurrency().getLimit(FileScheduler::STAGE_PROBE)
+		<< " decode_limit=" << command.pipeline.getConcurrency().getLimit(FileScheduler::STAGE_FINGERPRINT) << "\n";
+
+	return 0;
+}
+
+/*
+ * Budgets are the preferences' defaults. How many files are read at once is
+ * bounded like the preferences' default too, how many are decoded by maxDecoders.
+ */
+ScanCommand::ScanCommand(const int threshold, const int maxDecoders, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile, const bool isolateDecoders, const bool progressive): pipeline(model, pairs)
+{
+	int maxReaders = Preferences::DEFAULT_MAX_READ_WORKERS > 0 ? Preferences::DEFAULT_MAX_READ_WORKERS : QThread::idealThreadCount();
+
+	// The same scale as the similarity slider.
+	maxDifference = (100 - threshold) / 200.0;
+	firstPair = -1;
+
+	model.setSimilarityThreshold(threshold);
+
+	// Like the main window, the scan goes on without them if they can't be opened.
+	if (storeDirectory.isValid() && fingerprintCache.open(storeDirectory.path()))
+		pipeline.setFingerprintCache(&fingerprintCache);
+
+	if (storeDirectory.isValid() && thumbnailStore.open(storeDirectory.path()))
+		pipeline.setThumbnailStore(&thumbnailStore);
+
+	pipeline.setDuplicateGroups(&groups);
+	pipeline.setFingerprinting(engine, profile, progressive, Preferences::DEFAULT_AUDIO_PREFILTER);
+	pipeline.setIsolateDecoders(isolateDecoders);
+	pipeline.setConcurrencyBounds(maxReaders, maxDecoders);
+
+	// Noted on the comparing thread, when it's found rather than when the groups get to it.
+	connect(&pipeline, &ScanPipeline::duplicatesFound, this, [this]() {
+		qint64 none = -1;
+
+		firstPair.compare_exchange_strong(none, timer.elapsed());
+	}, Qt::DirectConnection);
+
+	// Queued, so it still ends the loop if every file finishes before the loop starts.
+	connect(&pipeline, &ScanPipeline::finished, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+}
+
+// Returns once every file has been fingerprinted and compared, or has failed.
+void ScanCommand::scan(const QStringList paths)
+{
+	foreach (QString path, paths)
+		pipeline.add(path);
+
+	loop.exec();
+
+	pipeline.stop();
+
+	// Consumers have run out of files by now, this only waits for them to notice.
+	QThreadPool::globalInstance()->waitForDone();
+}
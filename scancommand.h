@@ -0,0 +1,64 @@
+#ifndef SCANCOMMAND_H
+#define SCANCOMMAND_H
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QObject>
+#include <QStringList>
+#include <QTemporaryDir>
+
+#include <atomic>
+
+#include "duplicategroupsmodel.h"
+#include "fingerprintcache.h"
+#include "inputfilesmodel.h"
+#include "pairstore.h"
+#include "scanpipeline.h"
+#include "thumbnailstore.h"
+
+/*
+ * Scans a directory without a window and reports how fast it went. Files go
+ * through the ScanPipeline the main window drives, from probing and decoding to
+ * the fingerprint cache, the thumbnail store and the duplicate groups, so what's
+ * measured is the scan users get.
+ *
+ * Every pair within the threshold is written to standard output like
+ * --all-pairs does, closest first. The figures go to standard error as one line
+ * of key=value pairs, for scripts to pick up: files found and fingerprinted,
+ * seconds taken, files per second, seconds until the first pair within the
+ * threshold turned up, peak resident memory in MB, pairs found and where the
+ * read and decode limits ended up.
+ *
+ * Everything not given on the command line is the preferences' default. The
+ * fingerprint cache and thumbnails go to a directory of their own that's removed
+ * afterwards, so runs can be compared with each other whatever the preferences
+ * say and whatever was scanned before.
+ */
+class ScanCommand: public QObject
+{
+	Q_OBJECT
+
+	public:
+		static const char *ARGUMENT;
+
+		static int runCommand(const QStringList arguments);
+
+	private:
+		InputFilesModel model;
+		PairStore pairs;
+		DuplicateGroupsModel groups;
+		QTemporaryDir storeDirectory;
+		FingerprintCache fingerprintCache;
+		ThumbnailStore thumbnailStore;
+		ScanPipeline pipeline;
+		QElapsedTimer timer;
+		QEventLoop loop;
+		double maxDifference;
+		std::atomic<qint64> firstPair;
+
+		ScanCommand(const int threshold, const int maxDecoders, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile, const bool isolateDecoders, const bool progressive);
+
+		void scan(const QStringList paths);
+};
+
+#endif // SCANCOMMAND_H
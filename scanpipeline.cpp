@@ -0,0 +1,448 @@
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "scanpipeline.h"
+#include "closestpairs.h"
+#include "duplicategroupsmodel.h"
+#include "fingerprintcache.h"
+#include "fingerprintprofile.h"
+#include "mediautility.h"
+#include "pairstore.h"
+#include "preferences.h"
+#include "thumbnailstore.h"
+#include "tracer.h"
+
+// Until they're set, the settings are the preferences' defaults.
+ScanPipeline::ScanPipeline(InputFilesModel &model, PairStore &pairStore, QObject *parent): QObject(parent), model(model), pairStore(pairStore), timeToDie(false)
+{
+	fingerprintCache = nullptr;
+	thumbnailStore = nullptr;
+	duplicateGroups = nullptr;
+	closestPairs = nullptr;
+	engine = Preferences::DEFAULT_FINGERPRINT_ENGINE;
+	profile = Preferences::DEFAULT_FINGERPRINT_PROFILE;
+	progressive = Preferences::DEFAULT_PROGRESSIVE_FINGERPRINTS;
+	audioFirst = Preferences::DEFAULT_AUDIO_PREFILTER;
+	isolateDecoders = Preferences::DEFAULT_ISOLATE_DECODERS;
+	outstanding = 0;
+
+	setBudget(static_cast<qint64>(Preferences::DEFAULT_DECODE_TIME_BUDGET) * 1000, static_cast<qint64>(Preferences::DEFAULT_DECODE_BYTE_BUDGET) * 1000 * 1000);
+	setMemoryBudget(static_cast<qint64>(Preferences::DEFAULT_MEMORY_BUDGET) * 1000 * 1000);
+
+	connect(this, &ScanPipeline::fileInfoAdded, this, &ScanPipeline::addFileInfo, Qt::BlockingQueuedConnection);
+	connect(&workerPool, &WorkerPool::fileInfoReady, this, &ScanPipeline::addFileInfo);
+	connect(this, &ScanPipeline::compared, this, &ScanPipeline::finishComparing, Qt::QueuedConnection);
+	connect(this, &ScanPipeline::duplicatesFound, this, &ScanPipeline::addDuplicates, Qt::QueuedConnection);
+
+	// How many files are read and decoded at once is tuned from what the last interval managed.
+	concurrencyTimer.setInterval(ConcurrencyController::INTERVAL);
+	concurrencyClock.start();
+
+	connect(&concurrencyTimer, &QTimer::timeout, this, &ScanPipeline::updateConcurrency);
+
+	concurrencyTimer.start();
+
+	setConcurrencyBounds(Preferences::DEFAULT_MAX_READ_WORKERS > 0 ? Preferences::DEFAULT_MAX_READ_WORKERS : QThread::idealThreadCount(),
+						 Preferences::DEFAULT_MAX_DECODE_WORKERS > 0 ? Preferences::DEFAULT_MAX_DECODE_WORKERS : QThread::idealThreadCount());
+}
+
+void ScanPipeline::setBudget(const qint64 timeBudget, const qint64 byteBudget)
+{
+	this->timeBudget = timeBudget;
+	this->byteBudget = byteBudget;
+
+	workerPool.setBudget(timeBudget, byteBudget);
+}
+
+void ScanPipeline::setMemoryBudget(const qint64 bytes)
+{
+	scheduler.setMemoryBudget(bytes);
+	workerPool.setMemoryBudget(bytes);
+}
+
+// Files already fingerprinted keep what they were made with, refining them included.
+void ScanPipeline::setFingerprinting(const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile, const bool progressive, const bool audioFirst)
+{
+	this->engine = engine;
+	this->profile = profile;
+	this->progressive = progressive;
+	this->audioFirst = audioFirst;
+}
+
+void ScanPipeline::setConcurrencyBounds(const int maxProbes, const int maxFingerprints)
+{
+	concurrency.setBounds(maxProbes, maxFingerprints);
+	applyConcurrency();
+}
+
+// Library files that were fingerprinted before, by the engine and profile in use, aren't decoded again.
+void ScanPipeline::add(const QString path, const bool reference)
+{
+	model.add(path, reference);
+
+	if (reference && fingerprintCache) {
+		InputFileItemPtr cached = fingerprintCache->get(getFileCacheKey(path));
+
+		if (cached && cached->getPath() == path && cached->isFingerprintCurrent(engine, profile)) {
+			outstanding++;
+			addFileInfo(cached);
+
+			return;
+		}
+	}
+
+	scheduleProbe(path);
+}
+
+// Every finished fingerprint is compared again, pairs already found are only kept once.
+void ScanPipeline::compareAll()
+{
+	for (int row = 0; row < model.rowCount(); row++) {
+		QString path = model.getPath(row);
+		InputFileItemPtr item = model.getItem(path);
+
+		if (item->getStatus() == Ready && item->getFingerprintStatus() == Ready && item->isFingerprintComplete())
+			compare(path);
+	}
+}
+
+void ScanPipeline::setVisible(const QStringList paths)
+{
+	scheduler.setVisible(paths);
+	workerPool.setVisible(paths);
+}
+
+// Drops the queued files that have been removed from the model.
+void ScanPipeline::prune()
+{
+	scheduler.prune();
+	workerPool.prune();
+}
+
+void ScanPipeline::clear()
+{
+	pendingRefinements.clear();
+	prune();
+}
+
+// Nothing more is started, decoders that are running finish their file and stop.
+void ScanPipeline::stop()
+{
+	timeToDie = true;
+
+	concurrencyTimer.stop();
+	scheduler.clear();
+	workerPool.clear();
+}
+
+void ScanPipeline::scheduleProbe(const QString path)
+{
+	FileScheduler::Job job;
+
+	job.path = path;
+	job.probe = true;
+	job.cost = getFileSize(path);
+	job.memory = 0;
+	job.samples = 0;
+	job.audioFirst = false;
+	job.engine = engine;
+	job.profile = profile;
+	job.token = model.getCancelToken(path);
+
+	schedule(job);
+}
+
+void ScanPipeline::scheduleFile(const QString path, const quint32 samples, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile, const bool audioFirst)
+{
+	FileScheduler::Job job;
+
+	job.path = path;
+	job.probe = false;
+	job.cost = getFileSize(path);
+	job.memory = model.getItem(path)->getMemoryEstimate();
+	job.samples = samples;
+	job.audioFirst = audioFirst;
+	job.engine = engine;
+	job.profile = profile;
+	job.token = model.getCancelToken(path);
+
+	schedule(job);
+}
+
+void ScanPipeline::schedule(const FileScheduler::Job job)
+{
+	outstanding++;
+
+	if (isolateDecoders) {
+		workerPool.enqueue(job);
+
+		return;
+	}
+
+	scheduler.push(job);
+
+	startConsumer(timeBudget, byteBudget);
+}
+
+void ScanPipeline::startConsumer(const qint64 timeBudget, const qint64 byteBudget)
+{
+	if (scheduler.startConsumer()) {
+		QtConcurrent::run([=]() {
+			processFiles(timeBudget, byteBudget);
+		});
+	}
+}
+
+void ScanPipeline::processFiles(const qint64 timeBudget, const qint64 byteBudget)
+{
+	FileScheduler::Job job;
+
+	while (scheduler.takeOrStop(job)) {
+		if (timeToDie) {
+			scheduler.release(job);
+			scheduler.clear();
+
+			continue;
+		}
+
+		QSharedPointer<InputFileItem> item(new InputFileItem(job.path));
+
+		{
+			TRACE_SPAN(job.probe ? "probe file" : "fingerprint file", job.path);
+
+			if (job.probe)
+				item->probe(MediaUtility::PROBE_SIZE, timeBudget, job.token.data());
+
+			else
+				item->getInfo(timeBudget, byteBudget, job.token.data(), job.samples, job.audioFirst, job.engine, job.profile);
+		}
+
+		// The memory this file needed is free again, which may let a waiting file start.
+		scheduler.finish(job);
+		startConsumer(timeBudget, byteBudget);
+
+		// Removed while we were decoding, nobody wants this any more.
+		if (timeToDie || *job.token)
+			continue;
+
+		// Blocks until our thread has taken the result, which shows up as a gap in the trace.
+		TRACE_SPAN("wait for model update", job.path);
+
+		emit fileInfoAdded(item);
+	}
+}
+
+void ScanPipeline::addFileInfo(const InputFileItemPtr item)
+{
+	TRACE_SPAN("model update", item->getPath());
+
+	QString path = item->getPath();
+	// Worked out once and only when it's needed, it takes two stats and a hash.
+	QByteArray key;
+
+	pendingRefinements.remove(path);
+
+	if (thumbnailStore && !item->getThumbnail().isEmpty()) {
+		key = getFileCacheKey(path);
+		thumbnailStore->insert(key, item->getThumbnail());
+	}
+
+	model.update(item);
+
+	emit fileUpdated(item);
+
+	// Kept for when the file turns up again as part of a library.
+	if (fingerprintCache && item->getFingerprintStatus() == Ready) {
+		InputFileItemPtr mergedItem = model.getItem(path);
+
+		// One made by another engine or profile is replaced, the latest settings are the likeliest to be used again.
+		if (mergedItem->isFingerprintComplete()) {
+			if (key.isEmpty())
+				key = getFileCacheKey(path);
+
+			InputFileItemPtr cached = fingerprintCache->get(key);
+
+			if (!cached || !cached->isFingerprintCompatible(*mergedItem))
+				fingerprintCache->insert(key, *mergedItem);
+		}
+	}
+
+	// The headers are in, the file can now wait its turn to be decoded.
+	if (item->getStatus() == Ready && item->getFingerprintStatus() == Loading) {
+		scheduleFile(path,
+					 progressive ? FingerprintProfile::get(profile).coarseSamples : MediaUtility::ALL_SAMPLES,
+					 engine,
+					 profile,
+					 audioFirst);
+	} else if (item->getStatus() == Ready && item->getFingerprintStatus() == Ready) {
+		compare(path);
+	}
+
+	finishWork();
+}
+
+void ScanPipeline::compare(const QString path)
+{
+	outstanding++;
+
+	QtConcurrent::run([=]() {
+		// A refinement only carries the new samples, the model has the whole fingerprint.
+		InputFileItemPtr mergedItem = model.getItem(path);
+		QVector<InputFileItemPtr> similarItems;
+		QVector<InputFileItemPtr> duplicates;
+		QStringList refine;
+		bool closest = closestPairs && closestPairs->isEnabled();
+		bool closerPairs = false;
+		double maxDifference = model.getMaxDifference();
+
+		{
+			TRACE_SPAN("compare", path);
+
+			similarItems = model.getSimilarItems(mergedItem);
+
+			foreach (InputFileItemPtr similarItem, similarItems) {
+				double distance = model.getDistance(*mergedItem, *similarItem);
+
+				if (distance < 0.0)
+					continue;
+
+				// Pairs beyond the threshold are kept too, it may be loosened later. So are the pairs
+				// found while looking for the closest ones, which are mostly taken from there.
+				if (distance <= PairStore::MAX_DIFFERENCE)
+					pairStore.add(*mergedItem, *similarItem, distance);
+
+				if (closest) {
+					if (closestPairs->add(path, similarItem->getPath(), distance))
+						closerPairs = true;
+				} else if (distance <= maxDifference) {
+					duplicates.append(similarItem);
+				}
+			}
+		}
+
+		if (!duplicates.isEmpty() && !timeToDie)
+			emit duplicatesFound(mergedItem, duplicates);
+
+		if (closerPairs && !timeToDie)
+			emit closestPairsChanged();
+
+		// Only the soundtrack has been looked at so far. If it matched something we've
+		// found our duplicate without decoding any video, otherwise the pictures decide.
+		if (mergedItem->getAudioSamples() && !mergedItem->getFingerprintSamples()) {
+			if (similarItems.isEmpty() && mergedItem->getMissingSamples())
+				refine.append(path);
+		} else {
+			foreach (InputFileItemPtr similarItem, similarItems) {
+				// Files only paired up by their soundtrack don't need their video decoded.
+				if (similarItem->getFingerprintSamples() && !similarItem->isFingerprintComplete())
+					refine.append(similarItem->getPath());
+
+				if (!mergedItem->isFingerprintComplete() && !refine.contains(path))
+					refine.append(path);
+			}
+		}
+
+		emit compared(refine);
+	});
+}
+
+void ScanPipeline::finishComparing(const QStringList refine)
+{
+	if (!timeToDie)
+		refineFiles(refine);
+
+	finishWork();
+}
+
+void ScanPipeline::refineFiles(const QStringList paths)
+{
+	foreach (QString path, paths) {
+		if (pendingRefinements.contains(path))
+			continue;
+
+		InputFileItemPtr item = model.getItem(path);
+
+		if (item->getStatus() != Ready || !item->getMissingSamples())
+			continue;
+
+		quint32 samples = item->getMissingSamples();
+		// Missing samples are numbered by the profile the first ones were taken with.
+		FINGERPRINT_PROFILE itemProfile = item->getFingerprintProfile();
+		quint32 coarseSamples = FingerprintProfile::get(itemProfile).coarseSamples;
+
+		// Files that were only listened to so far start with a coarse look like everything else.
+		if (!item->getFingerprintSamples() && progressive && (samples & coarseSamples))
+			samples &= coarseSamples;
+
+		// The rest of a fingerprint has to come from the engine that started it.
+		FINGERPRINT_ENGINE itemEngine = item->getFingerprintSamples() ? item->getFingerprintEngine() : engine;
+
+		pendingRefinements.insert(path);
+		scheduleFile(path, samples, itemEngine, itemProfile);
+	}
+}
+
+void ScanPipeline::addDuplicates(const InputFileItemPtr item, const QVector<InputFileItemPtr> duplicates)
+{
+	QVector<InputFileItemPtr> remaining;
+
+	if (!duplicateGroups)
+		return;
+
+	TRACE_SPAN("group update", item->getPath());
+
+	// Files removed since they were compared mustn't come back as a group.
+	if (!model.getCancelToken(item->getPath()))
+		return;
+
+	foreach (InputFileItemPtr duplicate, duplicates) {
+		if (model.getCancelToken(duplicate->getPath()))
+			remaining.append(duplicate);
+	}
+
+	duplicateGroups->addDuplicates(item, remaining);
+}
+
+void ScanPipeline::updateConcurrency()
+{
+	FileScheduler::Stats stats = scheduler.getStats();
+	FileScheduler::Stats poolStats = workerPool.getStats();
+
+	// The counts of the two only ever go up, so their sum does too.
+	for (int stage = 0; stage < FileScheduler::STAGE_COUNT; stage++) {
+		stats.running[stage] += poolStats.running[stage];
+		stats.queued[stage] = stats.queued[stage] || poolStats.queued[stage];
+		stats.files[stage] += poolStats.files[stage];
+		stats.bytes[stage] += poolStats.bytes[stage];
+	}
+
+	concurrency.update(stats, concurrencyClock.restart());
+	applyConcurrency();
+}
+
+/*
+ * Both ways of decoding files are given the limits, whichever isn't in use just
+ * has nothing queued. The thread pool has room for every consumer on top of the
+ * threads comparing fingerprints, which would otherwise wait behind them.
+ */
+void ScanPipeline::applyConcurrency()
+{
+	int probes = concurrency.getLimit(FileScheduler::STAGE_PROBE);
+	int fingerprints = concurrency.getLimit(FileScheduler::STAGE_FINGERPRINT);
+
+	QThreadPool::globalInstance()->setMaxThreadCount(QThread::idealThreadCount() + probes + fingerprints);
+
+	scheduler.setStageLimits(probes, fingerprints);
+	workerPool.setStageLimits(probes, fingerprints);
+
+	startConsumer(timeBudget, byteBudget);
+
+	emit concurrencyChanged();
+}
+
+void ScanPipeline::finishWork()
+{
+	if (--outstanding == 0)
+		emit finished();
+}
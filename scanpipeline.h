@@ -0,0 +1,115 @@
+#ifndef SCANPIPELINE_H
+#define SCANPIPELINE_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+#include <atomic>
+
+#include "concurrencycontroller.h"
+#include "filescheduler.h"
+#include "inputfilesmodel.h"
+#include "workerpool.h"
+
+class ClosestPairs;
+class DuplicateGroupsModel;
+class FingerprintCache;
+class PairStore;
+class ThumbnailStore;
+
+/*
+ * Takes files from being added to being compared: each is probed and then
+ * fingerprinted through FileScheduler, in this process or in WorkerPool's
+ * helpers, with as many files read and decoded at once as ConcurrencyController
+ * settles on. Finished fingerprints go to the fingerprint cache and thumbnails to
+ * the thumbnail store, and each file is compared as its fingerprint comes in. The
+ * pairs found go to PairStore, and to the closest pairs or the duplicate groups,
+ * and files that might match are refined. Whatever it's given nothing of is left
+ * out.
+ *
+ * The main window and --scan both drive this, so the benchmark measures the scan
+ * users get. Everything but the comparing and decoding runs on the thread that
+ * made it.
+ */
+class ScanPipeline: public QObject
+{
+	Q_OBJECT
+
+	public:
+		ScanPipeline(InputFilesModel &model, PairStore &pairStore, QObject *parent = nullptr);
+
+		void setFingerprintCache(FingerprintCache *fingerprintCache) { this->fingerprintCache = fingerprintCache; }
+		void setThumbnailStore(ThumbnailStore *thumbnailStore) { this->thumbnailStore = thumbnailStore; }
+		void setDuplicateGroups(DuplicateGroupsModel *duplicateGroups) { this->duplicateGroups = duplicateGroups; }
+		void setClosestPairs(ClosestPairs *closestPairs) { this->closestPairs = closestPairs; }
+
+		void setBudget(const qint64 timeBudget, const qint64 byteBudget);
+		void setMemoryBudget(const qint64 bytes);
+		void setFingerprinting(const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile, const bool progressive, const bool audioFirst);
+		void setIsolateDecoders(const bool isolateDecoders) { this->isolateDecoders = isolateDecoders; }
+		void setConcurrencyBounds(const int maxProbes, const int maxFingerprints);
+		const ConcurrencyController &getConcurrency() const { return concurrency; }
+
+		void add(const QString path, const bool reference = false);
+		void compareAll();
+		void setVisible(const QStringList paths);
+		void prune();
+		void clear();
+		void stop();
+
+	signals:
+		void fileInfoAdded(InputFileItemPtr item);
+		void fileUpdated(const InputFileItemPtr item);
+		void compared(const QStringList refine);
+		void duplicatesFound(const InputFileItemPtr item, const QVector<InputFileItemPtr> duplicates);
+		void closestPairsChanged();
+		void concurrencyChanged();
+		// Nothing is queued, decoding or being compared. Files removed on the way are
+		// never finished, so this is only for scans where nothing is removed.
+		void finished();
+
+	private:
+		InputFilesModel &model;
+		PairStore &pairStore;
+		FingerprintCache *fingerprintCache;
+		ThumbnailStore *thumbnailStore;
+		DuplicateGroupsModel *duplicateGroups;
+		ClosestPairs *closestPairs;
+		FileScheduler scheduler;
+		WorkerPool workerPool;
+		ConcurrencyController concurrency;
+		QTimer concurrencyTimer;
+		QElapsedTimer concurrencyClock;
+		QSet<QString> pendingRefinements;
+		qint64 timeBudget;
+		qint64 byteBudget;
+		FINGERPRINT_ENGINE engine;
+		FINGERPRINT_PROFILE profile;
+		bool progressive;
+		bool audioFirst;
+		bool isolateDecoders;
+		std::atomic<bool> timeToDie;
+		// Files scheduled and comparisons running that haven't finished yet.
+		int outstanding;
+
+		void scheduleProbe(const QString path);
+		void scheduleFile(const QString path, const quint32 samples, const FINGERPRINT_ENGINE engine, const FINGERPRINT_PROFILE profile, const bool audioFirst = false);
+		void schedule(const FileScheduler::Job job);
+		void startConsumer(const qint64 timeBudget, const qint64 byteBudget);
+		void processFiles(const qint64 timeBudget, const qint64 byteBudget);
+		void compare(const QString path);
+		void finishWork();
+
+	private slots:
+		void addFileInfo(const InputFileItemPtr item);
+		void finishComparing(const QStringList refine);
+		void refineFiles(const QStringList paths);
+		void addDuplicates(const InputFileItemPtr item, const QVector<InputFileItemPtr> duplicates);
+		void updateConcurrency();
+		void applyConcurrency();
+};
+
+#endif // SCANPIPELINE_H
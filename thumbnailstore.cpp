@@ -0,0 +1,98 @@
+#include <QDataStream>
+#include <QDir>
+
+#include "thumbnailstore.h"
+
+const qint64 ThumbnailStore::PAGE_SIZE = 4096;
+static const quint32 INDEX_MAGIC = 0x53445448;
+// Went to 2 when the index moved to KeyedLog, whose records carry their length.
+static const quint32 INDEX_VERSION = 2;
+
+ThumbnailStore::ThumbnailStore()
+{
+	pages = 0;
+}
+
+bool ThumbnailStore::open(const QString directory)
+{
+	if (!QDir().mkpath(directory))
+		return false;
+
+	data.setFileName(QDir(directory).filePath("thumbnails.dat"));
+
+	if (!data.open(QIODevice::ReadWrite) || !index.open(QDir(directory).filePath("thumbnails.idx"), INDEX_MAGIC, INDEX_VERSION))
+		return false;
+
+	foreach (QByteArray key, index.getKeys()) {
+		QDataStream in(index.get(key));
+		Entry entry;
+
+		in.setVersion(QDataStream::Qt_5_0);
+		in >> entry.page >> entry.length;
+
+		if (in.status() == QDataStream::Ok && entry.page * PAGE_SIZE + entry.length <= data.size())
+			entries.insert(key, entry);
+	}
+
+	// Nothing points into the data any more, such as when the index was started over.
+	if (entries.isEmpty())
+		data.resize(0);
+
+	pages = getPageCount(data.size());
+
+	return true;
+}
+
+bool ThumbnailStore::contains(const QByteArray key) const
+{
+	return entries.contains(key);
+}
+
+QByteArray ThumbnailStore::get(const QByteArray key)
+{
+	QHash<QByteArray, Entry>::const_iterator entry = entries.constFind(key);
+
+	if (entry == entries.constEnd() || !data.seek(entry->page * PAGE_SIZE))
+		return QByteArray();
+
+	return data.read(entry->length);
+}
+
+void ThumbnailStore::insert(const QByteArray key, const QByteArray thumbnail)
+{
+	if (!data.isOpen() || !index.isOpen() || thumbnail.isEmpty())
+		return;
+
+	QHash<QByteArray, Entry>::const_iterator existing = entries.constFind(key);
+	Entry entry;
+
+	entry.length = static_cast<quint32>(thumbnail.size());
+
+	if (existing != entries.constEnd() && getPageCount(entry.length) <= getPageCount(existing->length)) {
+		entry.page = existing->page;
+	} else {
+		entry.page = pages;
+		pages += getPageCount(entry.length);
+	}
+
+	// New pages are padded out, so the data file always ends on a page boundary.
+	if (!data.seek(entry.page * PAGE_SIZE) || data.write(thumbnail) != thumbnail.size())
+		return;
+
+	if (entry.page + getPageCount(entry.length) == pages && data.size() < pages * PAGE_SIZE)
+		data.resize(pages * PAGE_SIZE);
+
+	QByteArray record;
+	QDataStream out(&record, QIODevice::WriteOnly);
+
+	out.setVersion(QDataStream::Qt_5_0);
+	out << entry.page << entry.length;
+
+	if (index.append(key, record))
+		entries.insert(key, entry);
+}
+
+quint32 ThumbnailStore::getPageCount(const qint64 length)
+{
+	return static_cast<quint32>((length + PAGE_SIZE - 1) / PAGE_SIZE);
+}
@@ -0,0 +1,46 @@
+#ifndef THUMBNAILSTORE_H
+#define THUMBNAILSTORE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+#include "keyedlog.h"
+
+/*
+ * On disk store of compressed thumbnails, keyed by getFileCacheKey(). Thumbnails
+ * are written to a data file in whole pages, so one can be read back with a single
+ * seek, and a thumbnail that's replaced by one no larger reuses its pages. Where
+ * each thumbnail lives is appended to a small KeyedLog as it's written, which is
+ * read back into memory when the store is opened.
+ *
+ * Only used from the GUI thread.
+ */
+class ThumbnailStore
+{
+	public:
+		static const qint64 PAGE_SIZE;
+
+		ThumbnailStore();
+
+		bool open(const QString directory);
+		bool contains(const QByteArray key) const;
+		QByteArray get(const QByteArray key);
+		void insert(const QByteArray key, const QByteArray thumbnail);
+
+	private:
+		struct Entry {
+			quint32 page;
+			quint32 length;
+		};
+
+		QFile data;
+		KeyedLog index;
+		QHash<QByteArray, Entry> entries;
+		quint32 pages;
+
+		static quint32 getPageCount(const qint64 length);
+};
+
+#endif // THUMBNAILSTORE_H
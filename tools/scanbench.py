@@ -0,0 +1,357 @@
+#!/usr/bin/env python3
+"""
+End to end scan benchmark.
+
+    scanbench.py corpus <directory> [--sources N] [--duplicates FRACTION]
+                        [--images FRACTION] [--audio FRACTION] [--seed N] [--jobs N]
+    scanbench.py run <directory> --binary <SameDifference> [--threshold N]
+                     [--threads N] [--method fast|thorough]
+                     [--profile fast|default|archive]
+                     [--decoders inprocess|isolated] [--fingerprints full|progressive]
+                     [--label TEXT] [--history FILE]
+
+corpus makes a test corpus in <directory> with the ffmpeg command line tool.
+Every source is a clip or picture of its own, drawn from a seeded pattern and
+encoded with a codec, container and resolution picked at random from what the
+local ffmpeg can write. Some clips have a soundtrack of seeded tones, so the
+audio prefilter has something to match. Some sources also get near-duplicates
+made from the encoded original: re-encodes at low quality, rescales, and for
+clips trims. Most copies of a clip with sound keep it, some lose it.
+The media go in <directory>/media and which files belong together is written
+to <directory>/truth.tsv. Files are written to <directory>/partial and moved
+into place once they're done. The same arguments always make the same corpus,
+and files that are already there are kept, so an interrupted run can be resumed.
+
+run scans <directory>/media with SameDifference --scan, which probes,
+schedules, decodes and compares the files the way the main window does, and
+reports files per second, peak resident memory, time to the first pair found,
+the read and decode limits the scan settled on and the precision and recall of
+the pairs found against the planted ones. With --history every run is appended
+to FILE as a line of JSON, for tracking scan throughput from release to release.
+"""
+
+import argparse
+import concurrent.futures
+import datetime
+import itertools
+import json
+import os
+import random
+import resource
+import shutil
+import subprocess
+import sys
+import time
+
+# Encoder, container and the options that make it a normal and a poor quality encode.
+VIDEO_FORMATS = [
+    ("libx264", "mp4", ["-crf", "23", "-pix_fmt", "yuv420p"], ["-crf", "38", "-pix_fmt", "yuv420p"]),
+    ("libx264", "mkv", ["-crf", "23", "-pix_fmt", "yuv420p"], ["-crf", "38", "-pix_fmt", "yuv420p"]),
+    ("libx265", "mkv", ["-crf", "28", "-pix_fmt", "yuv420p"], ["-crf", "40", "-pix_fmt", "yuv420p"]),
+    ("libvpx", "webm", ["-b:v", "1M"], ["-b:v", "150k"]),
+    ("libvpx-vp9", "webm", ["-crf", "32", "-b:v", "0"], ["-crf", "55", "-b:v", "0"]),
+    ("mpeg4", "avi", ["-q:v", "4"], ["-q:v", "20"]),
+    ("mpeg2video", "mpg", ["-q:v", "4"], ["-q:v", "20"]),
+    ("mjpeg", "mov", ["-q:v", "4", "-pix_fmt", "yuvj420p"], ["-q:v", "25", "-pix_fmt", "yuvj420p"]),
+    ("flv", "flv", ["-q:v", "4"], ["-q:v", "20"]),
+]
+
+IMAGE_FORMATS = [
+    ("png", "png", [], ["-compression_level", "0"]),
+    ("mjpeg", "jpg", ["-q:v", "3"], ["-q:v", "25"]),
+    ("libwebp", "webp", ["-quality", "80"], ["-quality", "10"]),
+    ("bmp", "bmp", [], []),
+    ("tiff", "tiff", [], []),
+]
+
+# Audio encoders each container can take, the first the local ffmpeg has is used.
+AUDIO_ENCODERS = {
+    "mp4": ["aac"],
+    "mkv": ["aac", "libopus"],
+    "webm": ["libopus", "libvorbis"],
+    "avi": ["libmp3lame", "mp2", "ac3"],
+    "mpg": ["mp2"],
+    "mov": ["aac", "pcm_s16le"],
+    "flv": ["libmp3lame", "aac"],
+}
+
+# How many copies of a clip with sound keep it.
+AUDIO_KEPT = 0.8
+
+RESOLUTIONS = [(320, 180), (480, 360), (640, 360), (640, 480), (854, 480), (720, 576), (1280, 720), (1920, 1080), (512, 512)]
+
+# Patterns are drawn this small and scaled up, the expression is evaluated for every pixel.
+PATTERN_SIZE = (160, 90)
+# MPEG-2 only takes the broadcast rates.
+FRAME_RATE = 25
+
+
+def available_encoders(ffmpeg):
+    output = subprocess.run([ffmpeg, "-hide_banner", "-encoders"], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True).stdout
+    encoders = set()
+
+    for line in output.splitlines():
+        fields = line.split()
+
+        if len(fields) >= 2 and len(fields[0]) == 6:
+            encoders.add(fields[1])
+
+    return encoders
+
+
+def pattern(rng, duration):
+    """A lavfi source of slowly moving interference bands, different for every seed."""
+    a, c = rng.uniform(3, 30), rng.uniform(3, 30)
+    b, d = rng.uniform(0.1, 1.5), rng.uniform(0.1, 1.5)
+    e, f = rng.uniform(0, 6.28), rng.uniform(0, 6.28)
+    start = rng.uniform(0, 100)
+    lum = "128+60*sin(X/%.3f+(T+%.2f)*%.3f+%.3f)+60*cos(Y/%.3f-(T+%.2f)*%.3f+%.3f)" % (a, start, b, e, c, start, d, f)
+
+    return "nullsrc=s=%dx%d:r=%d:d=%.2f,geq=lum='%s':cb=%d:cr=%d" % (
+        PATTERN_SIZE[0], PATTERN_SIZE[1], FRAME_RATE, duration, lum, rng.randint(64, 192), rng.randint(64, 192))
+
+
+def tones(rng, duration):
+    """A lavfi source of two tones, one of them pulsing, different for every seed."""
+    return "aevalsrc='0.4*sin(2*PI*%.1f*t)*(0.6+0.4*sin(2*PI*%.2f*t))+0.3*sin(2*PI*%.1f*t)':s=44100:d=%.2f" % (
+        rng.uniform(110, 880), rng.uniform(0.5, 4), rng.uniform(220, 1760), duration)
+
+
+def audio_encoder(extension, encoders):
+    return next((encoder for encoder in AUDIO_ENCODERS.get(extension, []) if encoder in encoders), None)
+
+
+def plan(media, sources, duplicates, images, audio, seed, encoders):
+    """Every file to make as (group, name, variant, arguments), originals before their copies."""
+    videos = [f for f in VIDEO_FORMATS if f[0] in encoders]
+    pictures = [f for f in IMAGE_FORMATS if f[0] in encoders]
+
+    if not videos or not pictures:
+        sys.exit("ffmpeg has none of the video or none of the image encoders we use")
+
+    for group in range(sources):
+        rng = random.Random(seed * 1000003 + group)
+        image = rng.random() < images
+        encoder, extension, good, poor = rng.choice(pictures if image else videos)
+        width, height = rng.choice(RESOLUTIONS)
+        duration = 1 if image else rng.uniform(6, 30)
+        directory = "%03d" % (group // 1000)
+        original = os.path.join(directory, "s%06d_original.%s" % (group, extension))
+        scale = ["-vf", "scale=%d:%d" % (width, height)]
+        frames = ["-frames:v", "1"] if image else []
+        sound = audio_encoder(extension, encoders) if not image and rng.random() < audio else None
+        inputs = ["-f", "lavfi", "-i", pattern(rng, duration)]
+
+        if sound:
+            inputs += ["-f", "lavfi", "-i", tones(rng, duration), "-map", "0:v", "-map", "1:a", "-c:a", sound, "-b:a", "128k", "-shortest"]
+        else:
+            inputs += ["-an"]
+
+        yield group, original, "original", inputs + scale + frames + ["-c:v", encoder] + good
+
+        if rng.random() >= duplicates:
+            continue
+
+        variants = ["reencode", "rescale"] if image else ["reencode", "rescale", "trim"]
+
+        for variant in rng.sample(variants, rng.randint(1, len(variants))):
+            encoder, extension, good, poor = rng.choice(pictures if image else videos)
+            name = os.path.join(directory, "s%06d_%s.%s" % (group, variant, extension))
+            source = ["-i", os.path.join(media, original)]
+            copy_sound = audio_encoder(extension, encoders) if sound and rng.random() < AUDIO_KEPT else None
+            sound_quality = "48k" if variant == "reencode" else "128k"
+            soundtrack = ["-c:a", copy_sound, "-b:a", sound_quality] if copy_sound else ["-an"]
+
+            if variant == "reencode":
+                arguments = source + soundtrack + ["-c:v", encoder] + poor
+            elif variant == "rescale":
+                width, height = rng.choice(RESOLUTIONS)
+                arguments = source + soundtrack + ["-vf", "scale=%d:%d" % (width, height), "-c:v", encoder] + good
+            else:
+                # Either end of a clip is cut, by up to a sixth of its length.
+                cut = rng.uniform(0.05, 0.17) * duration
+                trim = ["-ss", "%.2f" % cut] if rng.random() < 0.5 else ["-t", "%.2f" % (duration - cut)]
+                arguments = trim + source + soundtrack + ["-c:v", encoder] + good
+
+            yield group, name, variant, arguments
+
+
+def make(ffmpeg, media, partial, name, arguments):
+    path = os.path.join(media, name)
+
+    if os.path.exists(path):
+        return True
+
+    # Written outside the media first, so an interrupted run never leaves half a file to be scanned.
+    temporary = os.path.join(partial, name.replace(os.sep, "_"))
+    command = [ffmpeg, "-hide_banner", "-loglevel", "error", "-nostdin", "-y", "-threads", "1"] + arguments + [temporary]
+
+    if subprocess.run(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode != 0:
+        if os.path.exists(temporary):
+            os.remove(temporary)
+
+        return False
+
+    os.replace(temporary, path)
+
+    return True
+
+
+def make_corpus(options):
+    media = os.path.join(options.directory, "media")
+    partial = os.path.join(options.directory, "partial")
+    encoders = available_encoders(options.ffmpeg)
+    files = list(plan(media, options.sources, options.duplicates, options.images, options.audio, options.seed, encoders))
+    made = {}
+
+    for directory in set(os.path.dirname(name) for _, name, _, _ in files):
+        os.makedirs(os.path.join(media, directory), exist_ok=True)
+
+    # Whatever an interrupted run was writing is started again.
+    shutil.rmtree(partial, ignore_errors=True)
+    os.makedirs(partial)
+
+    started = time.monotonic()
+
+    # Copies are made from their original, so each group is made in order on one thread.
+    with concurrent.futures.ThreadPoolExecutor(options.jobs) as executor:
+        def make_group(entries):
+            results = []
+
+            for group, name, variant, arguments in entries:
+                if variant != "original" and not results[0][3]:
+                    break
+
+                results.append((group, name, variant, make(options.ffmpeg, media, partial, name, arguments)))
+
+            return results
+
+        groups = [executor.submit(make_group, list(entries)) for _, entries in itertools.groupby(files, key=lambda f: f[0])]
+
+        for done, future in enumerate(concurrent.futures.as_completed(groups), 1):
+            for group, name, variant, ok in future.result():
+                if ok:
+                    made[name] = (group, variant)
+
+            if done % 500 == 0 or done == len(groups):
+                print("%d of %d sources, %d files, %.0f s" % (done, len(groups), len(made), time.monotonic() - started), file=sys.stderr)
+
+    with open(os.path.join(options.directory, "truth.tsv"), "w") as truth:
+        for name in sorted(made):
+            truth.write("%d\t%s\t%s\n" % (made[name][0], made[name][1], name))
+
+    print("%d files in %s, %d failed" % (len(made), media, len(files) - len(made)), file=sys.stderr)
+
+
+def read_truth(directory):
+    groups = {}
+
+    with open(os.path.join(directory, "truth.tsv")) as truth:
+        for line in truth:
+            group, _, name = line.rstrip("\n").split("\t")
+            groups.setdefault(int(group), []).append(name)
+
+    pairs = set()
+
+    for names in groups.values():
+        for name, other in itertools.combinations(sorted(names), 2):
+            pairs.add((name, other))
+
+    return pairs
+
+
+def run_scan(options):
+    media = os.path.abspath(os.path.join(options.directory, "media"))
+    truth = read_truth(options.directory)
+    command = [options.binary, "--scan", media, str(options.threshold), str(options.threads), options.method, options.profile,
+               options.decoders, options.fingerprints]
+    process = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+
+    if process.returncode != 0:
+        sys.exit("%s failed:\n%s" % (" ".join(command), process.stderr))
+
+    # The figures are the last line on standard error, anything before it is FFmpeg or Qt talking.
+    figures = dict(field.split("=", 1) for field in process.stderr.strip().splitlines()[-1].split())
+    found = set()
+
+    for line in process.stdout.splitlines():
+        _, path, other = line.split("\t")
+        found.add(tuple(sorted((os.path.relpath(path, media), os.path.relpath(other, media)))))
+
+    correct = len(found & truth)
+    peak = float(figures["peak_rss_mb"])
+
+    if peak < 0:
+        # Not known on this platform, what the kernel says about our children is the next best thing.
+        peak = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss * (1 if sys.platform == "darwin" else 1024) / 1e6
+
+    result = {
+        "date": datetime.datetime.now().isoformat(timespec="seconds"),
+        "label": options.label,
+        "threshold": options.threshold,
+        "threads": options.threads,
+        "method": options.method,
+        "profile": options.profile,
+        "decoders": options.decoders,
+        "fingerprints": options.fingerprints,
+        "files": int(figures["files"]),
+        "fingerprinted": int(figures["fingerprinted"]),
+        "seconds": float(figures["seconds"]),
+        "files_per_second": float(figures["files_per_second"]),
+        "first_pair_seconds": float(figures["first_pair_seconds"]),
+        "peak_rss_mb": peak,
+        "read_limit": int(figures["read_limit"]),
+        "decode_limit": int(figures["decode_limit"]),
+        "pairs_found": len(found),
+        "pairs_planted": len(truth),
+        "precision": correct / len(found) if found else 1.0,
+        "recall": correct / len(truth) if truth else 1.0,
+    }
+
+    print("%(files)d files (%(fingerprinted)d fingerprinted) in %(seconds).1f s, %(files_per_second).1f files/s" % result)
+    print("first pair after %(first_pair_seconds).2f s, peak RSS %(peak_rss_mb).0f MB" % result)
+    print("settled on reading %(read_limit)d and decoding %(decode_limit)d files at a time" % result)
+    print("%(pairs_found)d pairs found, %(pairs_planted)d planted, precision %(precision).3f, recall %(recall).3f" % result)
+
+    if options.history:
+        with open(options.history, "a") as history:
+            history.write(json.dumps(result, sort_keys=True) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End to end scan benchmark")
+    commands = parser.add_subparsers(dest="command")
+    commands.required = True
+
+    corpus = commands.add_parser("corpus", help="make a test corpus")
+    corpus.add_argument("directory")
+    corpus.add_argument("--sources", type=int, default=20000, help="files that aren't copies of another")
+    corpus.add_argument("--duplicates", type=float, default=0.3, help="fraction of sources that get near-duplicates")
+    corpus.add_argument("--images", type=float, default=0.5, help="fraction of sources that are pictures")
+    corpus.add_argument("--audio", type=float, default=0.5, help="fraction of clips with a soundtrack")
+    corpus.add_argument("--seed", type=int, default=1)
+    corpus.add_argument("--jobs", type=int, default=os.cpu_count())
+    corpus.add_argument("--ffmpeg", default="ffmpeg")
+
+    run = commands.add_parser("run", help="scan a test corpus")
+    run.add_argument("directory")
+    run.add_argument("--binary", required=True)
+    run.add_argument("--threshold", type=int, default=50)
+    run.add_argument("--threads", type=int, default=os.cpu_count(), help="most files decoded at once")
+    run.add_argument("--method", choices=["fast", "thorough"], default="fast")
+    run.add_argument("--profile", choices=["fast", "default", "archive"], default="default")
+    run.add_argument("--decoders", choices=["inprocess", "isolated"], default="inprocess", help="decode in this process or in helper processes")
+    run.add_argument("--fingerprints", choices=["full", "progressive"], default="full", help="decode every sample at once or coarse ones first")
+    run.add_argument("--label", default="", help="stored with the results, such as the version scanned")
+    run.add_argument("--history", help="file to append the results to")
+
+    options = parser.parse_args()
+
+    if options.command == "corpus":
+        make_corpus(options)
+    else:
+        run_scan(options)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,233 @@
+#include <QByteArrayList>
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "tracer.h"
+
+const int Tracer::BUFFER_SIZE = 8192;
+std::atomic<bool> Tracer::enabled(false);
+
+// Events from helper processes are kept up to this many bytes of JSON, the oldest are dropped first.
+static const int REMOTE_LIMIT = 64 << 20;
+static const int FILE_LENGTH = 72;
+
+struct TraceEvent {
+	const char *name;
+	qint64 start;
+	qint64 end;
+	// The end of the path, which is the part that tells files apart.
+	char file[FILE_LENGTH];
+};
+
+/*
+ * Only the owning thread writes to a buffer. It fills in the slot and then
+ * publishes it by moving head on, so a reader copies what's below head and
+ * then throws away anything the writer may have lapped in the meantime.
+ * Buffers are kept for the life of the process, so the events of a thread
+ * that has finished can still be saved.
+ */
+struct TraceBuffer {
+	std::atomic<quint64> head;
+	quint64 taken;
+	int thread;
+	QString threadName;
+	TraceEvent *events;
+};
+
+static QMutex buffersMutex;
+static QVector<TraceBuffer *> buffers;
+static QList<QByteArray> remoteEvents;
+static int remoteSize = 0;
+static thread_local TraceBuffer *threadBuffer = nullptr;
+
+static TraceBuffer *getThreadBuffer()
+{
+	if (threadBuffer)
+		return threadBuffer;
+
+	QMutexLocker lock(&buffersMutex);
+	QThread *thread = QThread::currentThread();
+
+	threadBuffer = new TraceBuffer();
+	threadBuffer->head = 0;
+	threadBuffer->taken = 0;
+	threadBuffer->thread = buffers.length() + 1;
+	threadBuffer->events = new TraceEvent[Tracer::BUFFER_SIZE];
+
+	if (!thread->objectName().isEmpty())
+		threadBuffer->threadName = thread->objectName();
+
+	else if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+		threadBuffer->threadName = "Main thread";
+
+	else
+		threadBuffer->threadName = QString("Thread %1").arg(threadBuffer->thread);
+
+	buffers.append(threadBuffer);
+
+	return threadBuffer;
+}
+
+// Copies out the events from index from on and moves from past them.
+static QVector<TraceEvent> readEvents(TraceBuffer *buffer, quint64 &from)
+{
+	quint64 size = static_cast<quint64>(Tracer::BUFFER_SIZE);
+	quint64 end = buffer->head.load(std::memory_order_acquire);
+	quint64 begin = std::max(from, end > size ? end - size : 0);
+	QVector<TraceEvent> events;
+
+	for (quint64 i = begin; i < end; i++)
+		events.append(buffer->events[i % size]);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	// The slot being written now, and everything after it, held events older than head - size.
+	quint64 head = buffer->head.load(std::memory_order_relaxed);
+	quint64 valid = head >= size ? head - size + 1 : 0;
+
+	if (valid > begin)
+		events.remove(0, static_cast<int>(std::min<quint64>(valid - begin, static_cast<quint64>(events.length()))));
+
+	from = end;
+
+	return events;
+}
+
+static QByteArray escape(const QByteArray text)
+{
+	QByteArray escaped;
+
+	for (int i = 0; i < text.length(); i++) {
+		char c = text[i];
+
+		if (c == '"' || c == '\\')
+			escaped.append('\\').append(c);
+
+		else if (static_cast<unsigned char>(c) < 0x20)
+			escaped.append(QString("\\u%1").arg(static_cast<int>(c), 4, 16, QChar('0')).toLatin1());
+
+		else
+			escaped.append(c);
+	}
+
+	return escaped;
+}
+
+static QByteArray toJson(const TraceBuffer *buffer, const QVector<TraceEvent> events)
+{
+	QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+	QByteArray tid = QByteArray::number(buffer->thread);
+	QByteArray json;
+
+	if (events.isEmpty())
+		return json;
+
+	json.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid +
+				",\"args\":{\"name\":\"" + escape(buffer->threadName.toUtf8()) + "\"}}");
+
+	foreach (TraceEvent event, events) {
+		// Timestamps are in microseconds, the clock is shared by every process on the machine.
+		json.append(",\n{\"name\":\"" + escape(event.name) + "\",\"cat\":\"scan\",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":" + tid +
+					",\"ts\":" + QByteArray::number(event.start / 1000.0, 'f', 3) +
+					",\"dur\":" + QByteArray::number((event.end - event.start) / 1000.0, 'f', 3));
+
+		if (event.file[0])
+			json.append(",\"args\":{\"file\":\"" + escape(event.file) + "\"}");
+
+		json.append("}");
+	}
+
+	return json;
+}
+
+void Tracer::setEnabled(const bool enabled)
+{
+	Tracer::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+qint64 Tracer::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(const char *name, const QString &file, const qint64 start, const qint64 end)
+{
+	TraceBuffer *buffer = getThreadBuffer();
+	quint64 head = buffer->head.load(std::memory_order_relaxed);
+	TraceEvent &event = buffer->events[head % static_cast<quint64>(BUFFER_SIZE)];
+	QByteArray path = file.toUtf8();
+	int length = std::min(path.length(), FILE_LENGTH - 1);
+
+	event.name = name;
+	event.start = start;
+	event.end = end;
+
+	memcpy(event.file, path.constData() + path.length() - length, static_cast<size_t>(length));
+	event.file[length] = '\0';
+
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// The events recorded since the last call, as JSON for append() in another process.
+QByteArray Tracer::take()
+{
+	QMutexLocker lock(&buffersMutex);
+	QByteArray json;
+
+	foreach (TraceBuffer *buffer, buffers) {
+		QByteArray events = toJson(buffer, readEvents(buffer, buffer->taken));
+
+		if (!events.isEmpty())
+			json.append(json.isEmpty() ? events : ",\n" + events);
+	}
+
+	return json;
+}
+
+void Tracer::append(const QByteArray events)
+{
+	QMutexLocker lock(&buffersMutex);
+
+	if (events.isEmpty())
+		return;
+
+	remoteEvents.append(events);
+	remoteSize += events.size();
+
+	while (remoteSize > REMOTE_LIMIT && remoteEvents.length() > 1)
+		remoteSize -= remoteEvents.takeFirst().size();
+}
+
+bool Tracer::save(const QString path)
+{
+	QFile file(path);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	QMutexLocker lock(&buffersMutex);
+	QByteArrayList chunks = remoteEvents;
+
+	foreach (TraceBuffer *buffer, buffers) {
+		quint64 from = 0;
+		QByteArray events = toJson(buffer, readEvents(buffer, from));
+
+		if (!events.isEmpty())
+			chunks.append(events);
+	}
+
+	lock.unlock();
+
+	file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	file.write(chunks.join(",\n"));
+	file.write("\n]}\n");
+
+	return file.error() == QFileDevice::NoError;
+}
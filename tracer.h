@@ -0,0 +1,66 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <atomic>
+
+/*
+ * Optional timeline of a scan, saved in the Chrome trace format so it can be
+ * opened in chrome://tracing or Perfetto. Spans are recorded with TRACE_SPAN()
+ * into a ring buffer owned by the recording thread, so recording never takes a
+ * lock and only the newest events are kept. While tracing is off a span costs
+ * one relaxed load.
+ *
+ * Helper processes send their events back with each result, see take() and
+ * append(), so the saved timeline covers every process.
+ */
+class Tracer
+{
+	public:
+		static const int BUFFER_SIZE;
+
+		static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+		static void setEnabled(const bool enabled);
+		static qint64 now();
+		static void record(const char *name, const QString &file, const qint64 start, const qint64 end);
+
+		static QByteArray take();
+		static void append(const QByteArray events);
+		static bool save(const QString path);
+
+	private:
+		static std::atomic<bool> enabled;
+};
+
+class TraceSpan
+{
+	public:
+		TraceSpan(const char *name, const QString &file = QString()): name(name), start(0) {
+			if (Tracer::isEnabled()) {
+				this->file = file;
+				start = Tracer::now();
+			}
+		}
+
+		~TraceSpan() {
+			if (start)
+				Tracer::record(name, file, start, Tracer::now());
+		}
+
+	private:
+		const char *name;
+		QString file;
+		qint64 start;
+
+		Q_DISABLE_COPY(TraceSpan)
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Records the rest of the enclosing scope as a span, optionally naming the file it's for.
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+
+#endif // TRACER_H
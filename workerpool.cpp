@@ -0,0 +1,435 @@
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QThread>
+#include <QTimer>
+#include <QtEndian>
+
+#include <cstdio>
+
+#include "mediautility.h"
+#include "tracer.h"
+#include "workerpool.h"
+
+const int WorkerPool::BATCH_SIZE = 8;
+const int WorkerPool::HANG_TIMEOUT = 120000;
+const char *WorkerPool::WORKER_ARGUMENT = "--worker";
+static const QString TIME_BUDGET_ARGUMENT = "--time-budget";
+static const QString BYTE_BUDGET_ARGUMENT = "--byte-budget";
+static const QString TRACE_ARGUMENT = "--trace";
+
+/*
+ * Frames on the pipes are a 32 bit big endian length followed by a QDataStream
+ * payload. Requests carry a batch of files with what to take from each, responses
+ * a single InputFileItem followed by any trace events recorded since the last one.
+ */
+struct Request {
+	QString path;
+	bool probe;
+	quint32 samples;
+	bool audioFirst;
+	qint32 engine;
+	qint32 profile;
+};
+
+static QDataStream &operator<<(QDataStream &stream, const Request &request)
+{
+	return stream << request.path << request.probe << request.samples << request.audioFirst << request.engine << request.profile;
+}
+
+static QDataStream &operator>>(QDataStream &stream, Request &request)
+{
+	return stream >> request.path >> request.probe >> request.samples >> request.audioFirst >> request.engine >> request.profile;
+}
+
+static QByteArray frame(const QByteArray payload)
+{
+	QByteArray data(4, 0);
+
+	qToBigEndian<quint32>(static_cast<quint32>(payload.size()), reinterpret_cast<uchar *>(data.data()));
+
+	return data + payload;
+}
+
+static bool readFrame(FILE *file, QByteArray &payload)
+{
+	uchar header[4];
+
+	if (fread(header, 1, sizeof(header), file) != sizeof(header))
+		return false;
+
+	payload.resize(static_cast<int>(qFromBigEndian<quint32>(header)));
+
+	return fread(payload.data(), 1, static_cast<size_t>(payload.size()), file) == static_cast<size_t>(payload.size());
+}
+
+static bool writeFrame(FILE *file, const QByteArray payload)
+{
+	QByteArray data = frame(payload);
+
+	if (fwrite(data.constData(), 1, static_cast<size_t>(data.size()), file) != static_cast<size_t>(data.size()))
+		return false;
+
+	return fflush(file) == 0;
+}
+
+WorkerPool::WorkerPool(QObject *parent): QObject(parent)
+{
+	shuttingDown = false;
+	maxWorkers = QThread::idealThreadCount();
+	timeBudget = 0;
+	byteBudget = 0;
+}
+
+WorkerPool::~WorkerPool()
+{
+	shuttingDown = true;
+
+	clear();
+}
+
+int WorkerPool::runWorker()
+{
+	QByteArray request;
+	QStringList arguments = QCoreApplication::arguments();
+	int index = 0;
+	qint64 timeBudget = 0;
+	qint64 byteBudget = 0;
+
+	if ((index = arguments.indexOf(TIME_BUDGET_ARGUMENT)) >= 0 && index + 1 < arguments.length())
+		timeBudget = arguments[index + 1].toLongLong();
+
+	if ((index = arguments.indexOf(BYTE_BUDGET_ARGUMENT)) >= 0 && index + 1 < arguments.length())
+		byteBudget = arguments[index + 1].toLongLong();
+
+	Tracer::setEnabled(arguments.contains(TRACE_ARGUMENT));
+
+	// Each response is flushed on its own, so a crash only loses the file being decoded.
+	while (readFrame(stdin, request)) {
+		QList<Request> batch;
+		QDataStream in(request);
+
+		in >> batch;
+
+		foreach (const Request &file, batch) {
+			QByteArray response;
+			QDataStream out(&response, QIODevice::WriteOnly);
+			InputFileItem item(file.path);
+
+			{
+				TRACE_SPAN(file.probe ? "probe file" : "fingerprint file", file.path);
+
+				if (file.probe)
+					item.probe(MediaUtility::PROBE_SIZE, timeBudget);
+
+				else
+					item.getInfo(timeBudget, byteBudget, nullptr, file.samples, file.audioFirst, static_cast<FINGERPRINT_ENGINE>(file.engine), static_cast<FINGERPRINT_PROFILE>(file.profile));
+			}
+
+			out << item << Tracer::take();
+
+			if (!writeFrame(stdout, response))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+void WorkerPool::setBudget(const qint64 timeBudget, const qint64 byteBudget)
+{
+	// Running helpers keep their old budget, new ones pick this up when they're started.
+	this->timeBudget = timeBudget;
+	this->byteBudget = byteBudget;
+}
+
+/*
+ * Helpers already running are kept when the limits come down, the files handed
+ * to them are what's limited. They're only started as they're needed.
+ */
+void WorkerPool::setStageLimits(const int probes, const int fingerprints)
+{
+	pending.setStageLimits(probes, fingerprints);
+
+	maxWorkers = qMax(1, probes + fingerprints);
+
+	while (workers.length() < maxWorkers && workers.length() < pending.length())
+		startWorker();
+
+	dispatch();
+}
+
+void WorkerPool::enqueue(const FileScheduler::Job job)
+{
+	pending.push(job);
+
+	while (workers.length() < maxWorkers && workers.length() < pending.length())
+		startWorker();
+
+	dispatch();
+}
+
+static bool isCancelled(const CancelToken &token)
+{
+	return !token || *token;
+}
+
+void WorkerPool::prune()
+{
+	pending.prune();
+
+	// Helpers that only have removed files left are killed rather than left to finish them.
+	foreach (Worker *worker, workers) {
+		bool discard = !worker->inFlight.isEmpty();
+
+		foreach (FileScheduler::Job job, worker->inFlight) {
+			if (!isCancelled(job.token)) {
+				discard = false;
+
+				break;
+			}
+		}
+
+		if (discard) {
+			worker->discarded = true;
+			worker->process->kill();
+		}
+	}
+}
+
+void WorkerPool::clear()
+{
+	pending.clear();
+
+	foreach (Worker *worker, workers) {
+		stopWorker(worker);
+	}
+
+	workers.clear();
+}
+
+WorkerPool::Worker *WorkerPool::startWorker()
+{
+	Worker *worker = new Worker();
+
+	worker->process = new QProcess(this);
+	worker->watchdog = new QTimer(this);
+	worker->hung = false;
+	worker->discarded = false;
+
+	worker->watchdog->setSingleShot(true);
+	worker->watchdog->setInterval(static_cast<int>(qMax<qint64>(HANG_TIMEOUT, timeBudget * 2)));
+	worker->process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+
+	connect(worker->process, &QProcess::readyReadStandardOutput, this, [=]() {
+		readResults(worker);
+	});
+
+	connect(worker->process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, [=]() {
+		workerFinished(worker);
+	});
+
+	// finished() is never emitted for a helper that could not be started. This can be
+	// reported from within start(), so handle it once we're back in the event loop.
+	connect(worker->process, &QProcess::errorOccurred, this, [=](QProcess::ProcessError error) {
+		if (error == QProcess::FailedToStart)
+			workerFailedToStart(worker);
+	}, Qt::QueuedConnection);
+
+	// A helper that stops answering is killed, which is then handled like a crash.
+	connect(worker->watchdog, &QTimer::timeout, this, [=]() {
+		worker->hung = true;
+		worker->process->kill();
+	});
+
+	workers.append(worker);
+
+	QStringList arguments = QStringList() << WORKER_ARGUMENT
+										  << TIME_BUDGET_ARGUMENT << QString::number(timeBudget)
+										  << BYTE_BUDGET_ARGUMENT << QString::number(byteBudget);
+
+	// Like the budget, tracing is only picked up by helpers started after it's switched on.
+	if (Tracer::isEnabled())
+		arguments << TRACE_ARGUMENT;
+
+	worker->process->start(QCoreApplication::applicationFilePath(), arguments);
+
+	return worker;
+}
+
+void WorkerPool::stopWorker(Worker *worker)
+{
+	releaseInFlight(worker);
+
+	worker->process->disconnect(this);
+	worker->watchdog->stop();
+	worker->process->kill();
+	worker->process->waitForFinished();
+
+	worker->process->deleteLater();
+	worker->watchdog->deleteLater();
+
+	delete worker;
+}
+
+void WorkerPool::dispatch()
+{
+	foreach (Worker *worker, workers) {
+		dispatch(worker);
+	}
+}
+
+void WorkerPool::dispatch(Worker *worker)
+{
+	// Keep one batch queued behind the current file so helpers never wait on us.
+	// Helpers that are being killed get nothing, it would go down with them.
+	if (pending.length() == 0 || worker->inFlight.length() > 1 || worker->discarded)
+		return;
+
+	int batchSize = qBound(1, pending.length() / qMax(1, workers.length()), BATCH_SIZE);
+	QList<Request> batch;
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+
+	FileScheduler::Job job;
+
+	// The scheduler already skips cancelled files and hands out the most urgent ones first.
+	while (batch.length() < batchSize && pending.take(job)) {
+		Request request = { job.path, job.probe, job.samples, job.audioFirst, job.engine, job.profile };
+
+		batch.append(request);
+		worker->inFlight.append(job);
+	}
+
+	if (batch.isEmpty())
+		return;
+
+	out << batch;
+
+	worker->process->write(frame(payload));
+
+	if (!worker->watchdog->isActive())
+		worker->watchdog->start();
+}
+
+void WorkerPool::readResults(Worker *worker)
+{
+	worker->buffer.append(worker->process->readAllStandardOutput());
+
+	while (worker->buffer.size() >= 4) {
+		int length = static_cast<int>(qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(worker->buffer.constData())));
+
+		if (worker->buffer.size() < length + 4)
+			break;
+
+		// An answer to nothing we asked means we've lost track of the helper, so it's started over.
+		if (worker->inFlight.isEmpty()) {
+			worker->buffer.clear();
+			worker->discarded = true;
+			worker->process->kill();
+
+			return;
+		}
+
+		QDataStream in(worker->buffer.mid(4, length));
+		FileScheduler::Job job = worker->inFlight.takeFirst();
+		QSharedPointer<InputFileItem> item(new InputFileItem(job.path));
+		QByteArray events;
+
+		pending.finish(job);
+		worker->buffer.remove(0, length + 4);
+
+		in >> *item >> events;
+
+		Tracer::append(events);
+
+		if (!isCancelled(job.token))
+			emit fileInfoReady(item);
+	}
+
+	if (worker->inFlight.isEmpty())
+		worker->watchdog->stop();
+
+	else
+		worker->watchdog->start();
+
+	// Finished files free up memory, which other idle helpers may have been waiting on.
+	dispatch();
+}
+
+void WorkerPool::workerFinished(Worker *worker)
+{
+	workers.removeOne(worker);
+	releaseInFlight(worker);
+
+	// The first file in flight is the one the helper was decoding when it died.
+	if (!worker->inFlight.isEmpty() && !worker->discarded) {
+		FileScheduler::Job job = worker->inFlight.takeFirst();
+		QSharedPointer<InputFileItem> item(new InputFileItem(job.path));
+
+		if (worker->hung)
+			item->setFailed("Decoder stopped responding - will not compare for similarity.");
+
+		else
+			item->setFailed("Decoder crashed - will not compare for similarity.");
+
+		while (!worker->inFlight.isEmpty())
+			pending.push(worker->inFlight.takeFirst());
+
+		if (!isCancelled(job.token))
+			emit fileInfoReady(item);
+	}
+
+	worker->process->deleteLater();
+	worker->watchdog->deleteLater();
+
+	delete worker;
+
+	if (!shuttingDown && pending.length() > 0) {
+		startWorker();
+		dispatch();
+	}
+}
+
+void WorkerPool::workerFailedToStart(Worker *worker)
+{
+	// The helper may already have been stopped by clear() before this was delivered.
+	if (!workers.removeOne(worker))
+		return;
+
+	releaseInFlight(worker);
+
+	while (!worker->inFlight.isEmpty())
+		pending.push(worker->inFlight.takeFirst());
+
+	worker->process->deleteLater();
+	worker->watchdog->deleteLater();
+
+	delete worker;
+
+	// Don't keep respawning a helper that can't run, fail the remaining files instead.
+	if (workers.isEmpty()) {
+		foreach (FileScheduler::Job job, pending.takeAll()) {
+			if (isCancelled(job.token))
+				continue;
+
+			QSharedPointer<InputFileItem> item(new InputFileItem(job.path));
+
+			item->setFailed("Could not start decoder process - will not compare for similarity.");
+
+			emit fileInfoReady(item);
+		}
+	} else {
+		dispatch();
+	}
+}
+
+/*
+ * Gives back the memory of the files a helper had, whatever then happens to them.
+ * They don't count as finished, those that are queued again are counted when they are.
+ */
+void WorkerPool::releaseInFlight(Worker *worker)
+{
+	foreach (FileScheduler::Job job, worker->inFlight) {
+		pending.release(job);
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+
+#include "filescheduler.h"
+
+class QTimer;
+
+/*
+ * Runs InputFileItem::getInfo() in a pool of long-lived helper processes, so a
+ * file that crashes or deadlocks FFmpeg only takes down its helper. Helpers are
+ * fed batches of paths over stdin and answer with one serialised InputFileItem
+ * per path over stdout. A helper that dies or stops answering is restarted, and
+ * the file it was working on is reported as failed.
+ */
+class WorkerPool: public QObject
+{
+	Q_OBJECT
+
+	public:
+		static const int BATCH_SIZE;
+		static const int HANG_TIMEOUT;
+		static const char *WORKER_ARGUMENT;
+
+		explicit WorkerPool(QObject *parent = nullptr);
+		~WorkerPool();
+
+		static int runWorker();
+
+		void setBudget(const qint64 timeBudget, const qint64 byteBudget);
+		void setMemoryBudget(const qint64 bytes) { pending.setMemoryBudget(bytes); }
+		void setStageLimits(const int probes, const int fingerprints);
+		FileScheduler::Stats getStats() const { return pending.getStats(); }
+		void enqueue(const FileScheduler::Job job);
+		void setVisible(const QStringList paths) { pending.setVisible(paths); }
+		void prune();
+		void clear();
+		int getPendingCount() const { return pending.length(); }
+
+	signals:
+		void fileInfoReady(const InputFileItemPtr item);
+
+	private:
+		struct Worker {
+			QProcess *process;
+			QTimer *watchdog;
+			QByteArray buffer;
+			QList<FileScheduler::Job> inFlight;
+			bool hung;
+			bool discarded;
+		};
+
+		QVector<Worker *> workers;
+		FileScheduler pending;
+		bool shuttingDown;
+		int maxWorkers;
+		qint64 timeBudget;
+		qint64 byteBudget;
+
+		Worker *startWorker();
+		void stopWorker(Worker *worker);
+		void dispatch();
+		void dispatch(Worker *worker);
+		void readResults(Worker *worker);
+		void workerFinished(Worker *worker);
+		void workerFailedToStart(Worker *worker);
+		void releaseInFlight(Worker *worker);
+};
+
+#endif // WORKERPOOL_H